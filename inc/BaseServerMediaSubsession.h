@@ -25,19 +25,25 @@
 
 // v4l2rtspserver
 #include "V4L2DeviceSource.h"
+#include "FrameReplicator.h"
+#include "BatchGroupsock.h"
 #include "logger.h"
 
 #ifdef HAVE_ALSA
 #include "ALSACapture.h"
 #endif
 
+// RTP packet sizes from the minimum IPv4 datagram to the largest UDP payload
+#define RTP_PACKET_SIZE_MIN 576
+#define RTP_PACKET_SIZE_MAX 65507
+
 // ---------------------------------
 //   BaseServerMediaSubsession
 // ---------------------------------
 class BaseServerMediaSubsession
 {
 public:
-    BaseServerMediaSubsession(StreamReplicator *replicator) : m_replicator(replicator)
+    BaseServerMediaSubsession(FrameReplicator *replicator) : m_replicator(replicator), m_auxSDPLineVersion(0), m_auxSDPLinePayloadType(-1)
     {
         V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(replicator->inputSource());
         if (deviceSource)
@@ -138,7 +144,25 @@ public:
     static RTPSink *createSink(UsageEnvironment &env, Groupsock *rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, const std::string &format, V4L2DeviceSource *source);
     char const *getAuxLine(V4L2DeviceSource *source, RTPSink *rtpSink);
 
-    std::string getLastFrame() const
+    // RTP packet size, larger than the default for LANs with jumbo frames, false when out of range
+    static bool setRtpPacketSize(int rtpPacketSize)
+    {
+        if ((rtpPacketSize < RTP_PACKET_SIZE_MIN) || (rtpPacketSize > RTP_PACKET_SIZE_MAX))
+        {
+            return false;
+        }
+        m_rtpPacketSize = rtpPacketSize;
+        return true;
+    }
+
+    // version of the SDP parameters of the source, changes when the parameter sets change
+    unsigned int getAuxLineVersion() const
+    {
+        V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+        return deviceSource ? deviceSource->getAuxLineVersion() : 0;
+    }
+
+    std::shared_ptr<const FrameSnapshot> getLastFrame() const
     {
         V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
         if (deviceSource)
@@ -147,13 +171,38 @@ public:
         }
         else
         {
-            return "";
+            return std::shared_ptr<const FrameSnapshot>();
         }
     }
 
+    // a snapshot resumes a paused capture, true when the source captures lazily
+    bool wakeCapture()
+    {
+        V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+        return deviceSource ? deviceSource->wakeCapture() : false;
+    }
+
     std::string getFormat() const { return m_format; }
 
+    // keyframe asked by a client, on RTSP PLAY or RTCP PLI/FIR
+    void requestKeyFrame(const char *reason)
+    {
+        V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+        if (deviceSource)
+        {
+            deviceSource->requestKeyFrame(reason);
+        }
+    }
+    static void rtcpKeyFrameRequest(void *clientData) { ((BaseServerMediaSubsession *)clientData)->requestKeyFrame("rtcp"); }
+
 protected:
-    StreamReplicator *m_replicator;
+    FrameReplicator *m_replicator;
     std::string m_format;
+
+    // SDP fragment built from the source parameters, rebuilt when their version changes
+    std::string m_auxSDPLine;
+    unsigned int m_auxSDPLineVersion;
+    int m_auxSDPLinePayloadType;
+
+    static unsigned int m_rtpPacketSize;
 };
@@ -0,0 +1,145 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** BatchGroupsock.h
+**
+** Groupsock that sends the RTP packets of a frame with one sendmmsg
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+// live555
+#include <liveMedia.hh>
+
+#include "RTCPFeedbackGroupsock.h"
+
+#define RTP_BATCH_MAX_PACKETS 64
+#define RTP_BATCH_FLUSH_DELAY_US 1000
+
+// ---------------------------------
+// RTP sending of the unicast and multicast subsessions
+// ---------------------------------
+struct RtpSendOptions
+{
+	enum PacingMode
+	{
+		PACING_NONE = 0,
+		PACING_TXTIME, // departure time of each packet given to the fq qdisc
+		PACING_BUCKET  // packets sent from a timer in the event loop
+	};
+
+	RtpSendOptions() : m_batch(false), m_pacing(PACING_NONE) {};
+
+	// false for another name than txtime or bucket
+	static bool decodePacing(const std::string &name, PacingMode &pacing)
+	{
+		bool decoded = true;
+		if (name == "txtime")
+		{
+			pacing = PACING_TXTIME;
+		}
+		else if (name == "bucket")
+		{
+			pacing = PACING_BUCKET;
+		}
+		else
+		{
+			decoded = false;
+		}
+		return decoded;
+	}
+
+	// batching and pacing need the groupsocks of live555 2020.12
+	static bool isSupported() { return (LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800); }
+	bool isEnabled() const { return m_batch || (m_pacing != PACING_NONE); }
+
+	bool m_batch;
+	PacingMode m_pacing;
+};
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800
+// ---------------------------------
+// packets are kept until the RTP marker bit, then sent with sendmmsg and UDP GSO when available
+// with pacing, the packets of a frame are spread over the frame interval
+// ---------------------------------
+class BatchGroupsock : public RTCPFeedbackGroupsock
+{
+public:
+	typedef RtpSendOptions::PacingMode PacingMode;
+
+public:
+	// create a BatchGroupsock when batching or pacing is enabled, a RTCPFeedbackGroupsock otherwise
+	static RTCPFeedbackGroupsock *createNew(UsageEnvironment &env, struct sockaddr_storage const &groupAddress, Port port, u_int8_t ttl, const RtpSendOptions &options);
+	virtual ~BatchGroupsock();
+
+protected:
+	BatchGroupsock(UsageEnvironment &env, struct sockaddr_storage const &groupAddress, Port port, u_int8_t ttl, PacingMode pacing);
+
+	// override OutputSocket, called for each destination of a packet
+	virtual Boolean write(struct sockaddr_storage const &addressAndPort, u_int8_t ttl, unsigned char *buffer, unsigned bufferSize);
+
+	static void flushStub(void *clientData)
+	{
+		BatchGroupsock *groupsock = (BatchGroupsock *)clientData;
+		groupsock->m_flushTask = NULL;
+		groupsock->flush();
+	}
+	void flush();
+
+	static void sendDuePacketsStub(void *clientData)
+	{
+		BatchGroupsock *groupsock = (BatchGroupsock *)clientData;
+		groupsock->m_pacingTask = NULL;
+		groupsock->sendDuePackets();
+	}
+	void sendDuePackets();
+	void sendPackets(size_t firstPacket, size_t lastPacket);
+
+	void measureFrame(int64_t now, size_t frameBytes);
+	void schedulePackets(int64_t now, size_t frameBytes);
+	void compact();
+	void setTTL(int family, u_int8_t ttl);
+	static int64_t now();
+
+protected:
+	struct Packet
+	{
+		size_t m_offset;
+		unsigned int m_size;
+		int64_t m_departure;
+		struct sockaddr_storage m_destination;
+	};
+
+	// packets before m_sentPackets are sent, packets before m_timedPackets have a departure time
+	std::vector<unsigned char> m_buffer;
+	std::vector<Packet> m_packets;
+	size_t m_sentPackets;
+	size_t m_timedPackets;
+	int m_ttl;
+	bool m_gso;
+	TaskToken m_flushTask;
+	bool m_endOfFrame;
+
+	// pacing from the measured stream
+	PacingMode m_pacingMode;
+	TaskToken m_pacingTask;
+	int64_t m_lastFrameTime;
+	int64_t m_frameInterval;
+	double m_byteRate;
+	int64_t m_nextDeparture;
+	double m_stagger;
+	unsigned int m_sendBufferSize;
+
+	unsigned long m_frames;
+	unsigned long m_packetCount;
+	unsigned long m_syscalls;
+};
+#endif
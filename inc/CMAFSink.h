@@ -0,0 +1,93 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CMAFSink.h
+**
+** Implement a live555 Sink that store fragmented MP4 (CMAF) segments in memory
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <list>
+#include <string>
+#include <vector>
+
+#include "MemoryBufferSink.h"
+#include "V4L2DeviceSource.h"
+
+#define CMAF_TIMESCALE 90000
+
+// ---------------------------------
+// H264/H265 NAL units are packed in one fragment (moof+mdat) per part, segments are the concatenation of their parts
+// ---------------------------------
+class CMAFSink : public MemoryBufferSink
+{
+public:
+	static CMAFSink *createNew(UsageEnvironment &env, const std::string &format, V4L2DeviceSource *device, unsigned int chunkSize, unsigned int sliceDuration, unsigned int partDuration = 0, unsigned int nbSlices = 5)
+	{
+		return new CMAFSink(env, format, device, chunkSize, sliceDuration, partDuration, nbSlices);
+	}
+
+	virtual const char *getContentType() { return "video/mp4"; }
+	virtual std::string getCodecs();
+	virtual std::shared_ptr<const MemorySegment> getInitSegment();
+
+	// RFC 6381 codecs parameter from the SPS, with or without start code
+	static std::string getCodecs(const std::string &format, const std::string &sps);
+
+protected:
+	CMAFSink(UsageEnvironment &env, const std::string &format, V4L2DeviceSource *device, unsigned int chunkSize, unsigned int sliceDuration, unsigned int partDuration, unsigned int nbSlices);
+	virtual ~CMAFSink();
+
+	virtual Boolean continuePlaying();
+
+	static void afterGettingNal(void *clientData, unsigned frameSize,
+								unsigned numTruncatedBytes,
+								struct timeval presentationTime,
+								unsigned durationInMicroseconds)
+	{
+		CMAFSink *sink = (CMAFSink *)clientData;
+		sink->afterGettingNal(frameSize, numTruncatedBytes, presentationTime);
+	}
+	void afterGettingNal(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+
+	void endAccessUnit(double nextTime);
+	void flushFragment();
+	void appendBytes(const char *data, size_t size, std::vector<MemorySegment::Span> &spans);
+	std::string createInitSegment();
+
+protected:
+	struct Sample
+	{
+		uint32_t m_duration;
+		uint32_t m_size;
+		bool m_keyFrame;
+	};
+
+	std::string m_format;
+	V4L2DeviceSource *m_device;
+	unsigned char *m_buffer;
+	unsigned int m_bufferSize;
+
+	// parameter sets seen in the stream, the init segment is built again when they change
+	std::string m_vps;
+	std::string m_sps;
+	std::string m_pps;
+	std::shared_ptr<const MemorySegment> m_init;
+
+	// access unit in progress
+	std::vector<MemorySegment::Span> m_accessUnitSpans;
+	uint32_t m_accessUnitSize;
+
+	// samples of the next fragment
+	std::vector<Sample> m_samples;
+	std::vector<MemorySegment::Span> m_samplesSpans;
+	size_t m_samplesSize;
+	double m_fragmentTime;
+	uint32_t m_fragmentSequence;
+};
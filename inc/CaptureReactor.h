@@ -0,0 +1,80 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CaptureReactor.h
+**
+** epoll based capture threads shared by all the devices
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <time.h>
+
+#include <map>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// ---------------------------------
+// a fixed set of threads, each one waiting on many device fds
+// ---------------------------------
+class CaptureReactor
+{
+public:
+	// read one frame, same return value than read()
+	typedef int(ReadHandler)(void *clientData);
+
+public:
+	static CaptureReactor *getInstance();
+
+	// process-wide settings, to call before the first device is added
+	static void setThreads(unsigned int nbThreads, const std::vector<int> &cpus) { m_nbThreads = nbThreads; m_cpus = cpus; }
+	static void setRealtimePriority(int priority) { m_priority = priority; }
+	static void setStallTimeout(unsigned int stallTimeoutMs) { m_stallTimeoutMs = stallTimeoutMs; }
+
+	bool addDevice(int fd, ReadHandler *handler, void *clientData);
+	void removeDevice(int fd);
+
+protected:
+	struct Device
+	{
+		int m_fd;
+		ReadHandler *m_handler;
+		void *m_clientData;
+		timespec m_lastFrame;
+		bool m_stalled;
+		bool m_failed;
+	};
+
+	struct Worker
+	{
+		Worker() : m_epollFd(-1), m_timerFd(-1), m_cpu(-1) {}
+		int m_epollFd;
+		int m_timerFd;
+		int m_cpu;
+		std::mutex m_mutex; // protect the devices against removal while a frame is read
+		std::map<int, Device> m_devices;
+		std::thread m_thread;
+	};
+
+protected:
+	CaptureReactor();
+
+	void thread(Worker *worker);
+	void readDevice(Worker *worker, Device &device);
+	void checkDevices(Worker *worker);
+
+protected:
+	std::vector<Worker *> m_workers;
+	std::mutex m_mutex;
+	std::map<int, Worker *> m_deviceWorker;
+	unsigned int m_nextWorker;
+
+	static unsigned int m_nbThreads;
+	static std::vector<int> m_cpus;
+	static int m_priority;
+	static unsigned int m_stallTimeoutMs;
+};
@@ -27,5 +27,11 @@ public:
 	virtual int getChannels() { return -1; }
 	virtual int getAudioFormat() { return -1; }
 	virtual std::list<int> getAudioFormatList() { return std::list<int>(); }
+	// ask the encoder for a keyframe, false when the device cannot and it is not asked again
+	// called from the capture with the coalesced requests, at most once per keyframe request interval
+	virtual bool requestKeyFrame() { return false; }
+	// pause and resume the capture keeping the buffers, false when the device cannot
+	virtual bool stopCapture() { return false; }
+	virtual bool startCapture() { return false; }
 	virtual ~DeviceInterface() {};
 };
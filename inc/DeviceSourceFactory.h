@@ -16,32 +16,33 @@
 #include "V4L2DeviceSource.h"
 #include "H264_V4l2DeviceSource.h"
 #include "H265_V4l2DeviceSource.h"
+#include "FrameReplicator.h"
 
 class DeviceSourceFactory
 {
 public:
-    static FramedSource *createFramedSource(UsageEnvironment *env, int format, DeviceInterface *devCapture, int queueSize = 5, V4L2DeviceSource::CaptureMode captureMode = V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, int outfd = -1, bool repeatConfig = true)
+    static V4L2DeviceSource *createFramedSource(UsageEnvironment *env, int format, DeviceInterface *devCapture, int queueSize = 5, V4L2DeviceSource::CaptureMode captureMode = V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, int outfd = -1, bool repeatConfig = true, const V4L2DeviceSource::CaptureOptions &options = V4L2DeviceSource::CaptureOptions())
     {
-        FramedSource *source = NULL;
+        V4L2DeviceSource *source = NULL;
         if (format == V4L2_PIX_FMT_H264)
         {
-            source = H264_V4L2DeviceSource::createNew(*env, devCapture, outfd, queueSize, captureMode, repeatConfig, false);
+            source = H264_V4L2DeviceSource::createNew(*env, devCapture, outfd, queueSize, captureMode, repeatConfig, false, options);
         }
         else if (format == V4L2_PIX_FMT_HEVC)
         {
-            source = H265_V4L2DeviceSource::createNew(*env, devCapture, outfd, queueSize, captureMode, repeatConfig, false);
+            source = H265_V4L2DeviceSource::createNew(*env, devCapture, outfd, queueSize, captureMode, repeatConfig, false, options);
         }
         else
         {
-            source = V4L2DeviceSource::createNew(*env, devCapture, outfd, queueSize, captureMode);
+            source = V4L2DeviceSource::createNew(*env, devCapture, outfd, queueSize, captureMode, options);
         }
         return source;
     }
 
-    static StreamReplicator *createStreamReplicator(UsageEnvironment *env, int format, DeviceInterface *devCapture, int queueSize = 5, V4L2DeviceSource::CaptureMode captureMode = V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, int outfd = -1, bool repeatConfig = true)
+    static FrameReplicator *createFrameReplicator(UsageEnvironment *env, int format, DeviceInterface *devCapture, int queueSize = 5, V4L2DeviceSource::CaptureMode captureMode = V4L2DeviceSource::CAPTURE_INTERNAL_THREAD, int outfd = -1, bool repeatConfig = true, const V4L2DeviceSource::CaptureOptions &options = V4L2DeviceSource::CaptureOptions())
     {
-        StreamReplicator *replicator = NULL;
-        FramedSource *framedSource = DeviceSourceFactory::createFramedSource(env, format, devCapture, queueSize, captureMode, outfd, repeatConfig);
+        FrameReplicator *replicator = NULL;
+        V4L2DeviceSource *framedSource = DeviceSourceFactory::createFramedSource(env, format, devCapture, queueSize, captureMode, outfd, repeatConfig, options);
         if (framedSource != NULL)
         {
             // extend buffer size if needed
@@ -49,7 +50,8 @@ public:
             {
                 OutPacketBuffer::maxSize = devCapture->getBufferSize();
             }
-            replicator = StreamReplicator::createNew(*env, framedSource, false);
+            // replicas share the captured frames instead of copying them
+            replicator = FrameReplicator::createNew(*env, framedSource);
         }
         return replicator;
     }
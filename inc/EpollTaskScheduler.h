@@ -0,0 +1,96 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** EpollTaskScheduler.h
+**
+** live555 TaskScheduler based on epoll
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <atomic>
+#include <queue>
+#include <set>
+#include <unordered_set>
+#include <vector>
+
+// live555
+#include <BasicUsageEnvironment.hh>
+
+#define EPOLL_SCHEDULER_MAX_EVENT_TRIGGERS 32
+
+// ---------------------------------
+// drop-in replacement of BasicTaskScheduler without the select() limits
+// ---------------------------------
+class EpollTaskScheduler : public BasicTaskScheduler0
+{
+public:
+	static EpollTaskScheduler *createNew();
+	virtual ~EpollTaskScheduler();
+
+	// delayed tasks
+	virtual TaskToken scheduleDelayedTask(int64_t microseconds, TaskFunc *proc, void *clientData);
+	virtual void unscheduleDelayedTask(TaskToken &prevTask);
+
+	// event triggers, a trigger wakes up epoll_wait
+	virtual EventTriggerId createEventTrigger(TaskFunc *eventHandlerProc);
+	virtual void deleteEventTrigger(EventTriggerId eventTriggerId);
+	virtual void triggerEvent(EventTriggerId eventTriggerId, void *clientData = NULL);
+
+	// sockets
+	virtual void setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc *handlerProc, void *clientData);
+	virtual void moveSocketHandling(int oldSocketNum, int newSocketNum);
+
+protected:
+	EpollTaskScheduler(int epollFd, int eventFd);
+
+	virtual void SingleStep(unsigned maxDelayTime);
+
+	static int64_t now();
+	void handleTriggers();
+	void handleDelayedTasks();
+	void compactDelayedTasks();
+
+protected:
+	struct Handler
+	{
+		Handler() : m_conditionSet(0), m_handlerProc(NULL), m_clientData(NULL), m_alwaysReady(false) {}
+		int m_conditionSet;
+		BackgroundHandlerProc *m_handlerProc;
+		void *m_clientData;
+		bool m_alwaysReady;
+	};
+
+	struct DelayedTask
+	{
+		int64_t m_time;
+		uintptr_t m_id;
+		TaskFunc *m_proc;
+		void *m_clientData;
+		bool operator>(const DelayedTask &other) const { return (m_time > other.m_time) || ((m_time == other.m_time) && (m_id > other.m_id)); }
+	};
+
+	struct Trigger
+	{
+		Trigger() : m_handlerProc(NULL), m_clientData(NULL), m_pending(false) {}
+		TaskFunc *m_handlerProc;
+		std::atomic<void *> m_clientData;
+		std::atomic<bool> m_pending;
+	};
+
+protected:
+	int m_epollFd;
+	int m_eventFd;
+	std::vector<Handler> m_handlers; // indexed by socket
+	std::set<int> m_alwaysReady;
+	std::priority_queue<DelayedTask, std::vector<DelayedTask>, std::greater<DelayedTask>> m_delayedTasks;
+	std::unordered_set<uintptr_t> m_scheduledTasks; // unscheduled tasks stay in the heap until they expire
+	uintptr_t m_lastTaskId;
+	Trigger m_triggers[EPOLL_SCHEDULER_MAX_EVENT_TRIGGERS];
+	std::atomic<bool> m_triggerPending;
+};
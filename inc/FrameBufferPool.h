@@ -0,0 +1,97 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameBufferPool.h
+**
+** Pool of reusable capture buffers
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// ---------------------------------
+// Pool of capture buffers
+// ---------------------------------
+class FrameBufferPool
+{
+public:
+	// ---------------------------------
+	// Reference counted buffer
+	// ---------------------------------
+	class Buffer
+	{
+		friend class FrameBufferPool;
+
+	public:
+		char *data() { return m_data; }
+		size_t capacity() { return m_capacity; }
+		void setSize(size_t size) { m_size = size; }
+		size_t size() { return m_size; }
+
+		void addRef() { m_refCount.fetch_add(1, std::memory_order_relaxed); }
+		void release();
+
+	protected:
+		Buffer(FrameBufferPool *pool, char *data, size_t capacity, size_t mappedSize) : m_pool(pool), m_data(data), m_capacity(capacity), m_mappedSize(mappedSize), m_size(0), m_refCount(0) {}
+
+	protected:
+		FrameBufferPool *m_pool;
+		char *m_data;
+		size_t m_capacity;
+		size_t m_mappedSize;
+		size_t m_size;
+		std::atomic<int> m_refCount;
+	};
+
+public:
+	static FrameBufferPool *createNew(size_t bufferSize, unsigned int nbBuffers)
+	{
+		return new FrameBufferPool(bufferSize, nbBuffers);
+	}
+	// release the pool, it is deleted once all buffers came back
+	void close();
+
+	// get a buffer with one reference
+	Buffer *acquire();
+	// keep more free buffers, for a consumer that holds frames longer than the queue
+	void addBuffers(unsigned int nbBuffers);
+
+	unsigned long getHits() { return m_hits; }
+	unsigned long getMisses() { return m_misses; }
+	size_t getBufferSize() { return m_bufferSize; }
+
+	// process-wide allocation settings
+	static void setHugePages(bool hugePages) { m_hugePages = hugePages; }
+	static void setPrefault(bool prefault) { m_prefault = prefault; }
+
+protected:
+	FrameBufferPool(size_t bufferSize, unsigned int nbBuffers);
+	~FrameBufferPool();
+
+	Buffer *allocate(size_t prefaultSize);
+	void free(Buffer *buffer);
+	void recycle(Buffer *buffer);
+	void prefault(Buffer *buffer, size_t size);
+
+protected:
+	std::mutex m_mutex;
+	std::vector<Buffer *> m_freeList;
+	size_t m_bufferSize;
+	unsigned int m_nbBuffers;
+	unsigned int m_outstanding;
+	bool m_closed;
+	size_t m_highWaterMark;
+	std::atomic<unsigned long> m_hits;
+	std::atomic<unsigned long> m_misses;
+
+	static bool m_hugePages;
+	static bool m_prefault;
+};
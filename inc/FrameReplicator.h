@@ -0,0 +1,114 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameReplicator.h
+**
+** Fan-out of the frames of a V4L2DeviceSource to several consumers
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <deque>
+#include <mutex>
+#include <vector>
+
+// live555
+#include <liveMedia.hh>
+
+#include "V4L2DeviceSource.h"
+#include "GopCache.h"
+
+class FrameReplicator;
+
+// ---------------------------------
+// one consumer, reads the shared frames at its own pace
+// ---------------------------------
+class FrameReplica : public FramedSource
+{
+	friend class FrameReplicator;
+
+protected:
+	FrameReplica(UsageEnvironment &env, FrameReplicator *replicator, unsigned int maxAccessUnits);
+	virtual ~FrameReplica();
+
+	void pushFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit);
+	void deliverFrame();
+	static void deliverFrameStub(void *clientData) { ((FrameReplica *)clientData)->deliverTask(); }
+	void deliverTask();
+	void resync();
+	// start with the cached GOP, the next frames already in it are skipped
+	void prime(const std::vector<V4L2DeviceSource::FrameRef> &frames, size_t skipFrames);
+
+	// overide FramedSource
+	virtual void doGetNextFrame();
+	virtual void doStopGettingFrames();
+
+protected:
+	FrameReplicator *m_replicator;
+	std::deque<V4L2DeviceSource::FrameRef> m_queue;
+	unsigned int m_queuedAccessUnits;
+	unsigned int m_maxAccessUnits;
+	bool m_interFrames; // without inter prediction a consumer starts at any access unit
+	bool m_waitKeyFrame;
+	unsigned long m_dropped;
+	unsigned int m_primedAccessUnits;
+	size_t m_skipFrames;
+	TaskToken m_deliverTask; // queued frames are read from the event loop, not from the consumer callback
+};
+
+// ---------------------------------
+// replicator that shares reference counted frames between its replicas
+// ---------------------------------
+class FrameReplicator : public Medium
+{
+	friend class FrameReplica;
+
+public:
+	static FrameReplicator *createNew(UsageEnvironment &env, V4L2DeviceSource *source)
+	{
+		return new FrameReplicator(env, source);
+	}
+
+	// replicator of the same frames for another event loop, to close before this one
+	FrameReplicator *createMirror(UsageEnvironment &env);
+
+	FramedSource *inputSource() { return m_source; }
+	// RTP consumers play the cached GOP at once, segmenters keep its capture timestamps
+	FramedSource *createStreamReplica(bool rebaseGop = true);
+
+protected:
+	FrameReplicator(UsageEnvironment &env, V4L2DeviceSource *source, FrameReplicator *parent = NULL);
+	virtual ~FrameReplicator();
+
+	static void incomingFrameStub(void *clientData, const V4L2DeviceSource::FrameRef &frame) { ((FrameReplicator *)clientData)->incomingFrame(frame); }
+	void incomingFrame(const V4L2DeviceSource::FrameRef &frame);
+	void dispatchFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit);
+	void removeReplica(FrameReplica *replica);
+	void getGopFrames(std::vector<V4L2DeviceSource::FrameRef> &frames, size_t &skipFrames, bool rebase);
+
+	// mirror side, frames are posted from the thread of the parent
+	void postFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit);
+	static void pendingFramesStub(void *clientData) { ((FrameReplicator *)clientData)->pendingFrames(); }
+	void pendingFrames();
+
+protected:
+	V4L2DeviceSource *m_source;
+	std::vector<FrameReplica *> m_replicas;
+	bool m_startOfAccessUnit;
+
+	// GOP of the source, read by the mirrors under the lock of the mirrors
+	bool m_gopCacheEnabled;
+	GopCache m_gopCache;
+
+	FrameReplicator *m_parent;
+	std::mutex m_mirrorsMutex;
+	std::vector<FrameReplicator *> m_mirrors;
+
+	std::mutex m_pendingMutex;
+	std::deque<std::pair<V4L2DeviceSource::FrameRef, bool>> m_pending;
+	bool m_pendingOverflow;
+	EventTriggerId m_pendingTrigger;
+};
@@ -0,0 +1,131 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameRing.h
+**
+** Bounded single producer/single consumer ring
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <atomic>
+#include <utility>
+
+#define FRAME_RING_CACHE_LINE 64
+
+// ---------------------------------
+// lock-free ring between one producer thread and one consumer thread
+// ---------------------------------
+template <typename T>
+class FrameRing
+{
+	struct alignas(FRAME_RING_CACHE_LINE) Slot
+	{
+		T m_value;
+	};
+
+public:
+	FrameRing(size_t capacity) : m_mask(0), m_slots(NULL), m_head(0), m_tail(0), m_staged(0), m_dropped(0), m_droppedBytes(0)
+	{
+		size_t size = 1;
+		while (size < capacity)
+		{
+			size <<= 1;
+		}
+		m_mask = size - 1;
+		m_slots = new Slot[size];
+	}
+	~FrameRing()
+	{
+		delete[] m_slots;
+	}
+
+	size_t capacity() const { return m_mask + 1; }
+
+	// number of items, exact from the consumer side, an upper bound from the producer side
+	size_t size() const
+	{
+		return m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire);
+	}
+	bool empty() const { return size() == 0; }
+
+	// producer side, staged items are published together by commit()
+	bool stage(T &&value)
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed) + m_staged;
+		if (tail - m_head.load(std::memory_order_acquire) > m_mask)
+		{
+			return false;
+		}
+		m_slots[tail & m_mask].m_value = std::move(value);
+		m_staged++;
+		return true;
+	}
+	void commit()
+	{
+		m_tail.store(m_tail.load(std::memory_order_relaxed) + m_staged, std::memory_order_release);
+		m_staged = 0;
+	}
+	void rollback()
+	{
+		size_t tail = m_tail.load(std::memory_order_relaxed);
+		for (size_t i = 0; i < m_staged; i++)
+		{
+			m_slots[(tail + i) & m_mask].m_value = T();
+		}
+		m_staged = 0;
+	}
+	bool push(T &&value)
+	{
+		bool ret = this->stage(std::move(value));
+		if (ret)
+		{
+			this->commit();
+		}
+		return ret;
+	}
+
+	// consumer side
+	T *front()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		if (head == m_tail.load(std::memory_order_acquire))
+		{
+			return NULL;
+		}
+		return &m_slots[head & m_mask].m_value;
+	}
+	void pop()
+	{
+		size_t head = m_head.load(std::memory_order_relaxed);
+		m_slots[head & m_mask].m_value = T();
+		m_head.store(head + 1, std::memory_order_release);
+	}
+
+	// drop accounting, updated by the producer
+	void notifyDrop(size_t bytes)
+	{
+		m_dropped.fetch_add(1, std::memory_order_relaxed);
+		m_droppedBytes.fetch_add(bytes, std::memory_order_relaxed);
+	}
+	unsigned long getDropped() const { return m_dropped.load(std::memory_order_relaxed); }
+	unsigned long getDroppedBytes() const { return m_droppedBytes.load(std::memory_order_relaxed); }
+
+private:
+	FrameRing(const FrameRing &);
+	FrameRing &operator=(const FrameRing &);
+
+private:
+	size_t m_mask;
+	Slot *m_slots;
+	alignas(FRAME_RING_CACHE_LINE) std::atomic<size_t> m_head;
+	alignas(FRAME_RING_CACHE_LINE) std::atomic<size_t> m_tail;
+	size_t m_staged;
+	alignas(FRAME_RING_CACHE_LINE) std::atomic<unsigned long> m_dropped;
+	std::atomic<unsigned long> m_droppedBytes;
+};
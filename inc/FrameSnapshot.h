@@ -0,0 +1,89 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameSnapshot.h
+**
+** Immutable handle on the last keyframe
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/time.h>
+
+#include <atomic>
+#include <memory>
+#include <string>
+
+#include "FrameBufferPool.h"
+
+// ---------------------------------
+// keyframe kept inside its capture buffer, nothing is copied
+// ---------------------------------
+class FrameSnapshot
+{
+public:
+	// header holds what is needed to decode the frame (parameter sets), it is shared between snapshots
+	FrameSnapshot(FrameBufferPool::Buffer *buffer, const char *data, size_t size, const timeval &timestamp, const std::shared_ptr<const std::string> &header = std::shared_ptr<const std::string>())
+		: m_buffer(buffer), m_data(data), m_size(size), m_timestamp(timestamp), m_header(header)
+	{
+		if (m_buffer)
+			m_buffer->addRef();
+	}
+	~FrameSnapshot()
+	{
+		if (m_buffer)
+			m_buffer->release();
+	}
+
+	const char *getHeader() const { return m_header ? m_header->c_str() : NULL; }
+	size_t getHeaderSize() const { return m_header ? m_header->size() : 0; }
+	const char *getData() const { return m_data; }
+	size_t getDataSize() const { return m_size; }
+	size_t size() const { return this->getHeaderSize() + m_size; }
+	const timeval &getTimestamp() const { return m_timestamp; }
+
+private:
+	FrameSnapshot(const FrameSnapshot &);
+	FrameSnapshot &operator=(const FrameSnapshot &);
+
+private:
+	FrameBufferPool::Buffer *m_buffer;
+	const char *m_data;
+	size_t m_size;
+	timeval m_timestamp;
+	std::shared_ptr<const std::string> m_header;
+};
+
+// ---------------------------------
+// snapshot published by the capture thread and read from any thread
+// ---------------------------------
+class FrameSnapshotHolder
+{
+public:
+	std::shared_ptr<const FrameSnapshot> load() const
+	{
+#ifdef __cpp_lib_atomic_shared_ptr
+		return m_snapshot.load(std::memory_order_acquire);
+#else
+		return std::atomic_load_explicit(&m_snapshot, std::memory_order_acquire);
+#endif
+	}
+	void store(const std::shared_ptr<const FrameSnapshot> &snapshot)
+	{
+#ifdef __cpp_lib_atomic_shared_ptr
+		m_snapshot.store(snapshot, std::memory_order_release);
+#else
+		std::atomic_store_explicit(&m_snapshot, snapshot, std::memory_order_release);
+#endif
+	}
+
+private:
+#ifdef __cpp_lib_atomic_shared_ptr
+	std::atomic<std::shared_ptr<const FrameSnapshot>> m_snapshot;
+#else
+	std::shared_ptr<const FrameSnapshot> m_snapshot;
+#endif
+};
@@ -0,0 +1,58 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** GopCache.h
+**
+** Frames since the last keyframe, to start a new consumer on a decodable picture
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <vector>
+
+#include "V4L2DeviceSource.h"
+
+// a GOP longer than these limits is not cached, new consumers wait for the next keyframe
+#define GOP_CACHE_MAX_ACCESS_UNITS 300
+#define GOP_CACHE_MAX_BYTES (16 * 1024 * 1024)
+// capture buffers held by the cache, the buffer pool of the source keeps as many more
+#define GOP_CACHE_MAX_BUFFERS 64
+// cached access units are replayed this close to each other, the decoder catches up the live edge
+#define GOP_CACHE_REBASE_INTERVAL_US 1000
+// a GOP that did not grow since is not served, the capture was paused
+#define GOP_CACHE_MAX_AGE_MS 2000
+
+// ---------------------------------
+// references on the frames of the current GOP, the frames are not copied
+// ---------------------------------
+class GopCache
+{
+public:
+	GopCache(unsigned int maxAccessUnits = GOP_CACHE_MAX_ACCESS_UNITS, size_t maxBytes = GOP_CACHE_MAX_BYTES, unsigned int maxBuffers = GOP_CACHE_MAX_BUFFERS)
+		: m_maxAccessUnits(maxAccessUnits), m_maxBytes(maxBytes), m_maxBuffers(maxBuffers), m_accessUnits(0), m_bytes(0), m_buffers(0), m_lastBuffer(NULL), m_overflow(false) {}
+
+	void addFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit);
+	void clear();
+
+	// frames from the keyframe, timestamps brought close to the last one when rebased
+	std::vector<V4L2DeviceSource::FrameRef> getFrames(bool rebase = true) const;
+
+	unsigned int getAccessUnits() const { return m_accessUnits; }
+	size_t getBytes() const { return m_bytes; }
+	unsigned int getBuffers() const { return m_buffers; }
+
+protected:
+	unsigned int m_maxAccessUnits;
+	size_t m_maxBytes;
+	unsigned int m_maxBuffers;
+	std::vector<V4L2DeviceSource::FrameRef> m_frames;
+	unsigned int m_accessUnits;
+	size_t m_bytes;
+	// the frames of a capture buffer follow each other
+	unsigned int m_buffers;
+	const FrameBufferPool::Buffer *m_lastBuffer;
+	bool m_overflow;
+};
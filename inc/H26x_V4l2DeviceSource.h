@@ -13,6 +13,7 @@
 
 // project
 #include "V4L2DeviceSource.h"
+#include "StartCodeScanner.h"
 
 // ---------------------------------
 // H264 V4L2 FramedSource
@@ -23,17 +24,36 @@ const char H264shortmarker[] = {0, 0, 1};
 class H26X_V4L2DeviceSource : public V4L2DeviceSource
 {
 protected:
-	H26X_V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, bool repeatConfig, bool keepMarker)
-		: V4L2DeviceSource(env, device, outputFd, queueSize, captureMode), m_repeatConfig(repeatConfig), m_keepMarker(keepMarker) {}
+	// immutable, a new buffer is allocated when the parameter set changes, repeated frames keep the previous one alive
+	typedef std::shared_ptr<const std::string> ParameterSet;
+
+
+	H26X_V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, bool repeatConfig, bool keepMarker, const CaptureOptions &options)
+		: V4L2DeviceSource(env, device, outputFd, queueSize, captureMode, options), m_repeatConfig(repeatConfig), m_keepMarker(keepMarker), m_parameterSetsChanged(false) {}
 
 	virtual ~H26X_V4L2DeviceSource() {}
 
-	unsigned char *extractFrame(unsigned char *frame, size_t &size, size_t &outsize, int &frameType);
-	std::string getFrameWithMarker(const std::string &frame);
+public:
+	virtual bool hasInterFrames() { return true; }
+
+protected:
+	const std::vector<StartCodeScanner::NalUnit> &extractFrames(unsigned char *frame, size_t size);
+	std::string getFrameWithMarker(const ParameterSet &frame);
+	static const unsigned char *getNalHeader(const char *buffer, int size);
+	bool updateParameterSet(ParameterSet &parameterSet, const unsigned char *buffer, size_t size);
+	void clearParameterSet(ParameterSet &parameterSet);
+	virtual std::shared_ptr<const std::string> getFrameOwner(const unsigned char *frame);
+	void updateSnapshotHeader();
+	virtual void updateLastFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref);
 
 protected:
-	std::string m_sps;
-	std::string m_pps;
+	ParameterSet m_vps;
+	ParameterSet m_sps;
+	ParameterSet m_pps;
+	std::mutex m_parameterSetsMutex; // protect the pointers read by getInitFrames
 	bool m_repeatConfig;
 	bool m_keepMarker;
+	bool m_parameterSetsChanged; // aux line need to be published
+	StartCodeScanner m_scanner;
+	std::shared_ptr<const std::string> m_snapshotHeader; // parameter sets with start codes
 };
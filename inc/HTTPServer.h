@@ -13,7 +13,10 @@
 
 #pragma once
 
+#include <atomic>
 #include <list>
+#include <memory>
+#include <sstream>
 
 // hacking private members RTSPServer::fWeServeSRTP & RTSPServer::fWeEncryptSRTP
 #define private protected
@@ -22,8 +25,27 @@
 #include "RTSPCommon.hh"
 #include <GroupsockHelper.hh> // for "ignoreSigPipeOnSocket()"
 
+#include "FrameSnapshot.h"
+#include "MemorySegment.h"
+#include "MemoryBufferSink.h"
+#include "StaticFileCache.h"
+
+class TSServerMediaSubsession;
+
 #define TCP_STREAM_SINK_MIN_READ_SIZE 1000
 #define TCP_STREAM_SINK_BUFFER_SIZE 10000
+#define SEGMENT_WRITER_MAX_IOV 64
+// LL-HLS parts are listed for the last segments, requests wait at most a few target durations
+#define HLS_PART_SEGMENTS 3
+#define HLS_BLOCKING_TIMEOUT_FACTOR 3
+// playlist requests of a pipeline just started wait its first segments, then get a 503
+#define HLS_START_TIMEOUT 30
+// playlists are cached a short time by the proxies, segments as long as they are in the playlist
+#define HTTP_PLAYLIST_MAX_AGE 1
+// persistent connections are closed after some idle seconds, pipelined requests are queued up to a limit
+#define HTTP_KEEPALIVE_IDLE_TIMEOUT 15
+#define HTTP_KEEPALIVE_MAX_CONNECTIONS 1024
+#define HTTP_MAX_PIPELINED_REQUESTS 16
 
 class TCPSink : public MediaSink
 {
@@ -133,13 +155,90 @@ private:
 	int fOutputSocketNum;
 };
 
+// ---------------------------------------------------------
+//  Source that streams a snapshot, holding its reference until closed
+// ---------------------------------------------------------
+class FrameSnapshotSource : public FramedSource
+{
+public:
+	static FrameSnapshotSource *createNew(UsageEnvironment &env, const std::shared_ptr<const FrameSnapshot> &snapshot)
+	{
+		return new FrameSnapshotSource(env, snapshot);
+	}
+
+protected:
+	FrameSnapshotSource(UsageEnvironment &env, const std::shared_ptr<const FrameSnapshot> &snapshot) : FramedSource(env), m_snapshot(snapshot), m_offset(0) {}
+
+	virtual void doGetNextFrame()
+	{
+		size_t headerSize = m_snapshot->getHeaderSize();
+		if (m_offset >= m_snapshot->size())
+		{
+			handleClosure();
+			return;
+		}
+
+		// header first, then the keyframe
+		const char *data = NULL;
+		size_t size = 0;
+		if (m_offset < headerSize)
+		{
+			data = m_snapshot->getHeader() + m_offset;
+			size = headerSize - m_offset;
+		}
+		else
+		{
+			data = m_snapshot->getData() + (m_offset - headerSize);
+			size = m_snapshot->size() - m_offset;
+		}
+		fFrameSize = (size > fMaxSize) ? fMaxSize : size;
+		memcpy(fTo, data, fFrameSize);
+		m_offset += fFrameSize;
+		fNumTruncatedBytes = 0;
+		fPresentationTime = m_snapshot->getTimestamp();
+		FramedSource::afterGetting(this);
+	}
+
+private:
+	std::shared_ptr<const FrameSnapshot> m_snapshot;
+	size_t m_offset;
+};
+
+// ---------------------------------------------------------
+//  Send the response header and a segment straight from its chunks
+// ---------------------------------------------------------
+class SegmentWriter
+{
+public:
+	SegmentWriter(UsageEnvironment &env, int socketNum, const std::string &header, const std::shared_ptr<const MemorySegment> &segment, const std::string &trailer, TaskFunc *afterFunc, void *afterClientData);
+	~SegmentWriter();
+
+	void start() { this->write(); }
+
+private:
+	static void socketWritableHandler(void *clientData, int mask) { ((SegmentWriter *)clientData)->write(); }
+	void write();
+
+private:
+	UsageEnvironment &m_env;
+	int m_socketNum;
+	std::string m_header;
+	std::shared_ptr<const MemorySegment> m_segment;
+	std::string m_trailer;
+	size_t m_offset;
+	TaskFunc *m_afterFunc;
+	void *m_afterClientData;
+};
+
 // ---------------------------------------------------------
 //  Extend RTSP server to add support for HLS and MPEG-DASH
 // ---------------------------------------------------------
 #if LIVEMEDIA_LIBRARY_VERSION_INT < 1606435200
 #define SOCKETCLIENT sockaddr_in
+#define SOCKETCLIENTSTORAGE sockaddr_in
 #else
 #define SOCKETCLIENT sockaddr_storage const &
+#define SOCKETCLIENTSTORAGE sockaddr_storage
 #endif
 class HTTPServer : public RTSPServer
 {
@@ -149,33 +248,119 @@ class HTTPServer : public RTSPServer
 	public:
 		HTTPClientConnection(RTSPServer &ourServer, int clientSocket, struct SOCKETCLIENT clientAddr, Boolean useTLS)
 #if LIVEMEDIA_LIBRARY_VERSION_INT >= 1642723200
-			: RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr, useTLS), m_TCPSink(NULL), m_StreamToken(NULL), m_Subsession(NULL), m_Source(NULL)
+			: RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr, useTLS), m_TCPSink(NULL), m_SegmentWriter(NULL), m_StreamToken(NULL), m_Subsession(NULL), m_Source(NULL),
+			  m_RequestUrl(NULL), m_RequestStr(NULL), m_WaitingSink(NULL), m_WaitingTask(NULL), m_WaitingExpired(false),
+			  m_Chunked(false), m_ChunkedFraming(true), m_ChunkedSequence(0), m_ChunkedPart(0),
+			  m_RequestCount(0), m_KeepAlive(false), m_KeepAliveCounted(false), m_NextTask(NULL), m_IdleTask(NULL)
 		{
 #else
-			: RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr), m_TCPSink(NULL), m_StreamToken(NULL), m_Subsession(NULL), m_Source(NULL)
+			: RTSPServer::RTSPClientConnection(ourServer, clientSocket, clientAddr), m_TCPSink(NULL), m_SegmentWriter(NULL), m_StreamToken(NULL), m_Subsession(NULL), m_Source(NULL),
+			  m_RequestUrl(NULL), m_RequestStr(NULL), m_WaitingSink(NULL), m_WaitingTask(NULL), m_WaitingExpired(false),
+			  m_Chunked(false), m_ChunkedFraming(true), m_ChunkedSequence(0), m_ChunkedPart(0),
+			  m_RequestCount(0), m_KeepAlive(false), m_KeepAliveCounted(false), m_NextTask(NULL), m_IdleTask(NULL)
 		{
 #endif
+			((HTTPServer &)ourServer).m_connections++;
 		}
 		virtual ~HTTPClientConnection();
 
 	private:
+		void formatHeader(const char *contentType, unsigned int contentLength, const std::string &headers = std::string(), bool chunked = false);
 		void sendHeader(const char *contentType, unsigned int contentLength);
 		void streamSource(FramedSource *source);
 		void streamSource(const std::string &content);
+		void streamSegment(const char *contentType, const std::shared_ptr<const MemorySegment> &segment, const std::string &headers = std::string());
+		void streamCachedSegment(const char *contentType, const std::shared_ptr<const MemorySegment> &segment, const std::string &etag, const std::string &cacheControl, const std::string &headers = std::string(), time_t lastModified = 0);
+		bool isNotModified(const std::string &etag, time_t lastModified = 0);
+		std::string getRequestHeader(const char *name);
+		void writeSegment(const std::string &header, const std::shared_ptr<const MemorySegment> &segment, const std::string &trailer, TaskFunc *afterFunc);
+		void streamChunkedSegment(const char *streamName, const char *contentType, unsigned int sequence);
+		static void afterChunk(void *clientData);
+		void sendNextChunk();
 		ServerMediaSubsession *getSubsesion(const char *urlSuffix);
+		TSServerMediaSubsession *getHlsSubsession(const char *urlSuffix);
 		bool sendFile(char const *urlSuffix);
-		bool sendM3u8PlayList(char const *urlSuffix);
+		bool sendM3u8PlayList(char const *urlSuffix, char const *query);
 		bool sendMpdPlayList(char const *urlSuffix);
+		static std::string renderM3u8PlayList(char const *urlSuffix, MemoryBufferSink *sink);
+		static std::string renderMpdPlayList(char const *urlSuffix, TSServerMediaSubsession *subsession);
+		void sendBadRequest();
+		void sendServiceUnavailable(unsigned int retryAfter);
+		bool waitForPipeline(TSServerMediaSubsession *subsession);
+		std::string getConnectionHeader();
+		bool isBusy();
+		bool isKeepAliveRequested(const char *fullRequestStr);
+		void updateKeepAlive(const char *fullRequestStr);
+
+		// hold the request until the sink has a new part or segment, 0 waits a few target durations
+		bool waitFor(MemoryBufferSink *sink, unsigned int timeout = 0);
+		static void segmentAvailable(void *clientData);
+		static void waitingTimeout(void *clientData);
+		static void retryRequest(void *clientData);
+		void retryRequest();
 		virtual void handleHTTPCmd_StreamingGET(char const *urlSuffix, char const *fullRequestStr);
+		void handleRequest(char const *urlSuffix, char const *fullRequestStr);
 		virtual void handleCmd_notFound();
 		static void afterStreaming(void *clientData);
 
+		// persistent connection, the next request is handled once the response is sent
+		static void nextRequest(void *clientData);
+		void nextRequest();
+		void responseDone();
+		static void idleTimeout(void *clientData);
+
 	private:
 		static u_int32_t m_ClientSessionId;
 		TCPSink *m_TCPSink;
+		SegmentWriter *m_SegmentWriter;
 		void *m_StreamToken;
 		ServerMediaSubsession *m_Subsession;
 		FramedSource *m_Source;
+
+		// request in progress, replayed when a waited segment is available
+		char const *m_RequestUrl;
+		char const *m_RequestStr;
+		MemoryBufferSink *m_WaitingSink;
+		TaskToken m_WaitingTask;
+		bool m_WaitingExpired;
+		std::string m_WaitingUrl;
+		std::string m_WaitingRequest;
+
+		// segment in progress sent with chunked transfer encoding
+		bool m_Chunked;
+		bool m_ChunkedFraming; // HTTP/1.0 clients get a body delimited by the close of the connection
+		std::string m_ChunkedStream;
+		unsigned int m_ChunkedSequence;
+		unsigned int m_ChunkedPart;
+		std::string m_ChunkedHeader;
+
+		// keep-alive and requests pipelined during a response
+		unsigned int m_RequestCount;
+		bool m_KeepAlive;
+		bool m_KeepAliveCounted;
+		std::list<std::pair<std::string, std::string>> m_PendingRequests;
+		TaskToken m_NextTask;
+		TaskToken m_IdleTask;
+	};
+
+	// accepted connection waiting for its first request to choose the server that handles it
+	class PendingConnection
+	{
+	public:
+		PendingConnection(HTTPServer &ourServer, int clientSocket, struct SOCKETCLIENT clientAddr);
+		~PendingConnection();
+
+		static void incomingRequestHandler(void *clientData, int mask) { ((PendingConnection *)clientData)->incomingRequestHandler(); }
+		void incomingRequestHandler();
+		static void idleTimeout(void *clientData);
+		static void retryPeek(void *clientData);
+
+	private:
+		HTTPServer &m_server;
+		int m_clientSocket;
+		struct SOCKETCLIENTSTORAGE m_clientAddr;
+		TaskToken m_IdleTask;
+		TaskToken m_RetryTask;
 	};
 
 	class HTTPClientSession : public RTSPServer::RTSPClientSession
@@ -228,7 +413,7 @@ class HTTPServer : public RTSPServer
 	};
 
 public:
-	static HTTPServer *createNew(UsageEnvironment &env, Port rtspPort, const std::list<std::string> &userPasswordList, const char *realm, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string &webroot, const std::string &sslCert, bool enableRTSPS)
+	static HTTPServer *createNew(UsageEnvironment &env, Port rtspPort, const std::list<std::string> &userPasswordList, const char *realm, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string &webroot, const std::string &sslCert, bool enableRTSPS, unsigned int keepAliveTimeout = HTTP_KEEPALIVE_IDLE_TIMEOUT, unsigned int keepAliveMaxConnections = HTTP_KEEPALIVE_MAX_CONNECTIONS)
 	{
 		HTTPServer *httpServer = NULL;
 #if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
@@ -245,17 +430,29 @@ public:
 		if (ourSocketIPv4 != -1)
 		{
 			MyUserAuthenticationDatabase *authDatabase = MyUserAuthenticationDatabase::createNew(userPasswordList, realm);
-			httpServer = new HTTPServer(env, ourSocketIPv4, ourSocketIPv6, rtspPort, authDatabase, reclamationTestSeconds, hlsSegment, webroot, sslCert, enableRTSPS);
+			httpServer = new HTTPServer(env, ourSocketIPv4, ourSocketIPv6, rtspPort, authDatabase, reclamationTestSeconds, hlsSegment, webroot, sslCert, enableRTSPS, keepAliveTimeout, keepAliveMaxConnections);
+			// the workers only get RTSP connections, the web UI is served by this server when a webroot is configured
+			if (!webroot.empty())
+			{
+				httpServer->m_staticFiles.reset(StaticFileCache::createNew(env, webroot));
+			}
 		}
 		return httpServer;
 	}
 
+	// server without listening socket, its connections are accepted by another server
+	static HTTPServer *createWorker(UsageEnvironment &env, Port rtspPort, const std::list<std::string> &userPasswordList, const char *realm, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string &webroot, const std::string &sslCert, bool enableRTSPS, unsigned int keepAliveTimeout = HTTP_KEEPALIVE_IDLE_TIMEOUT, unsigned int keepAliveMaxConnections = HTTP_KEEPALIVE_MAX_CONNECTIONS)
+	{
+		MyUserAuthenticationDatabase *authDatabase = MyUserAuthenticationDatabase::createNew(userPasswordList, realm);
+		return new HTTPServer(env, -1, -1, rtspPort, authDatabase, reclamationTestSeconds, hlsSegment, webroot, sslCert, enableRTSPS, keepAliveTimeout, keepAliveMaxConnections);
+	}
+
 #if LIVEMEDIA_LIBRARY_VERSION_INT < 1611187200
-	HTTPServer(UsageEnvironment &env, int ourSocketIPv4, int ourSocketIPv6, Port rtspPort, MyUserAuthenticationDatabase *authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string &webroot, const std::string &sslCert, bool enableRTSPS)
-		: RTSPServer(env, ourSocketIPv4, rtspPort, authDatabase, reclamationTestSeconds), m_hlsSegment(hlsSegment), m_webroot(webroot)
+	HTTPServer(UsageEnvironment &env, int ourSocketIPv4, int ourSocketIPv6, Port rtspPort, MyUserAuthenticationDatabase *authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string &webroot, const std::string &sslCert, bool enableRTSPS, unsigned int keepAliveTimeout, unsigned int keepAliveMaxConnections)
+		: RTSPServer(env, ourSocketIPv4, rtspPort, authDatabase, reclamationTestSeconds), m_hlsSegment(hlsSegment), m_webroot(webroot), m_connections(0), m_connectionHandler(NULL), m_connectionHandlerData(NULL), m_keepAliveTimeout(keepAliveTimeout), m_keepAliveMaxConnections(keepAliveMaxConnections)
 #else
-	HTTPServer(UsageEnvironment &env, int ourSocketIPv4, int ourSocketIPv6, Port rtspPort, MyUserAuthenticationDatabase *authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string &webroot, const std::string &sslCert, bool enableRTSPS)
-		: RTSPServer(env, ourSocketIPv4, ourSocketIPv6, rtspPort, authDatabase, reclamationTestSeconds), m_hlsSegment(hlsSegment), m_webroot(webroot)
+	HTTPServer(UsageEnvironment &env, int ourSocketIPv4, int ourSocketIPv6, Port rtspPort, MyUserAuthenticationDatabase *authDatabase, unsigned reclamationTestSeconds, unsigned int hlsSegment, const std::string &webroot, const std::string &sslCert, bool enableRTSPS, unsigned int keepAliveTimeout, unsigned int keepAliveMaxConnections)
+		: RTSPServer(env, ourSocketIPv4, ourSocketIPv6, rtspPort, authDatabase, reclamationTestSeconds), m_hlsSegment(hlsSegment), m_webroot(webroot), m_connections(0), m_connectionHandler(NULL), m_connectionHandlerData(NULL), m_keepAliveTimeout(keepAliveTimeout), m_keepAliveMaxConnections(keepAliveMaxConnections)
 #endif
 	{
 		if ((!m_webroot.empty()) && (*m_webroot.rend() != '/'))
@@ -265,11 +462,43 @@ public:
 		this->setTLS(sslCert, enableRTSPS);
 	}
 
+	// the handler gets the path of RTSP requests and RTSP over HTTP tunnels, it returns false to keep the connection
+	typedef bool(ConnectionHandler)(void *clientData, int clientSocket, struct SOCKETCLIENT clientAddr, const std::string &path, const std::string &sessionCookie);
+	void setConnectionHandler(ConnectionHandler *handler, void *clientData)
+	{
+		m_connectionHandler = handler;
+		m_connectionHandlerData = clientData;
+	}
+
 	virtual RTSPServer::ClientConnection *createNewClientConnection(int clientSocket, struct SOCKETCLIENT clientAddr)
+	{
+		RTSPServer::ClientConnection *clientConnection = NULL;
+		if (m_connectionHandler != NULL)
+		{
+			PendingConnection *pending = new PendingConnection(*this, clientSocket, clientAddr);
+			envir().taskScheduler().setBackgroundHandling(clientSocket, SOCKET_READABLE | SOCKET_EXCEPTION, PendingConnection::incomingRequestHandler, pending);
+		}
+		else
+		{
+			clientConnection = this->addClientConnection(clientSocket, clientAddr);
+		}
+		return clientConnection;
+	}
+
+	RTSPServer::ClientConnection *addClientConnection(int clientSocket, struct SOCKETCLIENT clientAddr)
 	{
 		return new HTTPClientConnection(*this, clientSocket, clientAddr, isRTSPS());
 	}
 
+	// thread safe, the counter is atomic
+	unsigned int getConnectionCount() { return m_connections; }
+
+	// HTTP requests and the connections that carried them, shared by the workers
+	static unsigned int getHttpRequestCount() { return m_httpRequests; }
+	static unsigned int getHttpConnectionCount() { return m_httpConnections; }
+
+	static void parseRequest(const std::string &request, std::string &path, std::string &sessionCookie);
+
 	virtual RTSPServer::ClientSession *createNewClientSession(u_int32_t sessionId)
 	{
 		return new HTTPClientSession(*this, sessionId);
@@ -360,4 +589,14 @@ public:
 private:
 	const unsigned int m_hlsSegment;
 	std::string m_webroot;
+	std::unique_ptr<StaticFileCache> m_staticFiles;
+	std::atomic<unsigned int> m_connections;
+	ConnectionHandler *m_connectionHandler;
+	void *m_connectionHandlerData;
+	const unsigned int m_keepAliveTimeout; // idle timeout in seconds of the persistent connections, 0 disable keep-alive
+	const unsigned int m_keepAliveMaxConnections;
+
+	static std::atomic<unsigned int> m_keepAliveConnections;
+	static std::atomic<unsigned int> m_httpRequests;
+	static std::atomic<unsigned int> m_httpConnections;
 };
@@ -0,0 +1,47 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** KeyFrameRequester.h
+**
+** Keyframe requests to the encoder of a device
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <sys/time.h>
+
+#include <atomic>
+
+#include "DeviceInterface.h"
+
+// ---------------------------------
+// requests are raised from any thread, coalesced until the next keyframe and sent by the capture at most once per interval
+// ---------------------------------
+class KeyFrameRequester
+{
+public:
+	KeyFrameRequester(DeviceInterface *device, unsigned int intervalMs);
+
+	// thread safe, true when a new request is pending
+	bool request();
+	// the captured keyframe answers the pending request
+	void keyFrameCaptured() { m_requested = false; }
+	// called by the capture, true when the request was sent to the device
+	bool send(const timeval &tv);
+
+	bool isPending() { return m_requested; }
+	// an encoder without the control is not asked again, a transient error is retried
+	bool isSupported() { return m_supported; }
+	unsigned long getRequests() { return m_requests; }
+
+protected:
+	DeviceInterface *m_device;
+	unsigned int m_intervalMs; // 0 disables the requests
+	std::atomic<bool> m_requested;
+	timeval m_lastRequest;
+	std::atomic<bool> m_supported;
+	std::atomic<unsigned long> m_requests;
+};
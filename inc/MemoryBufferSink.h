@@ -5,54 +5,135 @@
 **
 ** MemoryBufferSink.h
 **
-** Implement a live555 Sink that store time slices in memory
+** Implement a live555 Sink that store segments in memory
 **
 ** -------------------------------------------------------------------------*/
 
 #pragma once
 
-#include <string>
+#include <list>
 #include <map>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include "MediaSink.hh"
 
+#include "MemorySegment.h"
+
+// smallest chunk of the arena, a few TS packets
+#define MEMORY_BUFFER_SINK_MIN_CHUNK_SIZE (7 * 188)
+#define MEMORY_BUFFER_SINK_TS_PACKET_SIZE 188
+
+// ---------------------------------
+// segments start on a keyframe once they last the slice duration, they are split in parts for LL-HLS
+// the derived muxers write the segments in the arena
+// ---------------------------------
 class MemoryBufferSink : public MediaSink
 {
+protected:
+	MemoryBufferSink(UsageEnvironment &env, unsigned chunkSize, unsigned int sliceDuration, unsigned int partDuration, unsigned int nbSlices);
+	virtual ~MemoryBufferSink();
+
 public:
-	static MemoryBufferSink *createNew(UsageEnvironment &env, unsigned int bufferSize, unsigned int sliceDuration, unsigned int nbSlices = 5)
+	struct PartInfo
+	{
+		double m_duration;
+		bool m_independent;
+	};
+	struct SegmentInfo
 	{
-		return new MemoryBufferSink(env, bufferSize, sliceDuration, nbSlices);
-	}
+		unsigned int m_sequence;
+		double m_start;
+		double m_duration;
+		size_t m_size;
+		bool m_complete;
+		std::vector<PartInfo> m_parts;
+	};
 
-protected:
-	MemoryBufferSink(UsageEnvironment &env, unsigned bufferSize, unsigned int sliceDuration, unsigned int nbSlices);
-	virtual ~MemoryBufferSink();
+	// container of the segments
+	virtual const char *getContentType() { return "video/mp2t"; }
+	virtual std::string getCodecs() { return std::string(); }
+	virtual std::shared_ptr<const MemorySegment> getInitSegment() { return std::shared_ptr<const MemorySegment>(); }
 
-	virtual Boolean continuePlaying();
+	// the segment keeps its chunks alive, it could be sent while the sink goes on
+	std::shared_ptr<const MemorySegment> getSegment(unsigned int sequence);
+	std::shared_ptr<const MemorySegment> getPart(unsigned int sequence, unsigned int part);
+	std::vector<SegmentInfo> getSegmentList();
+	// sequence of the segment in progress and number of its parts already available
+	unsigned int getCurrentSequence() { return m_sequence; }
+	unsigned int getCurrentParts();
+	// changes each time a part or a segment is added, the playlists are rendered once per version
+	unsigned int getVersion() { return m_version; }
 
-	static void afterGettingFrame(void *clientData, unsigned frameSize,
-								  unsigned numTruncatedBytes,
-								  struct timeval presentationTime,
-								  unsigned durationInMicroseconds)
+	double firstTime();
+	double duration();
+	unsigned int getSliceDuration() { return m_sliceDuration; }
+	unsigned int getPartDuration() { return m_partDuration; }
+	unsigned int getTargetDuration();
+	// wall clock time minus presentation time
+	double getClockOffset() { return m_clockOffset; }
+
+	// waiters are called once, when a part or a segment is available
+	void addWaiter(TaskFunc *func, void *clientData);
+	void removeWaiter(void *clientData);
+
+protected:
+	struct Part : public PartInfo
 	{
-		MemoryBufferSink *sink = (MemoryBufferSink *)clientData;
-		sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
-	}
+		size_t m_offset;
+		size_t m_size;
+		std::shared_ptr<const MemorySegment> m_segment;
+	};
 
-	void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+	// spans of a slice, the segment is built again only when the slice grew
+	struct Slice
+	{
+		Slice() : m_size(0), m_start(0), m_duration(0), m_complete(false), m_partOffset(0), m_partStart(0), m_partIndependent(true) {}
+		std::vector<MemorySegment::Span> m_spans;
+		size_t m_size;
+		std::shared_ptr<const MemorySegment> m_segment;
+		double m_start;
+		double m_duration;
+		bool m_complete;
+		std::vector<Part> m_parts;
+		size_t m_partOffset;
+		double m_partStart;
+		bool m_partIndependent;
+	};
 
-public:
-	unsigned int getBufferSize(unsigned int slice);
-	std::string getBuffer(unsigned int slice);
-	unsigned int firstTime();
-	unsigned int duration();
-	unsigned int getSliceDuration() { return m_sliceDuration; }
+	void onAccessUnit(const timeval &presentationTime, bool keyFrame);
+	void closePart(Slice &slice, size_t offset, double time);
+	void cutSlice(double time, size_t offset);
+	void splitSlice(Slice &slice, size_t offset, Slice &tail);
+	void appendSpan(Slice &slice, const MemorySegment::Span &span);
+	std::shared_ptr<const MemorySegment> createSegment(const Slice &slice, size_t offset, size_t size);
+	// packets inserted at the start of each segment, built again for each segment
+	virtual std::shared_ptr<SegmentArena::Chunk> createSegmentTables() { return std::shared_ptr<SegmentArena::Chunk>(); }
+	void notifyWaiters();
+
+protected:
+	// the source writes in the free part of the current chunk
+	std::shared_ptr<SegmentArena> m_arena;
+	std::shared_ptr<SegmentArena::Chunk> m_chunk;
+	size_t m_chunkUsed;
 
-private:
-	unsigned char *m_buffer;
-	unsigned int m_bufferSize;
-	std::map<unsigned int, std::string> m_outputBuffers;
-	unsigned int m_refTime;
+	// slices by media sequence number, the last one is in progress
+	std::map<unsigned int, Slice> m_outputBuffers;
+	unsigned int m_sequence;
+	unsigned int m_version;
+	bool m_started;
 	unsigned int m_sliceDuration;
+	unsigned int m_partDuration;
 	unsigned int m_nbSlices;
+	double m_maxDuration;
+	double m_clockOffset;
+
+	// access unit in progress
+	bool m_hasAccessUnit;
+	double m_accessUnitTime;
+	size_t m_accessUnitOffset;
+	bool m_accessUnitKey;
+
+	std::list<std::pair<TaskFunc *, void *>> m_waiters;
 };
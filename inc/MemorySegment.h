@@ -0,0 +1,101 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** MemorySegment.h
+**
+** Immutable HLS/DASH segment referencing chunks of an arena
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+#include <mutex>
+#include <vector>
+
+#define SEGMENT_ARENA_CHUNK_SIZE (64 * 1024)
+#define SEGMENT_ARENA_MAX_FREE_CHUNKS 256
+
+// ---------------------------------
+// fixed size chunks, recycled when the last segment referencing them is released
+// ---------------------------------
+class SegmentArena : public std::enable_shared_from_this<SegmentArena>
+{
+public:
+	class Chunk
+	{
+	public:
+		Chunk(size_t capacity) : m_data(new char[capacity]), m_capacity(capacity) {}
+		~Chunk() { delete[] m_data; }
+
+		char *data() { return m_data; }
+		const char *data() const { return m_data; }
+		size_t capacity() const { return m_capacity; }
+
+	private:
+		Chunk(const Chunk &);
+		Chunk &operator=(const Chunk &);
+
+	private:
+		char *m_data;
+		size_t m_capacity;
+	};
+
+public:
+	static std::shared_ptr<SegmentArena> createNew(size_t chunkSize = SEGMENT_ARENA_CHUNK_SIZE, unsigned int maxFreeChunks = SEGMENT_ARENA_MAX_FREE_CHUNKS)
+	{
+		return std::shared_ptr<SegmentArena>(new SegmentArena(chunkSize, maxFreeChunks));
+	}
+	~SegmentArena();
+
+	std::shared_ptr<Chunk> acquire();
+	size_t getChunkSize() { return m_chunkSize; }
+
+protected:
+	SegmentArena(size_t chunkSize, unsigned int maxFreeChunks) : m_chunkSize(chunkSize), m_maxFreeChunks(maxFreeChunks) {}
+
+	static void release(const std::weak_ptr<SegmentArena> &arena, Chunk *chunk);
+
+protected:
+	std::mutex m_mutex;
+	std::vector<Chunk *> m_freeList;
+	size_t m_chunkSize;
+	unsigned int m_maxFreeChunks;
+};
+
+// ---------------------------------
+// bytes of a segment, spans are never written again once they belong to a segment
+// ---------------------------------
+class MemorySegment
+{
+public:
+	struct Span
+	{
+		std::shared_ptr<SegmentArena::Chunk> m_chunk;
+		size_t m_offset;
+		size_t m_size;
+
+		const char *data() const { return m_chunk->data() + m_offset; }
+	};
+
+public:
+	MemorySegment(const std::vector<Span> &spans, size_t size) : m_spans(spans), m_size(size) {}
+	// copy of a rendered content (playlist, init segment)
+	explicit MemorySegment(const std::string &content);
+
+	const std::vector<Span> &getSpans() const { return m_spans; }
+	size_t size() const { return m_size; }
+
+private:
+	MemorySegment(const MemorySegment &);
+	MemorySegment &operator=(const MemorySegment &);
+
+private:
+	std::vector<Span> m_spans;
+	size_t m_size;
+};
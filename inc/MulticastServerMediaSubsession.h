@@ -10,6 +10,7 @@
 #pragma once
 
 #include <map>
+#include <set>
 #include "BaseServerMediaSubsession.h"
 
 // -----------------------------------------
@@ -18,11 +19,12 @@
 class MulticastServerMediaSubsession : public BaseServerMediaSubsession, public PassiveServerMediaSubsession
 {
 public:
-	static MulticastServerMediaSubsession *createNew(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, StreamReplicator *replicator);
+	// alwaysOn: send continuously instead of only while RTSP clients play the session
+	static MulticastServerMediaSubsession *createNew(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, FrameReplicator *replicator, bool alwaysOn = false, const RtpSendOptions &rtpSendOptions = RtpSendOptions());
 
 protected:
-	MulticastServerMediaSubsession(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, StreamReplicator *replicator)
-		: BaseServerMediaSubsession(replicator), PassiveServerMediaSubsession(*this->createRtpSink(env, destinationAddress, rtpPortNum, rtcpPortNum, ttl, replicator), m_rtcpInstance)
+	MulticastServerMediaSubsession(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, FrameReplicator *replicator, bool alwaysOn, const RtpSendOptions &rtpSendOptions)
+		: BaseServerMediaSubsession(replicator), PassiveServerMediaSubsession(*this->createRtpSink(env, destinationAddress, rtpPortNum, rtcpPortNum, ttl, replicator, alwaysOn, rtpSendOptions), m_rtcpInstance), m_SDPLinesVersion(0)
 	{
 	}
 
@@ -32,10 +34,20 @@ protected:
 	virtual char const *sdpLines(int addressFamily);
 #endif
 	virtual char const *getAuxSDPLine(RTPSink *rtpSink, FramedSource *inputSource);
-	RTPSink *createRtpSink(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, StreamReplicator *replicator);
+	virtual void startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData);
+	// called on TEARDOWN and when the session of the client timed out
+	virtual void deleteStream(unsigned clientSessionId, void *&streamToken);
+	RTPSink *createRtpSink(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, FrameReplicator *replicator, bool alwaysOn, const RtpSendOptions &rtpSendOptions);
+	void startSending(UsageEnvironment &env);
+	void stopSending();
 
 protected:
+	// set while building the base class, not in the initializer list
 	RTPSink *m_rtpSink;
 	RTCPInstance *m_rtcpInstance;
+	FramedSource *m_videoSource;
+	bool m_alwaysOn;
+	std::set<unsigned> m_clientSessions;
 	std::map<int, std::string> m_SDPLines;
+	unsigned int m_SDPLinesVersion;
 };
@@ -0,0 +1,47 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTCPFeedbackGroupsock.h
+**
+** Groupsock that reports the keyframe requests (RTCP PLI/FIR) of the clients
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+// live555
+#include <liveMedia.hh>
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800
+// ---------------------------------
+// the packets are still given to the RTCP instance, they are only inspected on the way
+// ---------------------------------
+class RTCPFeedbackGroupsock : public Groupsock
+{
+public:
+	typedef void(KeyFrameRequestHandler)(void *clientData);
+
+public:
+	RTCPFeedbackGroupsock(UsageEnvironment &env, struct sockaddr_storage const &groupAddress, Port port, u_int8_t ttl)
+		: Groupsock(env, groupAddress, port, ttl), m_handler(NULL), m_handlerClientData(NULL) {}
+
+	void setKeyFrameRequestHandler(KeyFrameRequestHandler *handler, void *clientData)
+	{
+		m_handler = handler;
+		m_handlerClientData = clientData;
+	}
+
+	// compound RTCP packet holding a Picture Loss Indication or a Full Intra Request
+	static bool isKeyFrameRequest(const unsigned char *buffer, unsigned size);
+
+protected:
+	// override Groupsock
+	virtual Boolean handleRead(unsigned char *buffer, unsigned bufferMaxSize, unsigned &bytesRead, struct sockaddr_storage &fromAddressAndPort);
+
+protected:
+	KeyFrameRequestHandler *m_handler;
+	void *m_handlerClientData;
+};
+#endif
@@ -0,0 +1,51 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** StartCodeScanner.h
+**
+** Annex-B start code scanner
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stddef.h>
+
+#include <vector>
+
+// ---------------------------------
+// find all the NAL units of an Annex-B buffer in one pass
+// ---------------------------------
+class StartCodeScanner
+{
+public:
+	struct NalUnit
+	{
+		unsigned char *m_marker;	 // start code
+		unsigned int m_markerLength; // 3 or 4
+		unsigned char *m_data;		 // NAL header
+		size_t m_size;				 // size without start code
+		int m_type;					 // first byte of the NAL header
+	};
+
+public:
+	const std::vector<NalUnit> &scan(unsigned char *buffer, size_t size);
+	// NAL units found by the last scan
+	const std::vector<NalUnit> &getNalList() const { return m_nalList; }
+
+	// position of the next 00 00 01 sequence at or after pos, size if none
+	static size_t findStartCode(const unsigned char *buffer, size_t size, size_t pos) { return m_find(buffer, size, pos); }
+	static const char *getImplementation();
+	// force an implementation by name, false when it is unknown or not supported by the CPU
+	static bool setImplementation(const char *name);
+
+protected:
+	typedef size_t (*FindFunction)(const unsigned char *buffer, size_t size, size_t pos);
+	static FindFunction selectImplementation();
+
+protected:
+	std::vector<NalUnit> m_nalList;
+	static FindFunction m_find;
+};
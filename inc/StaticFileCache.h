@@ -0,0 +1,89 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** StaticFileCache.h
+**
+** Files of the webroot held in memory with their precompressed variants
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <time.h>
+
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "UsageEnvironment.hh"
+
+#include "MemorySegment.h"
+
+// the webroot is loaded up to a depth and a size, a change is reloaded after a short delay
+#define STATIC_CACHE_MAX_DEPTH 4
+#define STATIC_CACHE_MAX_SIZE (64 * 1024 * 1024)
+#define STATIC_CACHE_MIN_COMPRESS_SIZE 256
+#define STATIC_CACHE_RELOAD_DELAY_MS 200
+// compression runs in the event loop, moderate levels keep a reload short
+#define STATIC_CACHE_GZIP_LEVEL 6
+#define STATIC_CACHE_BROTLI_QUALITY 5
+
+// ---------------------------------
+// immutable files, a reload builds a new set while the responses in progress keep the old one
+// ---------------------------------
+class StaticFileCache
+{
+public:
+	enum Encoding
+	{
+		ENCODING_IDENTITY,
+		ENCODING_GZIP,
+		ENCODING_BROTLI,
+		ENCODING_COUNT
+	};
+
+	struct File
+	{
+		std::string m_mime;
+		time_t m_lastModified;
+		std::string m_etag;
+		std::shared_ptr<const MemorySegment> m_content[ENCODING_COUNT];
+	};
+
+public:
+	static StaticFileCache *createNew(UsageEnvironment &env, const std::string &webroot)
+	{
+		return new StaticFileCache(env, webroot);
+	}
+	~StaticFileCache();
+
+	// file of an url path, NULL when it is not in the webroot
+	std::shared_ptr<const File> getFile(const std::string &path);
+
+	// best variant of the file accepted by the client
+	static Encoding negotiate(const File &file, const std::string &acceptEncoding);
+	static const char *getEncodingName(Encoding encoding);
+	static std::string getMimeType(const std::string &path);
+
+protected:
+	StaticFileCache(UsageEnvironment &env, const std::string &webroot);
+
+	void load();
+	void loadDirectory(const std::string &directory, const std::string &prefix, unsigned int depth, size_t &totalSize, const std::map<std::string, std::shared_ptr<const File>> &previousFiles, std::map<std::string, std::shared_ptr<const File>> &files);
+	std::shared_ptr<const File> loadFile(const std::string &path, const std::string &name, time_t lastModified);
+
+	static void inotifyHandler(void *clientData, int mask) { ((StaticFileCache *)clientData)->inotifyHandler(); }
+	void inotifyHandler();
+	static void reload(void *clientData);
+
+protected:
+	UsageEnvironment &m_env;
+	std::string m_webroot;
+	std::shared_ptr<const std::map<std::string, std::shared_ptr<const File>>> m_files;
+	int m_inotifyFd;
+	std::vector<int> m_watches;
+	TaskToken m_reloadTask;
+};
@@ -0,0 +1,112 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** TSMuxerSink.h
+**
+** Implement a live555 Sink that mux elementary streams in MPEG-TS segments in memory
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <stdint.h>
+
+#include <string>
+
+#include "MemoryBufferSink.h"
+#include "V4L2DeviceSource.h"
+
+#define TS_MUXER_PMT_PID 0x1000
+#define TS_MUXER_VIDEO_PID 0x100
+#define TS_MUXER_AUDIO_PID 0x101
+// PTS ahead of the PCR, 90kHz ticks
+#define TS_MUXER_PTS_DELAY 9000
+
+// ---------------------------------
+// 188 bytes packets are written in place in the arena chunks, the last packet of a video PES is padded when the next access unit starts
+// ---------------------------------
+class TSMuxerSink : public MemoryBufferSink
+{
+public:
+	static TSMuxerSink *createNew(UsageEnvironment &env, const std::string &format, V4L2DeviceSource *device, unsigned int chunkSize, unsigned int sliceDuration, unsigned int partDuration = 0, unsigned int nbSlices = 5)
+	{
+		return new TSMuxerSink(env, format, device, chunkSize, sliceDuration, partDuration, nbSlices);
+	}
+
+	// MPEG-TS stream_type of a format, 0 when it cannot be muxed
+	static uint8_t getStreamType(const std::string &format);
+
+	// audio frames (MPEG audio or AAC ADTS) muxed with the video of the sink
+	bool addAudioSource(FramedSource *source, const std::string &format);
+
+protected:
+	TSMuxerSink(UsageEnvironment &env, const std::string &format, V4L2DeviceSource *device, unsigned int chunkSize, unsigned int sliceDuration, unsigned int partDuration, unsigned int nbSlices);
+	virtual ~TSMuxerSink();
+
+	virtual Boolean continuePlaying();
+
+	static void afterGettingFrame(void *clientData, unsigned frameSize,
+								  unsigned numTruncatedBytes,
+								  struct timeval presentationTime,
+								  unsigned durationInMicroseconds)
+	{
+		TSMuxerSink *sink = (TSMuxerSink *)clientData;
+		sink->afterGettingFrame(frameSize, numTruncatedBytes, presentationTime);
+	}
+	void afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+
+	static void afterGettingAudioFrame(void *clientData, unsigned frameSize,
+									   unsigned numTruncatedBytes,
+									   struct timeval presentationTime,
+									   unsigned durationInMicroseconds)
+	{
+		TSMuxerSink *sink = (TSMuxerSink *)clientData;
+		sink->afterGettingAudioFrame(frameSize, numTruncatedBytes, presentationTime);
+	}
+	void afterGettingAudioFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime);
+	static void onAudioSourceClosure(void *clientData);
+	void continueAudio();
+
+	struct Stream
+	{
+		Stream() : m_pid(0), m_streamType(0), m_streamId(0), m_continuity(0), m_packet(NULL), m_packetUsed(0) {}
+		uint16_t m_pid;
+		uint8_t m_streamType;
+		uint8_t m_streamId;
+		uint8_t m_continuity;
+		// packet in progress, its 188 bytes are already reserved in a chunk
+		char *m_packet;
+		unsigned int m_packetUsed;
+	};
+
+	void writeNal(const unsigned char *nal, unsigned int size, const timeval &presentationTime);
+	void writeAudioFrame(const unsigned char *frame, unsigned int size, const timeval &presentationTime);
+	void startPes(Stream &stream, const timeval &presentationTime, unsigned int size, bool pcr);
+	void writePayload(Stream &stream, const unsigned char *data, unsigned int size);
+	void startPacket(Stream &stream, bool unitStart, const uint64_t *pcr);
+	void finishPacket(Stream &stream);
+	char *reservePacket();
+	void createTables();
+	virtual std::shared_ptr<SegmentArena::Chunk> createSegmentTables();
+
+protected:
+	std::string m_format;
+	V4L2DeviceSource *m_device;
+	unsigned char *m_buffer;
+	unsigned int m_bufferSize;
+	Stream m_video;
+
+	FramedSource *m_audioSource;
+	std::string m_audioFormat;
+	unsigned char *m_audioBuffer;
+	unsigned int m_audioBufferSize;
+	Stream m_audio;
+
+	// PAT and PMT packets, their continuity counters are set for each segment
+	std::string m_pat;
+	std::string m_pmt;
+	uint8_t m_patContinuity;
+	uint8_t m_pmtContinuity;
+};
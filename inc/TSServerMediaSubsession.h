@@ -10,30 +10,71 @@
 #pragma once
 
 #include <map>
+#include <memory>
 #include "UnicastServerMediaSubsession.h"
 #include "MemoryBufferSink.h"
 
+// seconds without HLS & MPEG-DASH request before the pipeline is stopped
+#define HLS_IDLE_TIMEOUT 60
+
 // -----------------------------------------
 //    ServerMediaSubsession for HLS
 // -----------------------------------------
 class TSServerMediaSubsession : public UnicastServerMediaSubsession
 {
 public:
-	static TSServerMediaSubsession *createNew(UsageEnvironment &env, StreamReplicator *videoreplicator, StreamReplicator *audioreplicator, unsigned int sliceDuration)
+	// partDuration: LL-HLS partial segment duration in ms, 0 disable partial segments
+	// cmaf: H264/H265 segments in fragmented MP4 (CMAF) instead of MPEG-TS
+	// idleTimeout: seconds without request before stopping the pipeline, 0 keep it running once started
+	static TSServerMediaSubsession *createNew(UsageEnvironment &env, FrameReplicator *videoreplicator, FrameReplicator *audioreplicator, unsigned int sliceDuration, unsigned int partDuration = 0, bool cmaf = false, unsigned int idleTimeout = HLS_IDLE_TIMEOUT)
 	{
-		return new TSServerMediaSubsession(env, videoreplicator, audioreplicator, sliceDuration);
+		return new TSServerMediaSubsession(env, videoreplicator, audioreplicator, sliceDuration, partDuration, cmaf, idleTimeout);
 	}
 
+	// the pipeline is started by the first call, each call postpones its stop
+	MemoryBufferSink *getHlsSink();
+	// false when the pipeline has nothing to segment
+	bool isPipelineRunning() { return (m_hlsSink != NULL) && (m_hlsSource != NULL); }
+	std::string getCodecs();
+	unsigned int getWidth();
+	unsigned int getHeight();
+
+	// playlist rendered for one version of the segment list
+	struct PlayList
+	{
+		PlayList() : m_version(0) {}
+		unsigned int m_version;
+		std::shared_ptr<const MemorySegment> m_content;
+		std::string m_etag;
+	};
+	PlayList &getPlayList(const std::string &type) { return m_playLists[type]; }
+
 protected:
-	TSServerMediaSubsession(UsageEnvironment &env, StreamReplicator *videoreplicator, StreamReplicator *audioreplicator, unsigned int sliceDuration);
+	TSServerMediaSubsession(UsageEnvironment &env, FrameReplicator *videoreplicator, FrameReplicator *audioreplicator, unsigned int sliceDuration, unsigned int partDuration, bool cmaf, unsigned int idleTimeout);
 	virtual ~TSServerMediaSubsession();
 
 	virtual float getCurrentNPT(void *streamToken);
 	virtual float duration() const;
-	virtual void seekStream(unsigned clientSessionId, void *streamToken, double &seekNPT, double streamDuration, u_int64_t &numBytes);
-	virtual FramedSource *getStreamSource(void *streamToken);
+
+	void startPipeline();
+	void stopPipeline();
+	static void idleTimeoutStub(void *clientData)
+	{
+		TSServerMediaSubsession *subsession = (TSServerMediaSubsession *)clientData;
+		subsession->m_idleTask = NULL;
+		subsession->idleTimeout();
+	}
+	void idleTimeout();
 
 protected:
-	unsigned int m_slice;
+	FrameReplicator *m_audioReplicator;
 	MemoryBufferSink *m_hlsSink;
+	FramedSource *m_hlsSource;
+	FramedSource *m_hlsAudioSource;
+	unsigned int m_sliceDuration;
+	unsigned int m_partDuration;
+	bool m_cmaf;
+	unsigned int m_idleTimeout;
+	TaskToken m_idleTask;
+	std::map<std::string, PlayList> m_playLists;
 };
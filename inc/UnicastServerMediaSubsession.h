@@ -17,13 +17,31 @@
 class UnicastServerMediaSubsession : public BaseServerMediaSubsession, public OnDemandServerMediaSubsession
 {
 public:
-	static UnicastServerMediaSubsession *createNew(UsageEnvironment &env, StreamReplicator *replicator);
+	static UnicastServerMediaSubsession *createNew(UsageEnvironment &env, FrameReplicator *replicator, const RtpSendOptions &rtpSendOptions = RtpSendOptions());
+
+	// all the clients of a stream share one framer and one RTP sink, frames are packetized once
+	static void setSharedPacketizer(bool sharedPacketizer) { m_sharedPacketizer = sharedPacketizer; }
 
 protected:
-	UnicastServerMediaSubsession(UsageEnvironment &env, StreamReplicator *replicator)
-		: BaseServerMediaSubsession(replicator), OnDemandServerMediaSubsession(env, False) {}
+	UnicastServerMediaSubsession(UsageEnvironment &env, FrameReplicator *replicator, const RtpSendOptions &rtpSendOptions)
+		: BaseServerMediaSubsession(replicator), OnDemandServerMediaSubsession(env, m_sharedPacketizer ? True : False), m_SDPLinesVersion(0), m_rtpSendOptions(rtpSendOptions) {}
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
+	virtual char const *sdpLines();
+#else
+	virtual char const *sdpLines(int addressFamily);
+#endif
 
 	virtual FramedSource *createNewStreamSource(unsigned clientSessionId, unsigned &estBitrate);
 	virtual RTPSink *createNewRTPSink(Groupsock *rtpGroupsock, unsigned char rtpPayloadTypeIfDynamic, FramedSource *inputSource);
 	virtual char const *getAuxSDPLine(RTPSink *rtpSink, FramedSource *inputSource);
+	virtual void startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData);
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800
+	virtual Groupsock *createGroupsock(struct sockaddr_storage const &addr, Port port);
+#endif
+
+protected:
+	unsigned int m_SDPLinesVersion;
+	RtpSendOptions m_rtpSendOptions;
+	static bool m_sharedPacketizer;
 };
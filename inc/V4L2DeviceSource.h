@@ -16,12 +16,19 @@
 #include <iostream>
 #include <iomanip>
 #include <mutex>
+#include <condition_variable>
 #include <thread>
+#include <atomic>
+#include <memory>
 
 // live555
 #include <liveMedia.hh>
 
 #include "DeviceInterface.h"
+#include "FrameBufferPool.h"
+#include "FrameRing.h"
+#include "FrameSnapshot.h"
+#include "KeyFrameRequester.h"
 
 // -----------------------------------------
 //    Video Device Source
@@ -34,17 +41,52 @@ public:
 	// ---------------------------------
 	struct Frame
 	{
-		Frame(char *buffer, int size, timeval timestamp, char *allocatedBuffer = NULL) : m_buffer(buffer), m_size(size), m_timestamp(timestamp), m_allocatedBuffer(allocatedBuffer) {};
-		Frame(const Frame &);
-		Frame &operator=(const Frame &);
-		~Frame() { delete[] m_allocatedBuffer; };
+		Frame() : m_buffer(NULL), m_size(0), m_timestamp({0, 0}), m_allocatedBuffer(NULL), m_keyFrame(false), m_endOfAccessUnit(true) {};
+		Frame(char *buffer, int size, timeval timestamp, FrameBufferPool::Buffer *allocatedBuffer = NULL, const std::shared_ptr<const std::string> &owner = std::shared_ptr<const std::string>())
+			: m_buffer(buffer), m_size(size), m_timestamp(timestamp), m_allocatedBuffer(allocatedBuffer), m_owner(owner), m_keyFrame(false), m_endOfAccessUnit(true)
+		{
+			if (m_allocatedBuffer)
+				m_allocatedBuffer->addRef();
+		};
+		Frame(Frame &&other) : m_buffer(other.m_buffer), m_size(other.m_size), m_timestamp(other.m_timestamp), m_allocatedBuffer(other.m_allocatedBuffer), m_owner(std::move(other.m_owner)), m_keyFrame(other.m_keyFrame), m_endOfAccessUnit(other.m_endOfAccessUnit)
+		{
+			other.m_allocatedBuffer = NULL;
+		};
+		Frame &operator=(Frame &&other)
+		{
+			if (this != &other)
+			{
+				if (m_allocatedBuffer)
+					m_allocatedBuffer->release();
+				m_buffer = other.m_buffer;
+				m_size = other.m_size;
+				m_timestamp = other.m_timestamp;
+				m_allocatedBuffer = other.m_allocatedBuffer;
+				m_owner = std::move(other.m_owner);
+				m_keyFrame = other.m_keyFrame;
+				m_endOfAccessUnit = other.m_endOfAccessUnit;
+				other.m_allocatedBuffer = NULL;
+			}
+			return *this;
+		};
+		~Frame()
+		{
+			if (m_allocatedBuffer)
+				m_allocatedBuffer->release();
+		};
 
 		char *m_buffer;
 		unsigned int m_size;
 		timeval m_timestamp;
-		char *m_allocatedBuffer;
+		FrameBufferPool::Buffer *m_allocatedBuffer;
+		std::shared_ptr<const std::string> m_owner; // frame outside the capture buffer (repeated parameter set)
+		bool m_keyFrame;		// frame belongs to an access unit that can be decoded on its own
+		bool m_endOfAccessUnit; // last frame of its access unit
 	};
 
+	typedef std::shared_ptr<const Frame> FrameRef;
+	typedef void(FrameHandler)(void *clientData, const FrameRef &frame);
+
 	// ---------------------------------
 	// Compute simple stats
 	// ---------------------------------
@@ -70,54 +112,156 @@ public:
 	{
 		CAPTURE_LIVE555_THREAD = 0,
 		CAPTURE_INTERNAL_THREAD,
+		CAPTURE_REACTOR,
 		NOCAPTURE
 	};
 
+	// ---------------------------------
+	// Capture Options
+	// ---------------------------------
+	struct CaptureOptions
+	{
+		CaptureOptions() : m_maxQueueBytes(0), m_targetLatencyMs(0), m_keyFrameRequestIntervalMs(1000), m_idleTimeoutMs(-1) {};
+
+		size_t m_maxQueueBytes;					  // queue budget in addition to the number of access units, 0 is unlimited
+		unsigned int m_targetLatencyMs;			  // age limit of the queued access units, 0 is unlimited
+		unsigned int m_keyFrameRequestIntervalMs; // minimum interval between two keyframe requests to the encoder, 0 disables them
+		int m_idleTimeoutMs;					  // delay before pausing the capture without consumer, -1 captures continuously
+	};
+
 public:
-	static V4L2DeviceSource *createNew(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode);
-	std::string getAuxLine() { return m_auxLine; }
-	std::string getLastFrame()
+	static V4L2DeviceSource *createNew(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, const CaptureOptions &options = CaptureOptions());
+	std::string getAuxLine()
 	{
-		std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-		std::string frame(m_lastFrame);
-		return frame;
+		std::lock_guard<std::mutex> lock(m_auxLineMutex);
+		std::string auxLine(m_auxLine);
+		return auxLine;
 	}
+	// incremented each time the parameter sets change
+	unsigned int getAuxLineVersion() { return m_auxLineVersion.load(std::memory_order_acquire); }
+	std::shared_ptr<const FrameSnapshot> getLastFrame() { return m_lastFrame.load(); }
 	DeviceInterface *getDevice() { return m_device; }
-	void postFrame(char *frame, int frameSize, const timeval &ref);
+	FrameBufferPool *getBufferPool() { return m_pool; }
+	unsigned long getDroppedFrames() { return m_captureQueue.getDropped(); }
+	unsigned int getQueueSize() { return m_queueSize; }
+	// measured on the last second in kbps, 0 until measured
+	unsigned int getBitrate() { return m_bitrate; }
+	void setFrameHandler(FrameHandler *handler, void *clientData);
+	void postFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref);
 	virtual std::list<std::string> getInitFrames() { return std::list<std::string>(); }
 	virtual bool isKeyFrame(const char *, int) { return false; }
+	// frames depend on the previous ones up to the last keyframe, without it every frame is decoded on its own
+	virtual bool hasInterFrames() { return false; }
+	// thread safe, requests are sent from the capture and coalesced until the next keyframe
+	void requestKeyFrame(const char *reason);
+	unsigned long getKeyFrameRequests() { return m_keyFrameRequester.getRequests(); }
+	// thread safe, the capture is paused after the idle timeout when the last consumer leaves
+	void addConsumer();
+	void removeConsumer();
+	bool wakeCapture();
 
 protected:
-	V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode);
+	V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, const CaptureOptions &options);
 	virtual ~V4L2DeviceSource();
 
 protected:
 	virtual void *thread();
-	static void deliverFrameStub(void *clientData) { ((V4L2DeviceSource *)clientData)->deliverFrame(); };
+	static void deliverFrameStub(void *clientData)
+	{
+		V4L2DeviceSource *source = (V4L2DeviceSource *)clientData;
+		// the trigger is shared, the schedulers have only 32 of them
+		if (source->m_captureChanged.exchange(false))
+		{
+			source->updateCapture();
+		}
+		source->deliverFrame();
+	};
 	void deliverFrame();
+	bool popFrame(Frame &frame);
 	static void incomingPacketHandlerStub(void *clientData, int mask) { ((V4L2DeviceSource *)clientData)->incomingPacketHandler(); };
 	void incomingPacketHandler();
+	static int readFrameStub(void *clientData) { return ((V4L2DeviceSource *)clientData)->getNextFrame(); }
 	int getNextFrame();
-	void processFrame(char *frame, int frameSize, const timeval &ref);
-	void queueFrame(char *frame, int frameSize, const timeval &tv, char *allocatedBuffer = NULL);
+	void processFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref);
+	bool queueFrame(char *frame, int frameSize, const timeval &tv, FrameBufferPool::Buffer *allocatedBuffer, const std::shared_ptr<const std::string> &owner, bool keyFrame, bool endOfAccessUnit);
+	void updateQueueBudget(const timeval &tv, size_t accessUnitSize);
+	bool isOverBudget(size_t accessUnitSize);
+	void dropAccessUnit();
+	void dropStaleAccessUnits();
+	void setAuxLine(const std::string &auxLine);
+	void sendKeyFrameRequest(const timeval &tv);
+	void updateCapture();
+	static void idleTimeoutStub(void *clientData)
+	{
+		V4L2DeviceSource *source = (V4L2DeviceSource *)clientData;
+		source->m_idleTask = NULL;
+		source->idleTimeout();
+	}
+	void idleTimeout();
+	bool pauseCapture();
+	bool resumeCapture();
+	// keep a reference on the last keyframe for snapshots
+	virtual void updateLastFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref);
 
 	// split packet in frames
 	virtual std::list<std::pair<unsigned char *, size_t>> splitFrames(unsigned char *frame, unsigned frameSize);
+	// immutable storage of a frame that is not in the capture buffer, the queued frame keeps it alive
+	virtual std::shared_ptr<const std::string> getFrameOwner(const unsigned char *frame) { return std::shared_ptr<const std::string>(); }
 
 	// overide FramedSource
 	virtual void doGetNextFrame();
 
 protected:
-	std::list<Frame *> m_captureQueue;
+	FrameRing<Frame> m_captureQueue;
 	Stats m_in;
 	Stats m_out;
 	EventTriggerId m_eventTriggerId;
 	int m_outfd;
 	DeviceInterface *m_device;
 	unsigned int m_queueSize;
+	CaptureMode m_captureMode;
+	FrameBufferPool *m_pool; // queued frames, the frame being captured and the snapshot, grown by the GOP cache
+
+	// queue budget, the producer counts in and the consumer counts out
+	std::atomic<unsigned int> m_queuedAccessUnits;
+	std::atomic<size_t> m_queuedBytes;
+	unsigned int m_maxQueueDurationMs; // age limit of the queued access units, only with a target latency
+	unsigned int m_maxAccessUnits;
+	size_t m_maxBytes;
+	bool m_waitKeyFrame;
+	bool m_skipToKeyFrame;
+	bool m_deliveringAccessUnit; // consumer side, the head of the queue is the rest of an access unit
+	time_t m_budgetSec;
+	unsigned int m_budgetAccessUnits;
+	size_t m_budgetBytes;
+	std::atomic<unsigned int> m_bitrate;
+	size_t m_maxQueueBytes;
+	unsigned int m_targetLatencyMs;
+
+	// keyframe requests, raised from any thread and sent by the capture
+	KeyFrameRequester m_keyFrameRequester;
+
+	// lazy capture, the state is changed from the event loop of the source
+	std::atomic<bool> m_lazyCapture;
+	bool m_capturing;
+	std::atomic<unsigned int> m_consumers;
+	std::atomic<bool> m_capturePaused;
+	bool m_readerParked; // guarded by m_captureMutex
+	std::mutex m_captureMutex;
+	std::condition_variable m_captureCondition;
+	std::atomic<bool> m_captureChanged;
+	std::atomic<bool> m_wakeCapture;
+	TaskToken m_idleTask;
+	timeval m_captureStart;
+	std::atomic<bool> m_waitFirstFrame;
+	unsigned long m_resumes;
+	int m_idleTimeoutMs;
+
 	std::thread m_thread;
-	std::mutex m_mutex;
+	std::mutex m_auxLineMutex;
 	std::string m_auxLine;
-	std::mutex m_lastFrameMutex;
-	std::string m_lastFrame;
+	std::atomic<unsigned int> m_auxLineVersion;
+	FrameSnapshotHolder m_lastFrame;
+	FrameHandler *m_frameHandler;
+	void *m_frameHandlerClientData;
 };
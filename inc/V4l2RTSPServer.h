@@ -12,6 +12,8 @@
 #pragma once
 
 #include <list>
+#include <set>
+#include <vector>
 
 // live555
 #include <BasicUsageEnvironment.hh>
@@ -21,31 +23,81 @@
 #include "UnicastServerMediaSubsession.h"
 #include "MulticastServerMediaSubsession.h"
 #include "TSServerMediaSubsession.h"
+#include "EpollTaskScheduler.h"
+#include "WorkerLoop.h"
 
 class V4l2RTSPServer
 {
 public:
-    V4l2RTSPServer(unsigned short rtspPort, unsigned short rtspOverHTTPPort = 0, int timeout = 10, unsigned int hlsSegment = 0, const std::list<std::string> &userPasswordList = std::list<std::string>(), const char *realm = NULL, const std::string &webroot = "", const std::string &sslkeycert = "", bool enableRTSPS = false)
-        : m_stop(0), m_env(BasicUsageEnvironment::createNew(*BasicTaskScheduler::createNew())), m_rtspPort(rtspPort)
+    // assignment of the unicast RTSP clients to the worker loops
+    enum LoopPolicy
     {
-        m_rtspServer = HTTPServer::createNew(*m_env, rtspPort, userPasswordList, realm, timeout, hlsSegment, webroot, sslkeycert, enableRTSPS);
+        LOOP_ROUNDROBIN,
+        LOOP_STREAM,
+        LOOP_LEASTLOADED
+    };
+
+public:
+    V4l2RTSPServer(unsigned short rtspPort, unsigned short rtspOverHTTPPort = 0, int timeout = 10, unsigned int hlsSegment = 0, const std::list<std::string> &userPasswordList = std::list<std::string>(), const char *realm = NULL, const std::string &webroot = "", const std::string &sslkeycert = "", bool enableRTSPS = false,
+                   unsigned int keepAliveTimeout = HTTP_KEEPALIVE_IDLE_TIMEOUT, unsigned int keepAliveMaxConnections = HTTP_KEEPALIVE_MAX_CONNECTIONS, const RtpSendOptions &rtpSendOptions = RtpSendOptions())
+        : m_stop(0), m_env(BasicUsageEnvironment::createNew(*V4l2RTSPServer::createTaskScheduler())), m_rtspPort(rtspPort), m_rtpSendOptions(rtpSendOptions), m_nextWorkerLoop(0)
+    {
+        m_rtspServer = HTTPServer::createNew(*m_env, rtspPort, userPasswordList, realm, timeout, hlsSegment, webroot, sslkeycert, enableRTSPS, keepAliveTimeout, keepAliveMaxConnections);
         if (m_rtspServer != NULL)
         {
             if (rtspOverHTTPPort)
             {
                 m_rtspServer->setUpTunnelingOverHTTP(rtspOverHTTPPort);
             }
+
+            // the main loop keeps accepting, unicast RTSP clients are handed over to the workers
+            for (unsigned int i = 0; i < m_nbWorkerLoops; i++)
+            {
+                m_workerLoops.push_back(WorkerLoop::createNew(V4l2RTSPServer::createTaskScheduler(), rtspPort, userPasswordList, realm, timeout, sslkeycert, enableRTSPS, keepAliveTimeout, keepAliveMaxConnections));
+            }
+            if (!m_workerLoops.empty())
+            {
+                LOG(NOTICE) << "worker loops:" << m_workerLoops.size() << " policy:" << m_loopPolicy;
+                m_rtspServer->setConnectionHandler(V4l2RTSPServer::dispatchConnectionStub, this);
+                this->logTLSSharding();
+            }
         }
     }
 
     virtual ~V4l2RTSPServer()
     {
+        for (WorkerLoop *workerLoop : m_workerLoops)
+        {
+            delete workerLoop;
+        }
         Medium::close(m_rtspServer);
         TaskScheduler *scheduler = &(m_env->taskScheduler());
         m_env->reclaim();
         delete scheduler;
     }
 
+    // process-wide event loop implementation, to set before creating the server
+    static void setEpollScheduler(bool epollScheduler) { m_epollScheduler = epollScheduler; }
+    static void setWorkerLoops(unsigned int nbWorkerLoops, LoopPolicy loopPolicy)
+    {
+        m_nbWorkerLoops = nbWorkerLoops;
+        m_loopPolicy = loopPolicy;
+    }
+
+    static TaskScheduler *createTaskScheduler()
+    {
+        TaskScheduler *scheduler = NULL;
+        if (m_epollScheduler)
+        {
+            scheduler = EpollTaskScheduler::createNew();
+        }
+        if (scheduler == NULL)
+        {
+            scheduler = BasicTaskScheduler::createNew();
+        }
+        return scheduler;
+    }
+
     bool available()
     {
         return ((m_env != NULL) && (m_rtspServer != NULL));
@@ -83,15 +135,17 @@ public:
     // -----------------------------------------
     //    create video capture & replicator
     // -----------------------------------------
-    StreamReplicator *CreateVideoReplicator(
+    FrameReplicator *CreateVideoReplicator(
         const V4L2DeviceParameters &inParam,
         int queueSize, V4L2DeviceSource::CaptureMode captureMode, int repeatConfig,
-        const std::string &outputFile, V4l2IoType ioTypeOut, V4l2Output *&out);
+        const std::string &outputFile, V4l2IoType ioTypeOut, V4l2Output *&out,
+        const V4L2DeviceSource::CaptureOptions &options = V4L2DeviceSource::CaptureOptions());
 
 #ifdef HAVE_ALSA
-    StreamReplicator *CreateAudioReplicator(
+    FrameReplicator *CreateAudioReplicator(
         const std::string &audioDev, const std::list<snd_pcm_format_t> &audioFmtList, int audioFreq, int audioNbChannels, int verbose,
-        int queueSize, V4L2DeviceSource::CaptureMode captureMode);
+        int queueSize, V4L2DeviceSource::CaptureMode captureMode,
+        const V4L2DeviceSource::CaptureOptions &options = V4L2DeviceSource::CaptureOptions());
 
     static std::string getV4l2Alsa(const std::string &v4l2device);
     static snd_pcm_format_t decodeAudioFormat(const std::string &fmt);
@@ -104,30 +158,39 @@ public:
     // -----------------------------------------
     //    Add unicast Session
     // -----------------------------------------
-    ServerMediaSession *AddUnicastSession(const std::string &url, StreamReplicator *videoReplicator, StreamReplicator *audioReplicator)
+    ServerMediaSession *AddUnicastSession(const std::string &url, FrameReplicator *videoReplicator, FrameReplicator *audioReplicator)
     {
         // Create Unicast Session
         std::list<ServerMediaSubsession *> subSession;
         if (videoReplicator)
         {
-            subSession.push_back(UnicastServerMediaSubsession::createNew(*this->env(), videoReplicator));
+            subSession.push_back(UnicastServerMediaSubsession::createNew(*this->env(), videoReplicator, m_rtpSendOptions));
         }
         if (audioReplicator)
         {
-            subSession.push_back(UnicastServerMediaSubsession::createNew(*this->env(), audioReplicator));
+            subSession.push_back(UnicastServerMediaSubsession::createNew(*this->env(), audioReplicator, m_rtpSendOptions));
         }
-        return this->addSession(url, subSession);
+        ServerMediaSession *sms = this->addSession(url, subSession);
+        if ((sms != NULL) && !m_workerLoops.empty())
+        {
+            for (WorkerLoop *workerLoop : m_workerLoops)
+            {
+                workerLoop->addUnicastSession(url, videoReplicator, audioReplicator, m_rtpSendOptions);
+            }
+            m_workerStreams.insert(url);
+        }
+        return sms;
     }
 
     // -----------------------------------------
     //    Add HLS & MPEG# Session
     // -----------------------------------------
-    ServerMediaSession *AddHlsSession(const std::string &url, int hlsSegment, StreamReplicator *videoReplicator, StreamReplicator *audioReplicator)
+    ServerMediaSession *AddHlsSession(const std::string &url, int hlsSegment, FrameReplicator *videoReplicator, FrameReplicator *audioReplicator, unsigned int hlsPart = 0, bool cmaf = false, unsigned int idleTimeout = HLS_IDLE_TIMEOUT)
     {
         std::list<ServerMediaSubsession *> subSession;
         if (videoReplicator)
         {
-            subSession.push_back(TSServerMediaSubsession::createNew(*this->env(), videoReplicator, audioReplicator, hlsSegment));
+            subSession.push_back(TSServerMediaSubsession::createNew(*this->env(), videoReplicator, audioReplicator, hlsSegment, hlsPart, cmaf, idleTimeout));
         }
         ServerMediaSession *sms = this->addSession(url, subSession);
 
@@ -146,7 +209,7 @@ public:
     // -----------------------------------------
     //    Add multicats Session
     // -----------------------------------------
-    ServerMediaSession *AddMulticastSession(const std::string &url, in_addr destinationAddress, unsigned short &rtpPortNum, unsigned short &rtcpPortNum, StreamReplicator *videoReplicator, StreamReplicator *audioReplicator)
+    ServerMediaSession *AddMulticastSession(const std::string &url, in_addr destinationAddress, unsigned short &rtpPortNum, unsigned short &rtcpPortNum, FrameReplicator *videoReplicator, FrameReplicator *audioReplicator, bool alwaysOn = false)
     {
 
         LOG(NOTICE) << "RTP  address " << inet_ntoa(destinationAddress) << ":" << rtpPortNum;
@@ -155,7 +218,7 @@ public:
         std::list<ServerMediaSubsession *> subSession;
         if (videoReplicator)
         {
-            subSession.push_back(MulticastServerMediaSubsession::createNew(*this->env(), destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, videoReplicator));
+            subSession.push_back(MulticastServerMediaSubsession::createNew(*this->env(), destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, videoReplicator, alwaysOn, m_rtpSendOptions));
             // increment ports for next sessions
             rtpPortNum += 2;
             rtcpPortNum += 2;
@@ -163,7 +226,7 @@ public:
 
         if (audioReplicator)
         {
-            subSession.push_back(MulticastServerMediaSubsession::createNew(*this->env(), destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, audioReplicator));
+            subSession.push_back(MulticastServerMediaSubsession::createNew(*this->env(), destinationAddress, Port(rtpPortNum), Port(rtcpPortNum), ttl, audioReplicator, alwaysOn, m_rtpSendOptions));
 
             // increment ports for next sessions
             rtpPortNum += 2;
@@ -202,13 +265,13 @@ public:
         return inet_ntoa(destinationAddress) + std::string(":") + std::to_string(rtpPortNum) + std::string(":") + std::to_string(rtcpPortNum);
     }
 
-    ServerMediaSession *AddMulticastSession(const std::string &url, const std::string &inmulticasturi, std::string &outmulticasturi, StreamReplicator *videoReplicator, StreamReplicator *audioReplicator)
+    ServerMediaSession *AddMulticastSession(const std::string &url, const std::string &inmulticasturi, std::string &outmulticasturi, FrameReplicator *videoReplicator, FrameReplicator *audioReplicator, bool alwaysOn = false)
     {
         struct in_addr destinationAddress;
         unsigned short rtpPortNum;
         unsigned short rtcpPortNum;
         outmulticasturi = this->decodeMulticastUrl(inmulticasturi, destinationAddress, rtpPortNum, rtcpPortNum);
-        return this->AddMulticastSession(url, destinationAddress, rtpPortNum, rtcpPortNum, videoReplicator, audioReplicator);
+        return this->AddMulticastSession(url, destinationAddress, rtpPortNum, rtcpPortNum, videoReplicator, audioReplicator, alwaysOn);
     }
 
     // -----------------------------------------
@@ -232,12 +295,24 @@ public:
 
     void RemoveSession(ServerMediaSession *sms)
     {
+        std::string url(sms->streamName());
+        if (m_workerStreams.erase(url) != 0)
+        {
+            for (WorkerLoop *workerLoop : m_workerLoops)
+            {
+                workerLoop->removeSession(url);
+            }
+        }
         m_rtspServer->deleteServerMediaSession(sms);
     }
 
     void addUserRecord(const char *username, const char *password)
     {
         m_rtspServer->addUserRecord(username, password);
+        for (WorkerLoop *workerLoop : m_workerLoops)
+        {
+            workerLoop->addUserRecord(username, password);
+        }
     }
 
     std::list<std::string> getUsers()
@@ -248,6 +323,11 @@ public:
     void setTLS(const std::string &sslCert, bool enableRTSPS = false, bool encryptSRTP = true)
     {
         m_rtspServer->setTLS(sslCert, enableRTSPS, encryptSRTP);
+        for (WorkerLoop *workerLoop : m_workerLoops)
+        {
+            workerLoop->setTLS(sslCert, enableRTSPS, encryptSRTP);
+        }
+        this->logTLSSharding();
     }
 
     bool isRTSPS()
@@ -303,9 +383,84 @@ protected:
         return sms;
     }
 
+    // the request of a TLS connection is encrypted, it cannot choose a worker loop
+    void logTLSSharding()
+    {
+        if (!m_workerLoops.empty() && m_rtspServer->isRTSPS())
+        {
+            LOG(WARN) << "RTSPS connections are not sharded, the main loop serves all of them";
+        }
+    }
+
+    // -----------------------------------------
+    //    choose the loop that serves a connection
+    // -----------------------------------------
+    static bool dispatchConnectionStub(void *clientData, int clientSocket, struct SOCKETCLIENT clientAddr, const std::string &path, const std::string &sessionCookie)
+    {
+        return ((V4l2RTSPServer *)clientData)->dispatchConnection(clientSocket, clientAddr, path, sessionCookie);
+    }
+
+    bool dispatchConnection(int clientSocket, struct SOCKETCLIENT clientAddr, const std::string &path, const std::string &sessionCookie)
+    {
+        // multicast sessions and HTTP requests are served by the main loop
+        std::string streamName;
+        for (const std::string &url : m_workerStreams)
+        {
+            if ((path == url) || (path.compare(0, url.size() + 1, url + "/") == 0))
+            {
+                streamName = url;
+                break;
+            }
+        }
+        if (streamName.empty())
+        {
+            return false;
+        }
+
+        size_t index = 0;
+        if (!sessionCookie.empty())
+        {
+            // both connections of an RTSP over HTTP tunnel must reach the same loop
+            index = std::hash<std::string>()(sessionCookie) % m_workerLoops.size();
+        }
+        else if (m_loopPolicy == LOOP_STREAM)
+        {
+            index = std::hash<std::string>()(streamName) % m_workerLoops.size();
+        }
+        else if (m_loopPolicy == LOOP_LEASTLOADED)
+        {
+            unsigned int minConnections = m_workerLoops[0]->getConnectionCount();
+            for (size_t i = 1; i < m_workerLoops.size(); i++)
+            {
+                unsigned int connections = m_workerLoops[i]->getConnectionCount();
+                if (connections < minConnections)
+                {
+                    minConnections = connections;
+                    index = i;
+                }
+            }
+        }
+        else
+        {
+            index = m_nextWorkerLoop++ % m_workerLoops.size();
+        }
+        LOG(INFO) << "stream:" << streamName << " served by worker loop:" << index;
+        m_workerLoops[index]->addClientConnection(clientSocket, clientAddr);
+        return true;
+    }
+
 protected:
     char m_stop;
     UsageEnvironment *m_env;
     HTTPServer *m_rtspServer;
     int m_rtspPort;
+    RtpSendOptions m_rtpSendOptions;
+
+    std::vector<WorkerLoop *> m_workerLoops;
+    std::set<std::string> m_workerStreams;
+    unsigned int m_nextWorkerLoop;
+
+    static bool m_epollScheduler;
+    static unsigned int m_nbWorkerLoops;
+    static LoopPolicy m_loopPolicy;
 };
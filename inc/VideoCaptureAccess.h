@@ -11,6 +11,11 @@
 
 #pragma once
 
+#include <errno.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <linux/videodev2.h>
+
 #include "DeviceInterface.h"
 #include "V4l2Capture.h"
 
@@ -29,6 +34,43 @@ public:
 	virtual int getWidth() { return m_device->getWidth(); }
 	virtual int getHeight() { return m_device->getHeight(); }
 	virtual int getVideoFormat() { return m_device->getFormat(); }
+	virtual bool requestKeyFrame()
+	{
+		struct v4l2_control control = {V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME, 0};
+		return (ioctl(m_device->getFd(), VIDIOC_S_CTRL, &control) == 0);
+	}
+	// STREAMOFF gives the buffers back, they stay mapped and are queued again on STREAMON
+	virtual bool stopCapture()
+	{
+		int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		return (ioctl(m_device->getFd(), VIDIOC_STREAMOFF, &type) == 0);
+	}
+	virtual bool startCapture()
+	{
+		for (unsigned int index = 0;; index++)
+		{
+			struct v4l2_buffer buf;
+			memset(&buf, 0, sizeof(buf));
+			buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+			buf.memory = V4L2_MEMORY_MMAP;
+			buf.index = index;
+			if (ioctl(m_device->getFd(), VIDIOC_QUERYBUF, &buf) != 0)
+			{
+				// EINVAL after the last buffer
+				if (errno != EINVAL)
+				{
+					return false;
+				}
+				break;
+			}
+			if (((buf.flags & V4L2_BUF_FLAG_QUEUED) == 0) && (ioctl(m_device->getFd(), VIDIOC_QBUF, &buf) != 0))
+			{
+				return false;
+			}
+		}
+		int type = V4L2_BUF_TYPE_VIDEO_CAPTURE;
+		return (ioctl(m_device->getFd(), VIDIOC_STREAMON, &type) == 0);
+	}
 
 protected:
 	V4l2Capture *m_device;
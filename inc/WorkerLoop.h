@@ -0,0 +1,73 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** WorkerLoop.h
+**
+** event loop running in its own thread that serves unicast RTSP clients
+**
+** -------------------------------------------------------------------------*/
+
+#pragma once
+
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <list>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+// live555
+#include <BasicUsageEnvironment.hh>
+
+#include "HTTPServer.h"
+#include "FrameReplicator.h"
+#include "BatchGroupsock.h"
+
+// ---------------------------------
+// the live555 objects of a worker are only used from its thread, the other threads post tasks
+// ---------------------------------
+class WorkerLoop
+{
+public:
+	static WorkerLoop *createNew(TaskScheduler *scheduler, Port rtspPort, const std::list<std::string> &userPasswordList, const char *realm, unsigned reclamationTestSeconds, const std::string &sslCert, bool enableRTSPS, unsigned int keepAliveTimeout = HTTP_KEEPALIVE_IDLE_TIMEOUT, unsigned int keepAliveMaxConnections = HTTP_KEEPALIVE_MAX_CONNECTIONS)
+	{
+		return new WorkerLoop(scheduler, rtspPort, userPasswordList, realm, reclamationTestSeconds, sslCert, enableRTSPS, keepAliveTimeout, keepAliveMaxConnections);
+	}
+	virtual ~WorkerLoop();
+
+	// could be called from any thread
+	void post(const std::function<void()> &task);
+
+	void addClientConnection(int clientSocket, struct SOCKETCLIENT clientAddr);
+	void addUnicastSession(const std::string &url, FrameReplicator *videoReplicator, FrameReplicator *audioReplicator, const RtpSendOptions &rtpSendOptions = RtpSendOptions());
+	void removeSession(const std::string &url);
+	void addUserRecord(const std::string &username, const std::string &password);
+	void setTLS(const std::string &sslCert, bool enableRTSPS, bool encryptSRTP);
+
+	// thread safe, connections served and waiting to be served
+	unsigned int getConnectionCount() { return m_server->getConnectionCount() + m_pendingConnections; }
+
+protected:
+	WorkerLoop(TaskScheduler *scheduler, Port rtspPort, const std::list<std::string> &userPasswordList, const char *realm, unsigned reclamationTestSeconds, const std::string &sslCert, bool enableRTSPS, unsigned int keepAliveTimeout, unsigned int keepAliveMaxConnections);
+
+	void thread();
+	static void runTasksStub(void *clientData) { ((WorkerLoop *)clientData)->runTasks(); }
+	void runTasks();
+
+protected:
+	UsageEnvironment *m_env;
+	HTTPServer *m_server;
+	char m_stop;
+	std::atomic<unsigned int> m_pendingConnections;
+	std::vector<FrameReplicator *> m_mirrors;
+
+	std::mutex m_tasksMutex;
+	std::deque<std::function<void()>> m_tasks;
+	EventTriggerId m_tasksTrigger;
+
+	std::thread m_thread;
+};
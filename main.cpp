@@ -33,6 +33,7 @@
 
 #include "V4l2RTSPServer.h"
 #include "DeviceSourceFactory.h"
+#include "CaptureReactor.h"
 
 // -----------------------------------------
 //    signal handler
@@ -94,7 +95,16 @@ int main(int argc, char **argv)
 	bool repeatConfig = true;
 	int timeout = 65;
 	int defaultHlsSegment = 2;
+	int defaultHlsPart = 300;
 	unsigned int hlsSegment = 0;
+	unsigned int hlsPart = 0;
+	bool cmaf = false;
+	unsigned int hlsIdleTimeout = HLS_IDLE_TIMEOUT;
+	bool multicastAlwaysOn = false;
+	unsigned int keepAliveTimeout = HTTP_KEEPALIVE_IDLE_TIMEOUT;
+	unsigned int keepAliveMaxConnections = HTTP_KEEPALIVE_MAX_CONNECTIONS;
+	V4L2DeviceSource::CaptureOptions captureOptions;
+	RtpSendOptions rtpSendOptions;
 	std::string sslKeyCert;
 	bool enableRTSPS = false;
 	const char *realm = NULL;
@@ -115,10 +125,10 @@ int main(int argc, char **argv)
 
 	// decode parameters
 	int c = 0;
-	while ((c = getopt(argc, argv, "v::Q:O:b:"
-								   "I:P:p:m::u:M::ct:S::x:X"
+	while ((c = getopt(argc, argv, "v::Q:L:i:d:O:b:"
+								   "I:P:p:m::u:M::ncNej:gq:l:t:S::K::DJ:k:x:X"
 								   "R:U:"
-								   "TrwBsf::F:W:H:G:"
+								   "TrwBsE:Y:Zf::F:W:H:G:"
 								   "A:C:a:"
 								   "Vh")) != -1)
 	{
@@ -130,7 +140,16 @@ int main(int argc, char **argv)
 				verbose++;
 			break;
 		case 'Q':
-			queueSize = atoi(optarg);
+			sscanf(optarg, "%d:%zu", &queueSize, &captureOptions.m_maxQueueBytes);
+			break;
+		case 'L':
+			captureOptions.m_targetLatencyMs = atoi(optarg);
+			break;
+		case 'i':
+			captureOptions.m_keyFrameRequestIntervalMs = atoi(optarg);
+			break;
+		case 'd':
+			captureOptions.m_idleTimeoutMs = atoi(optarg);
 			break;
 		case 'O':
 			outputFile = optarg;
@@ -160,15 +179,83 @@ int main(int argc, char **argv)
 			multicast = true;
 			maddr = optarg ? optarg : maddr;
 			break;
+		case 'n':
+			multicastAlwaysOn = true;
+			break;
 		case 'c':
 			repeatConfig = false;
 			break;
+		case 'N':
+			UnicastServerMediaSubsession::setSharedPacketizer(true);
+			break;
+		case 'e':
+			V4l2RTSPServer::setEpollScheduler(true);
+			break;
+		case 'j':
+		{
+			std::istringstream is(optarg);
+			std::string nbLoops;
+			getline(is, nbLoops, ':');
+			std::string policy;
+			getline(is, policy);
+			V4l2RTSPServer::LoopPolicy loopPolicy = V4l2RTSPServer::LOOP_ROUNDROBIN;
+			if (policy == "stream")
+			{
+				loopPolicy = V4l2RTSPServer::LOOP_STREAM;
+			}
+			else if (policy == "load")
+			{
+				loopPolicy = V4l2RTSPServer::LOOP_LEASTLOADED;
+			}
+			V4l2RTSPServer::setWorkerLoops(atoi(nbLoops.c_str()), loopPolicy);
+			break;
+		}
+		case 'g':
+			rtpSendOptions.m_batch = true;
+			break;
+		case 'q':
+			if (!RtpSendOptions::decodePacing(optarg, rtpSendOptions.m_pacing))
+			{
+				std::cerr << "invalid pacing:" << optarg << ", expected txtime or bucket" << std::endl;
+				exit(1);
+			}
+			break;
+		case 'l':
+			if (!BaseServerMediaSubsession::setRtpPacketSize(atoi(optarg)))
+			{
+				std::cerr << "invalid RTP packet size:" << optarg << ", expected " << RTP_PACKET_SIZE_MIN << ".." << RTP_PACKET_SIZE_MAX << std::endl;
+				exit(1);
+			}
+			break;
 		case 't':
 			timeout = atoi(optarg);
 			break;
 		case 'S':
 			hlsSegment = optarg ? atoi(optarg) : defaultHlsSegment;
 			break;
+		case 'K':
+			hlsPart = optarg ? atoi(optarg) : defaultHlsPart;
+			break;
+		case 'D':
+			cmaf = true;
+			break;
+		case 'J':
+			hlsIdleTimeout = atoi(optarg);
+			break;
+		case 'k':
+		{
+			std::istringstream is(optarg);
+			std::string idleTimeout;
+			getline(is, idleTimeout, ':');
+			std::string maxConnections;
+			getline(is, maxConnections);
+			keepAliveTimeout = atoi(idleTimeout.c_str());
+			if (!maxConnections.empty())
+			{
+				keepAliveMaxConnections = atoi(maxConnections.c_str());
+			}
+			break;
+		}
 #ifndef NO_OPENSSL
 		case 'x':
 			sslKeyCert = optarg;
@@ -202,6 +289,27 @@ int main(int argc, char **argv)
 		case 's':
 			captureMode = V4L2DeviceSource::CAPTURE_LIVE555_THREAD;
 			break;
+		case 'E':
+		{
+			captureMode = V4L2DeviceSource::CAPTURE_REACTOR;
+			std::vector<int> cpus;
+			std::istringstream is(optarg);
+			std::string nbThreads;
+			getline(is, nbThreads, ':');
+			std::string cpu;
+			while (getline(is, cpu, ','))
+			{
+				cpus.push_back(atoi(cpu.c_str()));
+			}
+			CaptureReactor::setThreads(atoi(nbThreads.c_str()), cpus);
+			break;
+		}
+		case 'Y':
+			CaptureReactor::setRealtimePriority(atoi(optarg));
+			break;
+		case 'Z':
+			FrameBufferPool::setHugePages(true);
+			break;
 		case 'f':
 			format = V4l2Device::fourcc(optarg);
 			if (format)
@@ -249,12 +357,15 @@ int main(int argc, char **argv)
 		case 'h':
 		default:
 		{
-			std::cout << argv[0] << " [-v[v]] [-Q queueSize] [-O file]" << std::endl;
-			std::cout << "\t          [-I interface] [-P RTSP port] [-p RTSP/HTTP port] [-m multicast url] [-u unicast url] [-M multicast addr] [-c] [-t timeout] [-T] [-S[duration]]" << std::endl;
-			std::cout << "\t          [-r] [-w] [-s] [-f[format] [-W width] [-H height] [-F fps] [device] [device]" << std::endl;
+			std::cout << argv[0] << " [-v[v]] [-Q queueSize[:bytes]] [-L latency] [-i interval] [-d idle] [-O file]" << std::endl;
+			std::cout << "\t          [-I interface] [-P RTSP port] [-p RTSP/HTTP port] [-m multicast url] [-u unicast url] [-M multicast addr] [-n] [-c] [-N] [-e] [-j loops[:policy]] [-g] [-q txtime|bucket] [-l size] [-t timeout] [-T] [-S[duration]] [-J idle] [-k timeout[:connections]]" << std::endl;
+			std::cout << "\t          [-r] [-w] [-s] [-E threads[:cpus]] [-Y priority] [-Z] [-f[format] [-W width] [-H height] [-F fps] [device] [device]" << std::endl;
 			std::cout << "\t -v               : verbose" << std::endl;
 			std::cout << "\t -vv              : very verbose" << std::endl;
-			std::cout << "\t -Q <length>      : Number of frame queue  (default " << queueSize << ")" << std::endl;
+			std::cout << "\t -Q <length>[:<bytes>] : Number of frames (access units) and bytes in queue (default " << queueSize << ")" << std::endl;
+			std::cout << "\t -L <latency>     : target queue latency in ms, size the queue from the measured stream" << std::endl;
+			std::cout << "\t -i <interval>    : minimum interval in ms between keyframe requests to the encoder, 0 disable (default 1000)" << std::endl;
+			std::cout << "\t -d <idle>        : capture only while clients are connected, pause the device after idle ms without client" << std::endl;
 			std::cout << "\t -O <output>      : Copy captured frame to a file or a V4L2 device" << std::endl;
 			std::cout << "\t -b <webroot>     : path to webroot" << std::endl;
 
@@ -267,10 +378,23 @@ int main(int argc, char **argv)
 			std::cout << "\t -u <url>         : unicast url (default " << url << ")" << std::endl;
 			std::cout << "\t -m <url>         : multicast url (default " << murl << ")" << std::endl;
 			std::cout << "\t -M <addr>        : multicast group:port (default is random_address:20000)" << std::endl;
+			std::cout << "\t -n               : multicast sent continuously (default only while RTSP clients play it)" << std::endl;
 			std::cout << "\t -c               : don't repeat config (default repeat config before IDR frame)" << std::endl;
+			std::cout << "\t -N               : packetize once for all unicast clients of a stream (default one RTP sink per client)" << std::endl;
+			std::cout << "\t -e               : RTSP/HTTP event loop based on epoll (default select)" << std::endl;
+			std::cout << "\t -j <n>[:<policy>] : serve unicast RTSP clients from n worker loops, policy rr|stream|load (default rr), RTSPS clients stay on the main loop" << std::endl;
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800
+			std::cout << "\t -g               : send the RTP packets of a frame with sendmmsg and UDP GSO" << std::endl;
+			std::cout << "\t -q <pacing>      : spread the RTP packets of a frame over the frame interval, txtime (needs the fq qdisc) or bucket" << std::endl;
+#endif
+			std::cout << "\t -l <size>        : RTP packet size in bytes, 576..65507 and up to the MTU minus 28 (default 1000)" << std::endl;
 			std::cout << "\t -t <timeout>     : RTCP expiration timeout in seconds (default " << timeout << ")" << std::endl;
 			std::cout << "\t -T               : burn timestamp overlay into raw YUV frames" << std::endl;
 			std::cout << "\t -S[<duration>]   : enable HLS & MPEG-DASH with segment duration  in seconds (default " << defaultHlsSegment << ")" << std::endl;
+			std::cout << "\t -K[<duration>]   : enable Low-Latency HLS with partial segment duration in ms (default " << defaultHlsPart << ")" << std::endl;
+			std::cout << "\t -D               : H264/H265 HLS & MPEG-DASH segments in fragmented MP4 (CMAF) instead of MPEG-TS" << std::endl;
+			std::cout << "\t -J <idle>        : stop HLS & MPEG-DASH muxing after idle seconds without request, 0 keep it running (default " << HLS_IDLE_TIMEOUT << ")" << std::endl;
+			std::cout << "\t -k <timeout>[:<n>] : HTTP keep-alive idle timeout in seconds and max persistent connections, 0 disable (default " << HTTP_KEEPALIVE_IDLE_TIMEOUT << ":" << HTTP_KEEPALIVE_MAX_CONNECTIONS << ")" << std::endl;
 #ifndef NO_OPENSSL
 			std::cout << "\t -x <sslkeycert>  : enable SRTP" << std::endl;
 			std::cout << "\t -X               : enable RTSPS" << std::endl;
@@ -281,6 +405,9 @@ int main(int argc, char **argv)
 			std::cout << "\t -w               : V4L2 capture using write interface (default use memory mapped buffers)" << std::endl;
 			std::cout << "\t -B               : V4L2 capture using blocking mode (default use non-blocking mode)" << std::endl;
 			std::cout << "\t -s               : V4L2 capture using live555 mainloop (default use a reader thread)" << std::endl;
+			std::cout << "\t -E <n>[:<cpu>,..]: V4L2 capture using n epoll threads shared by all devices, pinned to cpus" << std::endl;
+			std::cout << "\t -Y <priority>    : SCHED_FIFO priority of the epoll capture threads" << std::endl;
+			std::cout << "\t -Z               : V4L2 capture buffers backed by hugepages" << std::endl;
 			std::cout << "\t -f               : V4L2 capture using current capture format (-W,-H,-F are ignored)" << std::endl;
 			std::cout << "\t -f<format>       : V4L2 capture using format (-W,-H,-F are used)" << std::endl;
 			std::cout << "\t -W <width>       : V4L2 capture width (default " << width << ")" << std::endl;
@@ -301,6 +428,11 @@ int main(int argc, char **argv)
 		}
 		}
 	}
+	if (rtpSendOptions.isEnabled() && !RtpSendOptions::isSupported())
+	{
+		std::cerr << "-g and -q need a live555 with sendmmsg support (2020.12 or later)" << std::endl;
+		exit(1);
+	}
 	std::list<std::string> devList;
 	while (optind < argc)
 	{
@@ -334,9 +466,10 @@ int main(int argc, char **argv)
 	// init logger
 	initLogger(verbose);
 	LOG(NOTICE) << "Version: " << VERSION << " live555 version:" << LIVEMEDIA_LIBRARY_VERSION_STRING;
+	LOG(INFO) << "Start code scanner: " << StartCodeScanner::getImplementation();
 
 	// create RTSP server
-	V4l2RTSPServer rtspServer(rtspPort, rtspOverHTTPPort, timeout, hlsSegment, userPasswordList, realm, webroot, sslKeyCert, enableRTSPS);
+	V4l2RTSPServer rtspServer(rtspPort, rtspOverHTTPPort, timeout, hlsSegment, userPasswordList, realm, webroot, sslKeyCert, enableRTSPS, keepAliveTimeout, keepAliveMaxConnections, rtpSendOptions);
 	if (!rtspServer.available())
 	{
 		LOG(ERROR) << "Failed to create RTSP server: " << rtspServer.getResultMsg();
@@ -372,27 +505,27 @@ int main(int argc, char **argv)
 
 			V4l2Output *out = NULL;
 			V4L2DeviceParameters inParam(videoDev.c_str(), videoformatList, width, height, fps, ioTypeIn, openflags, overlay);
-			StreamReplicator *videoReplicator = rtspServer.CreateVideoReplicator(
+			FrameReplicator *videoReplicator = rtspServer.CreateVideoReplicator(
 				inParam,
 				queueSize, captureMode, repeatConfig,
-				output, ioTypeOut, out);
+				output, ioTypeOut, out, captureOptions);
 			if (out != NULL)
 			{
 				outList.push_back(out);
 			}
 
 			// Init Audio Capture
-			StreamReplicator *audioReplicator = NULL;
+			FrameReplicator *audioReplicator = NULL;
 #ifdef HAVE_ALSA
 			audioReplicator = rtspServer.CreateAudioReplicator(
 				audioDev, audioFmtList, audioFreq, audioNbChannels, verbose,
-				queueSize, captureMode);
+				queueSize, captureMode, captureOptions);
 #endif
 
 			// Create Multicast Session
 			if (multicast)
 			{
-				ServerMediaSession *sms = rtspServer.AddMulticastSession(baseUrl + murl, destinationAddress, rtpPortNum, rtcpPortNum, videoReplicator, audioReplicator);
+				ServerMediaSession *sms = rtspServer.AddMulticastSession(baseUrl + murl, destinationAddress, rtpPortNum, rtcpPortNum, videoReplicator, audioReplicator, multicastAlwaysOn);
 				if (sms)
 				{
 					nbSource += sms->numSubsessions();
@@ -402,7 +535,7 @@ int main(int argc, char **argv)
 			// Create HLS Session
 			if (hlsSegment > 0)
 			{
-				ServerMediaSession *sms = rtspServer.AddHlsSession(baseUrl + tsurl, hlsSegment, videoReplicator, audioReplicator);
+				ServerMediaSession *sms = rtspServer.AddHlsSession(baseUrl + tsurl, hlsSegment, videoReplicator, audioReplicator, hlsPart, cmaf, hlsIdleTimeout);
 				if (sms)
 				{
 					nbSource += sms->numSubsessions();
@@ -0,0 +1,430 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** BatchGroupsock.cpp
+**
+** Groupsock that sends the RTP packets of a frame with one sendmmsg
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <linux/net_tstamp.h>
+
+#include <algorithm>
+
+// live555
+#include <GroupsockHelper.hh>
+
+#include "logger.h"
+#include "BatchGroupsock.h"
+
+#ifndef UDP_SEGMENT
+#define UDP_SEGMENT 103
+#endif
+
+// limits of the kernel for one GSO message
+#define RTP_BATCH_MAX_SEGMENTS 64
+#define RTP_BATCH_MAX_GSO_SIZE 65000
+
+// a frame is sent during a part of the frame interval, at least at twice the stream rate
+#define RTP_PACING_WINDOW 0.8
+#define RTP_PACING_HEADROOM 2.0
+#define RTP_PACING_STAGGER 0.2
+#define RTP_PACING_BURST_US 500
+#define RTP_PACING_MAX_INTERVAL_US 200000
+
+#define RTP_SNDBUF_DURATION_MS 200
+#define RTP_SNDBUF_MAX (8 * 1024 * 1024)
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800
+
+static bool sameDestination(const struct sockaddr_storage &a, const struct sockaddr_storage &b)
+{
+	bool same = false;
+	if (a.ss_family == b.ss_family)
+	{
+		if (a.ss_family == AF_INET6)
+		{
+			const struct sockaddr_in6 &a6 = (const struct sockaddr_in6 &)a;
+			const struct sockaddr_in6 &b6 = (const struct sockaddr_in6 &)b;
+			same = (a6.sin6_port == b6.sin6_port) && (memcmp(&a6.sin6_addr, &b6.sin6_addr, sizeof(a6.sin6_addr)) == 0);
+		}
+		else
+		{
+			const struct sockaddr_in &a4 = (const struct sockaddr_in &)a;
+			const struct sockaddr_in &b4 = (const struct sockaddr_in &)b;
+			same = (a4.sin_port == b4.sin_port) && (a4.sin_addr.s_addr == b4.sin_addr.s_addr);
+		}
+	}
+	return same;
+}
+
+// departure times are given to the fq qdisc
+static bool enableTxTime(int socket)
+{
+	bool enabled = false;
+#ifdef SO_TXTIME
+	struct sock_txtime txtime;
+	memset(&txtime, 0, sizeof(txtime));
+	txtime.clockid = CLOCK_MONOTONIC;
+	enabled = (setsockopt(socket, SOL_SOCKET, SO_TXTIME, &txtime, sizeof(txtime)) == 0);
+#endif
+	return enabled;
+}
+
+int64_t BatchGroupsock::now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+RTCPFeedbackGroupsock *BatchGroupsock::createNew(UsageEnvironment &env, struct sockaddr_storage const &groupAddress, Port port, u_int8_t ttl, const RtpSendOptions &options)
+{
+	RTCPFeedbackGroupsock *groupsock = NULL;
+	if (options.isEnabled())
+	{
+		groupsock = new BatchGroupsock(env, groupAddress, port, ttl, options.m_pacing);
+	}
+	else
+	{
+		groupsock = new RTCPFeedbackGroupsock(env, groupAddress, port, ttl);
+	}
+	return groupsock;
+}
+
+BatchGroupsock::BatchGroupsock(UsageEnvironment &env, struct sockaddr_storage const &groupAddress, Port port, u_int8_t ttl, PacingMode pacing)
+	: RTCPFeedbackGroupsock(env, groupAddress, port, ttl), m_sentPackets(0), m_timedPackets(0), m_ttl(-1), m_gso(false), m_flushTask(NULL), m_endOfFrame(false),
+	  m_pacingMode(pacing), m_pacingTask(NULL), m_lastFrameTime(0), m_frameInterval(0), m_byteRate(0), m_nextDeparture(0), m_stagger(0), m_sendBufferSize(0),
+	  m_frames(0), m_packetCount(0), m_syscalls(0)
+{
+	int segmentSize = 0;
+	socklen_t len = sizeof(segmentSize);
+	m_gso = (getsockopt(this->socketNum(), IPPROTO_UDP, UDP_SEGMENT, &segmentSize, &len) == 0);
+	m_buffer.reserve(RTP_BATCH_MAX_PACKETS * 1500);
+	m_packets.reserve(RTP_BATCH_MAX_PACKETS);
+	m_sendBufferSize = getSendBufferSize(env, this->socketNum());
+
+	// the streams sent from the same process should not burst together
+	m_stagger = RTP_PACING_STAGGER * (random() % 1000) / 1000;
+	if ((m_pacingMode == RtpSendOptions::PACING_TXTIME) && !enableTxTime(this->socketNum()))
+	{
+		LOG(WARN) << "batch groupsock socket:" << this->socketNum() << " SO_TXTIME not available, pacing from the event loop";
+		m_pacingMode = RtpSendOptions::PACING_BUCKET;
+	}
+	LOG(INFO) << "batch groupsock socket:" << this->socketNum() << " gso:" << m_gso << " pacing:" << m_pacingMode;
+}
+
+BatchGroupsock::~BatchGroupsock()
+{
+	this->flush();
+	env().taskScheduler().unscheduleDelayedTask(m_pacingTask);
+	if (m_sentPackets < m_timedPackets)
+	{
+		this->sendPackets(m_sentPackets, m_timedPackets);
+	}
+	if (m_frames != 0)
+	{
+		LOG(NOTICE) << "batch groupsock socket:" << this->socketNum() << " frames:" << m_frames << " packets/frame:" << (double)m_packetCount / m_frames << " syscalls/frame:" << (double)m_syscalls / m_frames;
+	}
+}
+
+// ---------------------------------
+// packets are queued, the end of the frame is flushed at once
+// ---------------------------------
+Boolean BatchGroupsock::write(struct sockaddr_storage const &addressAndPort, u_int8_t ttl, unsigned char *buffer, unsigned bufferSize)
+{
+	if (ttl != m_ttl)
+	{
+		this->flush();
+		this->setTTL(addressAndPort.ss_family, ttl);
+	}
+	// paced frames are kept whole to spread them over the frame interval
+	if ((m_pacingMode == RtpSendOptions::PACING_NONE) && (m_packets.size() - m_timedPackets >= RTP_BATCH_MAX_PACKETS))
+	{
+		this->flush();
+	}
+
+	Packet packet;
+	packet.m_offset = m_buffer.size();
+	packet.m_size = bufferSize;
+	packet.m_departure = 0;
+	packet.m_destination = addressAndPort;
+	m_buffer.insert(m_buffer.end(), buffer, buffer + bufferSize);
+	m_packets.push_back(packet);
+
+	// the marker bit ends a frame, it is also set in the type of the RTCP packets
+	// the flush is deferred to let the groupsock write the packet to all its destinations
+	if ((bufferSize < 2) || (buffer[1] & 0x80))
+	{
+		m_endOfFrame = true;
+		env().taskScheduler().unscheduleDelayedTask(m_flushTask);
+		m_flushTask = env().taskScheduler().scheduleDelayedTask(0, BatchGroupsock::flushStub, this);
+	}
+	else if (m_flushTask == NULL)
+	{
+		m_flushTask = env().taskScheduler().scheduleDelayedTask(RTP_BATCH_FLUSH_DELAY_US, BatchGroupsock::flushStub, this);
+	}
+	return True;
+}
+
+void BatchGroupsock::flush()
+{
+	env().taskScheduler().unscheduleDelayedTask(m_flushTask);
+	if (m_timedPackets < m_packets.size())
+	{
+		int64_t time = now();
+		size_t nbPackets = m_packets.size() - m_timedPackets;
+		size_t frameBytes = 0;
+		for (size_t i = m_timedPackets; i < m_packets.size(); i++)
+		{
+			frameBytes += m_packets[i].m_size;
+		}
+		if (m_endOfFrame)
+		{
+			this->measureFrame(time, frameBytes);
+			m_frames++;
+		}
+		m_packetCount += nbPackets;
+		this->schedulePackets(time, frameBytes);
+
+		unsigned long syscalls = m_syscalls;
+		this->sendDuePackets();
+		LOG(DEBUG) << "batch groupsock socket:" << this->socketNum() << " packets:" << nbPackets << " bytes:" << frameBytes << " syscalls:" << (m_syscalls - syscalls);
+	}
+	m_endOfFrame = false;
+}
+
+// ---------------------------------
+// frame interval and rate of the stream, the send buffer follows the rate
+// ---------------------------------
+void BatchGroupsock::measureFrame(int64_t time, size_t frameBytes)
+{
+	if (m_lastFrameTime != 0)
+	{
+		int64_t interval = time - m_lastFrameTime;
+		if ((interval > 0) && (interval < RTP_PACING_MAX_INTERVAL_US))
+		{
+			m_frameInterval = (m_frameInterval != 0) ? (7 * m_frameInterval + interval) / 8 : interval;
+			double byteRate = frameBytes * 1000000.0 / m_frameInterval;
+			m_byteRate = (m_byteRate != 0) ? (7 * m_byteRate + byteRate) / 8 : byteRate;
+		}
+	}
+	m_lastFrameTime = time;
+
+	unsigned int sendBufferSize = std::max((double)(2 * frameBytes), m_byteRate * RTP_SNDBUF_DURATION_MS / 1000);
+	sendBufferSize = std::min(sendBufferSize, (unsigned int)RTP_SNDBUF_MAX);
+	if (sendBufferSize > m_sendBufferSize + m_sendBufferSize / 4)
+	{
+		increaseSendBufferTo(env(), this->socketNum(), sendBufferSize);
+		m_sendBufferSize = sendBufferSize;
+		LOG(INFO) << "batch groupsock socket:" << this->socketNum() << " rate:" << (unsigned int)(m_byteRate * 8 / 1000) << "kbps send buffer:" << m_sendBufferSize;
+	}
+}
+
+void BatchGroupsock::schedulePackets(int64_t time, size_t frameBytes)
+{
+	int64_t departure = time;
+	double rate = 0; // bytes per microsecond
+	if ((m_pacingMode != RtpSendOptions::PACING_NONE) && (m_frameInterval != 0))
+	{
+		rate = std::max(frameBytes / (RTP_PACING_WINDOW * m_frameInterval), RTP_PACING_HEADROOM * m_byteRate / 1000000);
+		departure = std::max(time + (int64_t)(m_stagger * m_frameInterval), m_nextDeparture);
+	}
+
+	double packetTime = departure;
+	for (size_t i = m_timedPackets; i < m_packets.size(); i++)
+	{
+		m_packets[i].m_departure = (int64_t)packetTime;
+		if (rate > 0)
+		{
+			packetTime += m_packets[i].m_size / rate;
+		}
+	}
+	m_nextDeparture = (int64_t)packetTime;
+	m_timedPackets = m_packets.size();
+}
+
+void BatchGroupsock::sendDuePackets()
+{
+	env().taskScheduler().unscheduleDelayedTask(m_pacingTask);
+	size_t lastPacket = m_timedPackets;
+	if (m_pacingMode == RtpSendOptions::PACING_BUCKET)
+	{
+		// the bucket allows a short burst
+		int64_t time = now() + RTP_PACING_BURST_US;
+		lastPacket = m_sentPackets;
+		while ((lastPacket < m_timedPackets) && (m_packets[lastPacket].m_departure <= time))
+		{
+			lastPacket++;
+		}
+	}
+	if (lastPacket > m_sentPackets)
+	{
+		this->sendPackets(m_sentPackets, lastPacket);
+		m_sentPackets = lastPacket;
+	}
+	if (m_sentPackets < m_timedPackets)
+	{
+		int64_t delay = m_packets[m_sentPackets].m_departure - now();
+		m_pacingTask = env().taskScheduler().scheduleDelayedTask(std::max(delay, (int64_t)0), BatchGroupsock::sendDuePacketsStub, this);
+	}
+	this->compact();
+}
+
+void BatchGroupsock::compact()
+{
+	if (m_sentPackets == m_packets.size())
+	{
+		m_packets.clear();
+		m_buffer.clear();
+		m_sentPackets = 0;
+		m_timedPackets = 0;
+	}
+	else if (m_sentPackets >= RTP_BATCH_MAX_PACKETS)
+	{
+		size_t offset = m_packets[m_sentPackets].m_offset;
+		m_buffer.erase(m_buffer.begin(), m_buffer.begin() + offset);
+		m_packets.erase(m_packets.begin(), m_packets.begin() + m_sentPackets);
+		for (Packet &packet : m_packets)
+		{
+			packet.m_offset -= offset;
+		}
+		m_timedPackets -= m_sentPackets;
+		m_sentPackets = 0;
+	}
+}
+
+// ---------------------------------
+// one sendmmsg, consecutive packets of the same size to the same destination are GSO segments
+// with SO_TXTIME each packet is a message with its departure time
+// ---------------------------------
+void BatchGroupsock::sendPackets(size_t firstPacket, size_t lastPacket)
+{
+	size_t nbPackets = lastPacket - firstPacket;
+	bool txtime = (m_pacingMode == RtpSendOptions::PACING_TXTIME);
+	std::vector<struct mmsghdr> messages(nbPackets);
+	std::vector<struct iovec> iovecs(nbPackets);
+	std::vector<size_t> messagePackets(nbPackets);
+	const size_t controlSize = CMSG_SPACE(sizeof(uint64_t));
+	std::vector<char> controls(nbPackets * controlSize);
+	size_t nbMessages = 0;
+	size_t messageSize = 0;
+
+	for (size_t i = 0; i < nbPackets; i++)
+	{
+		const Packet &packet = m_packets[firstPacket + i];
+		iovecs[i].iov_base = &m_buffer[packet.m_offset];
+		iovecs[i].iov_len = packet.m_size;
+
+		// only the last segment of a message could be shorter
+		bool segment = false;
+		if (m_gso && !txtime && (nbMessages > 0))
+		{
+			const Packet &previous = m_packets[firstPacket + i - 1];
+			const Packet &first = m_packets[messagePackets[nbMessages - 1]];
+			struct msghdr &msg = messages[nbMessages - 1].msg_hdr;
+			segment = sameDestination(previous.m_destination, packet.m_destination) && (previous.m_size == first.m_size) && (packet.m_size <= first.m_size) && (msg.msg_iovlen < RTP_BATCH_MAX_SEGMENTS) && (messageSize + packet.m_size <= RTP_BATCH_MAX_GSO_SIZE);
+		}
+
+		if (segment)
+		{
+			messages[nbMessages - 1].msg_hdr.msg_iovlen++;
+			messageSize += packet.m_size;
+		}
+		else
+		{
+			struct msghdr &msg = messages[nbMessages].msg_hdr;
+			memset(&messages[nbMessages], 0, sizeof(messages[nbMessages]));
+			msg.msg_name = (void *)&packet.m_destination;
+			msg.msg_namelen = (packet.m_destination.ss_family == AF_INET6) ? sizeof(struct sockaddr_in6) : sizeof(struct sockaddr_in);
+			msg.msg_iov = &iovecs[i];
+			msg.msg_iovlen = 1;
+			messagePackets[nbMessages] = firstPacket + i;
+			messageSize = packet.m_size;
+			nbMessages++;
+		}
+	}
+
+	for (size_t i = 0; i < nbMessages; i++)
+	{
+		struct msghdr &msg = messages[i].msg_hdr;
+		if (txtime)
+		{
+#ifdef SCM_TXTIME
+			msg.msg_control = &controls[i * controlSize];
+			msg.msg_controllen = CMSG_SPACE(sizeof(uint64_t));
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = SOL_SOCKET;
+			cmsg->cmsg_type = SCM_TXTIME;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint64_t));
+			uint64_t departure = m_packets[messagePackets[i]].m_departure * 1000;
+			memcpy(CMSG_DATA(cmsg), &departure, sizeof(departure));
+#endif
+		}
+		else if (msg.msg_iovlen > 1)
+		{
+			msg.msg_control = &controls[i * controlSize];
+			msg.msg_controllen = CMSG_SPACE(sizeof(uint16_t));
+			struct cmsghdr *cmsg = CMSG_FIRSTHDR(&msg);
+			cmsg->cmsg_level = IPPROTO_UDP;
+			cmsg->cmsg_type = UDP_SEGMENT;
+			cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+			uint16_t segmentSize = m_packets[messagePackets[i]].m_size;
+			memcpy(CMSG_DATA(cmsg), &segmentSize, sizeof(segmentSize));
+		}
+	}
+
+	size_t sent = 0;
+	while (sent < nbMessages)
+	{
+		int ret = sendmmsg(this->socketNum(), &messages[sent], nbMessages - sent, 0);
+		m_syscalls++;
+		if (ret > 0)
+		{
+			sent += ret;
+		}
+		else if ((ret < 0) && (errno == EINTR))
+		{
+			continue;
+		}
+		else if ((ret < 0) && m_gso && ((errno == EIO) || (errno == EINVAL)))
+		{
+			// interface without checksum offload
+			LOG(WARN) << "batch groupsock socket:" << this->socketNum() << " disable GSO error:" << strerror(errno);
+			m_gso = false;
+			this->sendPackets(messagePackets[sent], lastPacket);
+			break;
+		}
+		else
+		{
+			// like sendto, packets that do not fit in the socket buffer are lost
+			LOG(DEBUG) << "batch groupsock socket:" << this->socketNum() << " lost messages:" << (nbMessages - sent) << " error:" << strerror(errno);
+			break;
+		}
+	}
+}
+
+void BatchGroupsock::setTTL(int family, u_int8_t ttl)
+{
+	m_ttl = ttl;
+	if (family == AF_INET6)
+	{
+		int hops = ttl;
+		setsockopt(this->socketNum(), IPPROTO_IPV6, IPV6_MULTICAST_HOPS, &hops, sizeof(hops));
+	}
+	else
+	{
+		setsockopt(this->socketNum(), IPPROTO_IP, IP_MULTICAST_TTL, &ttl, sizeof(ttl));
+	}
+}
+
+#endif
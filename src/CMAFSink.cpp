@@ -0,0 +1,562 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CMAFSink.cpp
+**
+** Implement a live555 Sink that store fragmented MP4 (CMAF) segments in memory
+**
+** -------------------------------------------------------------------------*/
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+#include <iomanip>
+
+#include "logger.h"
+#include "CMAFSink.h"
+
+// ---------------------------------
+// ISO BMFF boxes
+// ---------------------------------
+static void putU8(std::string &out, uint8_t value)
+{
+	out.push_back((char)value);
+}
+
+static void putU16(std::string &out, uint16_t value)
+{
+	out.push_back((char)(value >> 8));
+	out.push_back((char)value);
+}
+
+static void putU32(std::string &out, uint32_t value)
+{
+	putU16(out, value >> 16);
+	putU16(out, value & 0xFFFF);
+}
+
+static void putU64(std::string &out, uint64_t value)
+{
+	putU32(out, value >> 32);
+	putU32(out, value & 0xFFFFFFFF);
+}
+
+static std::string box(const char *type, const std::string &content)
+{
+	std::string out;
+	putU32(out, 8 + content.size());
+	out.append(type, 4);
+	out.append(content);
+	return out;
+}
+
+static std::string fullBox(const char *type, uint8_t version, uint32_t flags, const std::string &content)
+{
+	std::string header;
+	putU32(header, (version << 24) | (flags & 0xFFFFFF));
+	return box(type, header + content);
+}
+
+static void putMatrix(std::string &out)
+{
+	const uint32_t matrix[] = {0x00010000, 0, 0, 0, 0x00010000, 0, 0, 0, 0x40000000};
+	for (uint32_t value : matrix)
+	{
+		putU32(out, value);
+	}
+}
+
+// NAL unit without the emulation prevention bytes
+static std::string unescapeNal(const std::string &nal, size_t maxSize)
+{
+	std::string out;
+	for (size_t i = 0; (i < nal.size()) && (out.size() < maxSize); i++)
+	{
+		if ((i >= 2) && (nal[i] == 3) && (nal[i - 1] == 0) && (nal[i - 2] == 0))
+		{
+			continue;
+		}
+		out.push_back(nal[i]);
+	}
+	return out;
+}
+
+static std::string stripStartCode(const std::string &frame)
+{
+	size_t start = 0;
+	if ((frame.size() > 4) && (frame.compare(0, 4, std::string("\0\0\0\1", 4)) == 0))
+	{
+		start = 4;
+	}
+	else if ((frame.size() > 3) && (frame.compare(0, 3, std::string("\0\0\1", 3)) == 0))
+	{
+		start = 3;
+	}
+	return frame.substr(start);
+}
+
+// ---------------------------------
+// codecs parameter
+// ---------------------------------
+std::string CMAFSink::getCodecs(const std::string &format, const std::string &frame)
+{
+	std::string sps = stripStartCode(frame);
+	std::ostringstream os;
+	if ((format == "video/H264") && (sps.size() >= 4))
+	{
+		os << "avc1." << std::hex << std::setfill('0') << std::setw(2) << (int)(uint8_t)sps[1] << std::setw(2) << (int)(uint8_t)sps[2] << std::setw(2) << (int)(uint8_t)sps[3];
+	}
+	else if (format == "video/H265")
+	{
+		// profile_tier_level follows the NAL header and the first byte of the SPS
+		std::string raw = unescapeNal(sps, 15);
+		if (raw.size() >= 15)
+		{
+			const uint8_t *ptl = (const uint8_t *)raw.c_str() + 3;
+			uint8_t profileSpace = ptl[0] >> 6;
+			uint32_t compatibility = (ptl[1] << 24) | (ptl[2] << 16) | (ptl[3] << 8) | ptl[4];
+			uint32_t reversed = 0;
+			for (int i = 0; i < 32; i++)
+			{
+				reversed |= ((compatibility >> i) & 1) << (31 - i);
+			}
+			os << "hvc1.";
+			if (profileSpace != 0)
+			{
+				os << (char)('A' + profileSpace - 1);
+			}
+			os << (int)(ptl[0] & 0x1F) << "." << std::hex << std::uppercase << reversed << std::dec;
+			os << "." << ((ptl[0] & 0x20) ? "H" : "L") << (int)ptl[11];
+			int lastConstraint = 10;
+			while ((lastConstraint >= 5) && (ptl[lastConstraint] == 0))
+			{
+				lastConstraint--;
+			}
+			for (int i = 5; i <= lastConstraint; i++)
+			{
+				os << "." << std::hex << std::uppercase << (int)ptl[i] << std::dec;
+			}
+		}
+	}
+	return os.str();
+}
+
+// -----------------------------------------
+//    CMAFSink
+// -----------------------------------------
+CMAFSink::CMAFSink(UsageEnvironment &env, const std::string &format, V4L2DeviceSource *device, unsigned int chunkSize, unsigned int sliceDuration, unsigned int partDuration, unsigned int nbSlices)
+	: MemoryBufferSink(env, chunkSize, sliceDuration, partDuration, nbSlices), m_format(format), m_device(device),
+	  m_accessUnitSize(0), m_samplesSize(0), m_fragmentTime(0), m_fragmentSequence(0)
+{
+	m_bufferSize = OutPacketBuffer::maxSize;
+	m_buffer = new unsigned char[m_bufferSize];
+}
+
+CMAFSink::~CMAFSink()
+{
+	delete[] m_buffer;
+}
+
+Boolean CMAFSink::continuePlaying()
+{
+	Boolean ret = False;
+	if (fSource != NULL)
+	{
+		fSource->getNextFrame(m_buffer, m_bufferSize,
+							  afterGettingNal, this,
+							  onSourceClosure, this);
+		ret = True;
+	}
+	return ret;
+}
+
+void CMAFSink::afterGettingNal(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime)
+{
+	if (numTruncatedBytes > 0)
+	{
+		envir() << "CMAFSink::afterGettingNal(): The input frame data was too large for our buffer size truncated:" << numTruncatedBytes << " bufferSize:" << m_bufferSize << "\n";
+		m_bufferSize += numTruncatedBytes;
+		delete[] m_buffer;
+		m_buffer = new unsigned char[m_bufferSize];
+	}
+	else if (frameSize > 0)
+	{
+		std::string nal = stripStartCode(std::string((const char *)m_buffer, frameSize));
+		double time = presentationTime.tv_sec + presentationTime.tv_usec / 1000000.0;
+		if (m_hasAccessUnit && (time != m_accessUnitTime))
+		{
+			this->endAccessUnit(time);
+		}
+		if (!m_hasAccessUnit)
+		{
+			m_hasAccessUnit = true;
+			m_accessUnitTime = time;
+			m_accessUnitKey = false;
+		}
+
+		// parameter sets go to the init segment, access unit delimiters are not needed
+		bool configuration = false;
+		if (!nal.empty() && (m_format == "video/H264"))
+		{
+			int type = nal[0] & 0x1F;
+			std::string *parameterSet = (type == 7) ? &m_sps : ((type == 8) ? &m_pps : NULL);
+			if (parameterSet && (*parameterSet != nal))
+			{
+				parameterSet->assign(nal);
+				m_init.reset();
+			}
+			configuration = (parameterSet != NULL) || (type == 9);
+		}
+		else if (!nal.empty() && (m_format == "video/H265"))
+		{
+			int type = (nal[0] & 0x7E) >> 1;
+			std::string *parameterSet = (type == 32) ? &m_vps : ((type == 33) ? &m_sps : ((type == 34) ? &m_pps : NULL));
+			if (parameterSet && (*parameterSet != nal))
+			{
+				parameterSet->assign(nal);
+				m_init.reset();
+			}
+			configuration = (parameterSet != NULL) || (type == 35);
+		}
+
+		if (!configuration && !nal.empty())
+		{
+			m_accessUnitKey = m_accessUnitKey || ((m_device != NULL) && m_device->isKeyFrame(nal.c_str(), nal.size()));
+
+			// length prefixed NAL unit
+			std::string length;
+			putU32(length, nal.size());
+			this->appendBytes(length.c_str(), length.size(), m_accessUnitSpans);
+			this->appendBytes(nal.c_str(), nal.size(), m_accessUnitSpans);
+			m_accessUnitSize += length.size() + nal.size();
+		}
+	}
+
+	continuePlaying();
+}
+
+// the access unit is complete when the next one starts, its duration is known
+void CMAFSink::endAccessUnit(double nextTime)
+{
+	Slice &slice = m_outputBuffers[m_sequence];
+	double duration = nextTime - m_accessUnitTime;
+
+	if (m_accessUnitKey && (!m_started || (m_accessUnitTime - slice.m_start >= m_sliceDuration)))
+	{
+		this->flushFragment();
+		this->cutSlice(m_accessUnitTime, m_outputBuffers[m_sequence].m_size);
+	}
+	else if (m_started && (m_partDuration != 0) && !m_samples.empty() && ((m_accessUnitTime - slice.m_partStart + duration) * 1000 > m_partDuration))
+	{
+		this->flushFragment();
+		this->closePart(slice, slice.m_size, m_accessUnitTime);
+		this->notifyWaiters();
+	}
+
+	// what is received before the first keyframe cannot be decoded
+	if (m_started && (m_accessUnitSize != 0))
+	{
+		if (m_samples.empty())
+		{
+			m_fragmentTime = m_accessUnitTime;
+		}
+		Sample sample;
+		sample.m_duration = (uint32_t)llround(duration * CMAF_TIMESCALE);
+		sample.m_size = m_accessUnitSize;
+		sample.m_keyFrame = m_accessUnitKey;
+		m_samples.push_back(sample);
+		m_samplesSpans.insert(m_samplesSpans.end(), m_accessUnitSpans.begin(), m_accessUnitSpans.end());
+		m_samplesSize += m_accessUnitSize;
+	}
+	m_accessUnitSpans.clear();
+	m_accessUnitSize = 0;
+	m_hasAccessUnit = false;
+}
+
+// moof and mdat header are written in the arena in front of the samples
+void CMAFSink::flushFragment()
+{
+	if (m_samples.empty())
+	{
+		return;
+	}
+
+	std::string mfhd;
+	putU32(mfhd, ++m_fragmentSequence);
+
+	std::string tfhd;
+	putU32(tfhd, 1); // track_ID
+	std::string tfdt;
+	putU64(tfdt, (uint64_t)llround(m_fragmentTime * CMAF_TIMESCALE));
+
+	// data_offset, sample duration, size and flags
+	std::string trun;
+	putU32(trun, m_samples.size());
+	size_t dataOffsetPosition = trun.size();
+	putU32(trun, 0);
+	for (const Sample &sample : m_samples)
+	{
+		putU32(trun, sample.m_duration);
+		putU32(trun, sample.m_size);
+		putU32(trun, sample.m_keyFrame ? 0x02000000 : 0x01010000);
+	}
+	size_t moofSize = 8 + (8 + mfhd.size() + 4) + 8 + (8 + tfhd.size() + 4) + (8 + tfdt.size() + 4) + (8 + trun.size() + 4);
+	uint32_t dataOffset = moofSize + 8;
+	trun[dataOffsetPosition] = (char)(dataOffset >> 24);
+	trun[dataOffsetPosition + 1] = (char)(dataOffset >> 16);
+	trun[dataOffsetPosition + 2] = (char)(dataOffset >> 8);
+	trun[dataOffsetPosition + 3] = (char)dataOffset;
+
+	std::string traf = fullBox("tfhd", 0, 0x020000, tfhd) + fullBox("tfdt", 1, 0, tfdt) + fullBox("trun", 0, 0x000701, trun);
+	std::string header = box("moof", fullBox("mfhd", 0, 0, mfhd) + box("traf", traf));
+	putU32(header, 8 + m_samplesSize);
+	header.append("mdat");
+
+	std::vector<MemorySegment::Span> headerSpans;
+	this->appendBytes(header.c_str(), header.size(), headerSpans);
+	Slice &slice = m_outputBuffers[m_sequence];
+	for (const MemorySegment::Span &span : headerSpans)
+	{
+		this->appendSpan(slice, span);
+	}
+	for (const MemorySegment::Span &span : m_samplesSpans)
+	{
+		this->appendSpan(slice, span);
+	}
+	m_samples.clear();
+	m_samplesSpans.clear();
+	m_samplesSize = 0;
+}
+
+// copy in the free part of the chunks, contiguous bytes stay in one span
+void CMAFSink::appendBytes(const char *data, size_t size, std::vector<MemorySegment::Span> &spans)
+{
+	while (size > 0)
+	{
+		if (!m_chunk || (m_chunkUsed == m_chunk->capacity()))
+		{
+			m_chunk = m_arena->acquire();
+			m_chunkUsed = 0;
+		}
+		size_t length = std::min(size, m_chunk->capacity() - m_chunkUsed);
+		memcpy(m_chunk->data() + m_chunkUsed, data, length);
+		if (!spans.empty() && (spans.back().m_chunk == m_chunk) && (spans.back().m_offset + spans.back().m_size == m_chunkUsed))
+		{
+			spans.back().m_size += length;
+		}
+		else
+		{
+			MemorySegment::Span span = {m_chunk, m_chunkUsed, length};
+			spans.push_back(span);
+		}
+		m_chunkUsed += length;
+		data += length;
+		size -= length;
+	}
+}
+
+// ---------------------------------
+// init segment
+// ---------------------------------
+std::string CMAFSink::getCodecs()
+{
+	return CMAFSink::getCodecs(m_format, m_sps);
+}
+
+std::shared_ptr<const MemorySegment> CMAFSink::getInitSegment()
+{
+	if (!m_init)
+	{
+		if (m_sps.empty() && m_device)
+		{
+			// parameter sets are not repeated in the stream, take them from the source
+			std::list<std::string> initFrames = m_device->getInitFrames();
+			std::list<std::string>::iterator it = initFrames.begin();
+			if ((m_format == "video/H265") && (it != initFrames.end()))
+			{
+				m_vps = stripStartCode(*it++);
+			}
+			if (it != initFrames.end())
+			{
+				m_sps = stripStartCode(*it++);
+			}
+			if (it != initFrames.end())
+			{
+				m_pps = stripStartCode(*it++);
+			}
+		}
+		std::string init = this->createInitSegment();
+		if (!init.empty())
+		{
+			m_init.reset(new MemorySegment(init));
+		}
+	}
+	return m_init;
+}
+
+std::string CMAFSink::createInitSegment()
+{
+	std::string config;
+	std::string sampleEntry;
+	if ((m_format == "video/H264") && (m_sps.size() >= 4) && !m_pps.empty())
+	{
+		putU8(config, 1);
+		putU8(config, m_sps[1]);
+		putU8(config, m_sps[2]);
+		putU8(config, m_sps[3]);
+		putU8(config, 0xFF); // lengthSizeMinusOne = 3
+		putU8(config, 0xE1); // one SPS
+		putU16(config, m_sps.size());
+		config.append(m_sps);
+		putU8(config, 1); // one PPS
+		putU16(config, m_pps.size());
+		config.append(m_pps);
+		uint8_t profile = m_sps[1];
+		if ((profile == 100) || (profile == 110) || (profile == 122) || (profile == 244))
+		{
+			// 4:2:0 8 bits, no SPS extension
+			putU8(config, 0xFD);
+			putU8(config, 0xF8);
+			putU8(config, 0xF8);
+			putU8(config, 0);
+		}
+		config = box("avcC", config);
+		sampleEntry = "avc1";
+	}
+	else if ((m_format == "video/H265") && !m_vps.empty() && !m_sps.empty() && !m_pps.empty())
+	{
+		std::string raw = unescapeNal(m_sps, 15);
+		if (raw.size() < 15)
+		{
+			return std::string();
+		}
+		putU8(config, 1);
+		config.append(raw, 3, 12); // profile, compatibility, constraint and level
+		putU16(config, 0xF000);	   // min_spatial_segmentation_idc
+		putU8(config, 0xFC);	   // parallelismType
+		putU8(config, 0xFD);	   // chroma_format_idc 4:2:0
+		putU8(config, 0xF8);	   // bit_depth_luma_minus8
+		putU8(config, 0xF8);	   // bit_depth_chroma_minus8
+		putU16(config, 0);		   // avgFrameRate
+		putU8(config, 0x0F);	   // one temporal layer, nested, lengthSizeMinusOne = 3
+		putU8(config, 3);
+		const std::string *parameterSets[] = {&m_vps, &m_sps, &m_pps};
+		const uint8_t types[] = {32, 33, 34};
+		for (int i = 0; i < 3; i++)
+		{
+			putU8(config, 0x80 | types[i]);
+			putU16(config, 1);
+			putU16(config, parameterSets[i]->size());
+			config.append(*parameterSets[i]);
+		}
+		config = box("hvcC", config);
+		sampleEntry = "hvc1";
+	}
+	else
+	{
+		return std::string();
+	}
+
+	uint16_t width = 0;
+	uint16_t height = 0;
+	if (m_device && m_device->getDevice() && (m_device->getDevice()->getWidth() > 0))
+	{
+		width = m_device->getDevice()->getWidth();
+		height = m_device->getDevice()->getHeight();
+	}
+
+	std::string ftyp;
+	ftyp.append("iso6");
+	putU32(ftyp, 0);
+	ftyp.append("iso6cmfcdash");
+
+	std::string mvhd;
+	putU32(mvhd, 0); // creation_time
+	putU32(mvhd, 0); // modification_time
+	putU32(mvhd, 1000);
+	putU32(mvhd, 0); // duration
+	putU32(mvhd, 0x00010000);
+	putU16(mvhd, 0x0100);
+	mvhd.append(10, '\0');
+	putMatrix(mvhd);
+	mvhd.append(24, '\0');
+	putU32(mvhd, 2); // next_track_ID
+
+	std::string tkhd;
+	putU32(tkhd, 0);
+	putU32(tkhd, 0);
+	putU32(tkhd, 1); // track_ID
+	putU32(tkhd, 0);
+	putU32(tkhd, 0); // duration
+	tkhd.append(8, '\0');
+	putU16(tkhd, 0); // layer
+	putU16(tkhd, 0); // alternate_group
+	putU16(tkhd, 0); // volume
+	putU16(tkhd, 0);
+	putMatrix(tkhd);
+	putU32(tkhd, width << 16);
+	putU32(tkhd, height << 16);
+
+	std::string mdhd;
+	putU32(mdhd, 0);
+	putU32(mdhd, 0);
+	putU32(mdhd, CMAF_TIMESCALE);
+	putU32(mdhd, 0);
+	putU16(mdhd, 0x55C4); // und
+	putU16(mdhd, 0);
+
+	std::string hdlr;
+	putU32(hdlr, 0);
+	hdlr.append("vide");
+	hdlr.append(12, '\0');
+	hdlr.append("VideoHandler", strlen("VideoHandler") + 1);
+
+	std::string visualSampleEntry;
+	visualSampleEntry.append(6, '\0');
+	putU16(visualSampleEntry, 1); // data_reference_index
+	visualSampleEntry.append(16, '\0');
+	putU16(visualSampleEntry, width);
+	putU16(visualSampleEntry, height);
+	putU32(visualSampleEntry, 0x00480000);
+	putU32(visualSampleEntry, 0x00480000);
+	putU32(visualSampleEntry, 0);
+	putU16(visualSampleEntry, 1); // frame_count
+	visualSampleEntry.append(32, '\0');
+	putU16(visualSampleEntry, 0x0018);
+	putU16(visualSampleEntry, 0xFFFF);
+	visualSampleEntry.append(config);
+
+	std::string stsd;
+	putU32(stsd, 1);
+	stsd.append(box(sampleEntry.c_str(), visualSampleEntry));
+
+	std::string empty;
+	putU32(empty, 0);
+	std::string stsz;
+	putU32(stsz, 0);
+	putU32(stsz, 0);
+	std::string stbl = fullBox("stsd", 0, 0, stsd) + fullBox("stts", 0, 0, empty) + fullBox("stsc", 0, 0, empty) + fullBox("stsz", 0, 0, stsz) + fullBox("stco", 0, 0, empty);
+
+	std::string dref;
+	putU32(dref, 1);
+	dref.append(fullBox("url ", 0, 1, std::string()));
+	std::string vmhd(8, '\0');
+	std::string minf = fullBox("vmhd", 0, 1, vmhd) + box("dinf", fullBox("dref", 0, 0, dref)) + box("stbl", stbl);
+
+	std::string mdia = fullBox("mdhd", 0, 0, mdhd) + fullBox("hdlr", 0, 0, hdlr) + box("minf", minf);
+	std::string trak = fullBox("tkhd", 0, 3, tkhd) + box("mdia", mdia);
+
+	std::string trex;
+	putU32(trex, 1); // track_ID
+	putU32(trex, 1); // default_sample_description_index
+	putU32(trex, 0);
+	putU32(trex, 0);
+	putU32(trex, 0);
+
+	std::string moov = fullBox("mvhd", 0, 0, mvhd) + box("trak", trak) + box("mvex", fullBox("trex", 0, 0, trex));
+	return box("ftyp", ftyp) + box("moov", moov);
+}
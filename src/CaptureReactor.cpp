@@ -0,0 +1,255 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** CaptureReactor.cpp
+**
+** epoll based capture threads shared by all the devices
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+
+#include "logger.h"
+#include "CaptureReactor.h"
+
+#define CAPTURE_REACTOR_MAX_EVENTS 16
+
+unsigned int CaptureReactor::m_nbThreads = 1;
+std::vector<int> CaptureReactor::m_cpus;
+int CaptureReactor::m_priority = 0;
+unsigned int CaptureReactor::m_stallTimeoutMs = 2000;
+
+// ---------------------------------
+// reactor started with the first device
+// ---------------------------------
+CaptureReactor *CaptureReactor::getInstance()
+{
+	static CaptureReactor *reactor = new CaptureReactor();
+	return reactor;
+}
+
+CaptureReactor::CaptureReactor() : m_nextWorker(0)
+{
+	unsigned int nbThreads = (m_nbThreads > 0) ? m_nbThreads : 1;
+	for (unsigned int i = 0; i < nbThreads; i++)
+	{
+		Worker *worker = new Worker();
+		worker->m_epollFd = epoll_create1(EPOLL_CLOEXEC);
+		if (worker->m_epollFd == -1)
+		{
+			LOG(ERROR) << "epoll_create1 error:" << strerror(errno);
+			delete worker;
+			continue;
+		}
+
+		// the watchdog tick is also used to retry the devices in error
+		worker->m_timerFd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+		if (worker->m_timerFd != -1)
+		{
+			itimerspec period;
+			period.it_interval.tv_sec = m_stallTimeoutMs / 1000;
+			period.it_interval.tv_nsec = (m_stallTimeoutMs % 1000) * 1000000;
+			period.it_value = period.it_interval;
+			timerfd_settime(worker->m_timerFd, 0, &period, NULL);
+
+			epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = worker->m_timerFd;
+			epoll_ctl(worker->m_epollFd, EPOLL_CTL_ADD, worker->m_timerFd, &ev);
+		}
+
+		if (!m_cpus.empty())
+		{
+			worker->m_cpu = m_cpus[i % m_cpus.size()];
+		}
+		m_workers.push_back(worker);
+		worker->m_thread = std::thread(&CaptureReactor::thread, this, worker);
+	}
+	LOG(NOTICE) << "capture reactor threads:" << m_workers.size() << " stall timeout:" << m_stallTimeoutMs << "ms";
+}
+
+// ---------------------------------
+// devices are spread over the threads
+// ---------------------------------
+bool CaptureReactor::addDevice(int fd, ReadHandler *handler, void *clientData)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	if (m_workers.empty())
+	{
+		return false;
+	}
+	Worker *worker = m_workers[m_nextWorker++ % m_workers.size()];
+
+	std::lock_guard<std::mutex> workerLock(worker->m_mutex);
+	Device &device = worker->m_devices[fd];
+	device.m_fd = fd;
+	device.m_handler = handler;
+	device.m_clientData = clientData;
+	clock_gettime(CLOCK_MONOTONIC, &device.m_lastFrame);
+	device.m_stalled = false;
+	device.m_failed = false;
+
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = fd;
+	if (epoll_ctl(worker->m_epollFd, EPOLL_CTL_ADD, fd, &ev) != 0)
+	{
+		LOG(ERROR) << "epoll_ctl add fd:" << fd << " error:" << strerror(errno);
+		worker->m_devices.erase(fd);
+		return false;
+	}
+	m_deviceWorker[fd] = worker;
+	LOG(NOTICE) << "capture reactor add fd:" << fd << " cpu:" << worker->m_cpu;
+	return true;
+}
+
+// once returned, the handler is not called anymore
+void CaptureReactor::removeDevice(int fd)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	std::map<int, Worker *>::iterator it = m_deviceWorker.find(fd);
+	if (it != m_deviceWorker.end())
+	{
+		Worker *worker = it->second;
+		std::lock_guard<std::mutex> workerLock(worker->m_mutex);
+		epoll_ctl(worker->m_epollFd, EPOLL_CTL_DEL, fd, NULL);
+		worker->m_devices.erase(fd);
+		m_deviceWorker.erase(it);
+	}
+}
+
+// ---------------------------------
+// thread mainloop
+// ---------------------------------
+void CaptureReactor::thread(Worker *worker)
+{
+	if (worker->m_cpu >= 0)
+	{
+		cpu_set_t cpuset;
+		CPU_ZERO(&cpuset);
+		CPU_SET(worker->m_cpu, &cpuset);
+		int ret = pthread_setaffinity_np(pthread_self(), sizeof(cpuset), &cpuset);
+		if (ret != 0)
+		{
+			LOG(WARN) << "cannot set affinity cpu:" << worker->m_cpu << " error:" << strerror(ret);
+		}
+	}
+	if (m_priority > 0)
+	{
+		sched_param param;
+		memset(&param, 0, sizeof(param));
+		param.sched_priority = m_priority;
+		int ret = pthread_setschedparam(pthread_self(), SCHED_FIFO, &param);
+		if (ret != 0)
+		{
+			LOG(WARN) << "cannot set SCHED_FIFO priority:" << m_priority << " error:" << strerror(ret);
+		}
+	}
+
+	LOG(NOTICE) << "begin capture reactor thread";
+	epoll_event events[CAPTURE_REACTOR_MAX_EVENTS];
+	for (;;)
+	{
+		int nbEvents = epoll_wait(worker->m_epollFd, events, CAPTURE_REACTOR_MAX_EVENTS, -1);
+		if (nbEvents < 0)
+		{
+			if (errno == EINTR)
+			{
+				continue;
+			}
+			LOG(ERROR) << "epoll_wait error:" << strerror(errno);
+			break;
+		}
+
+		std::lock_guard<std::mutex> lock(worker->m_mutex);
+		for (int i = 0; i < nbEvents; i++)
+		{
+			int fd = events[i].data.fd;
+			if (fd == worker->m_timerFd)
+			{
+				uint64_t expirations = 0;
+				if (::read(fd, &expirations, sizeof(expirations)) > 0)
+				{
+					this->checkDevices(worker);
+				}
+			}
+			else
+			{
+				// the device may have been removed since epoll_wait returned
+				std::map<int, Device>::iterator it = worker->m_devices.find(fd);
+				if (it != worker->m_devices.end())
+				{
+					this->readDevice(worker, it->second);
+				}
+			}
+		}
+	}
+	LOG(NOTICE) << "end capture reactor thread";
+}
+
+void CaptureReactor::readDevice(Worker *worker, Device &device)
+{
+	if (device.m_handler(device.m_clientData) > 0)
+	{
+		clock_gettime(CLOCK_MONOTONIC, &device.m_lastFrame);
+		if (device.m_stalled)
+		{
+			LOG(NOTICE) << "capture fd:" << device.m_fd << " resumed";
+			device.m_stalled = false;
+		}
+	}
+	else if (errno == EAGAIN)
+	{
+		LOG(DEBUG) << "Retrying getNextFrame";
+	}
+	else
+	{
+		// keep the thread running for the other devices, the watchdog retries later
+		LOG(ERROR) << "capture fd:" << device.m_fd << " error:" << strerror(errno);
+		epoll_ctl(worker->m_epollFd, EPOLL_CTL_DEL, device.m_fd, NULL);
+		device.m_failed = true;
+	}
+}
+
+// ---------------------------------
+// watchdog
+// ---------------------------------
+void CaptureReactor::checkDevices(Worker *worker)
+{
+	timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	for (std::map<int, Device>::iterator it = worker->m_devices.begin(); it != worker->m_devices.end(); ++it)
+	{
+		Device &device = it->second;
+		if (device.m_failed)
+		{
+			epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN;
+			ev.data.fd = device.m_fd;
+			if (epoll_ctl(worker->m_epollFd, EPOLL_CTL_ADD, device.m_fd, &ev) == 0)
+			{
+				LOG(NOTICE) << "capture fd:" << device.m_fd << " retry";
+				device.m_failed = false;
+				device.m_lastFrame = now;
+			}
+		}
+
+		long elapsedMs = (now.tv_sec - device.m_lastFrame.tv_sec) * 1000 + (now.tv_nsec - device.m_lastFrame.tv_nsec) / 1000000;
+		if (!device.m_stalled && (elapsedMs > (long)m_stallTimeoutMs))
+		{
+			LOG(WARN) << "capture fd:" << device.m_fd << " stalled since " << elapsedMs << "ms";
+			device.m_stalled = true;
+		}
+	}
+}
@@ -0,0 +1,375 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** EpollTaskScheduler.cpp
+**
+** live555 TaskScheduler based on epoll
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/resource.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "EpollTaskScheduler.h"
+
+#define EPOLL_SCHEDULER_MAX_EVENTS 256
+#define EPOLL_SCHEDULER_MAX_TIMEOUT_MS 1000000
+// the heap is rebuilt when most of its tasks were unscheduled
+#define EPOLL_SCHEDULER_MIN_COMPACT_SIZE 64
+
+EpollTaskScheduler *EpollTaskScheduler::createNew()
+{
+	EpollTaskScheduler *scheduler = NULL;
+	int epollFd = epoll_create1(EPOLL_CLOEXEC);
+	int eventFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if ((epollFd != -1) && (eventFd != -1))
+	{
+		scheduler = new EpollTaskScheduler(epollFd, eventFd);
+	}
+	else
+	{
+		LOG(ERROR) << "cannot create epoll scheduler error:" << strerror(errno);
+		if (epollFd != -1)
+			close(epollFd);
+		if (eventFd != -1)
+			close(eventFd);
+	}
+	return scheduler;
+}
+
+EpollTaskScheduler::EpollTaskScheduler(int epollFd, int eventFd)
+	: m_epollFd(epollFd), m_eventFd(eventFd), m_lastTaskId(0), m_triggerPending(false)
+{
+	epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN;
+	ev.data.fd = m_eventFd;
+	epoll_ctl(m_epollFd, EPOLL_CTL_ADD, m_eventFd, &ev);
+
+	// sockets are no more limited by FD_SETSIZE, only by the file limit
+	rlimit limit;
+	if ((getrlimit(RLIMIT_NOFILE, &limit) == 0) && (limit.rlim_cur < limit.rlim_max))
+	{
+		limit.rlim_cur = limit.rlim_max;
+		setrlimit(RLIMIT_NOFILE, &limit);
+	}
+	LOG(NOTICE) << "epoll scheduler max files:" << limit.rlim_cur;
+}
+
+EpollTaskScheduler::~EpollTaskScheduler()
+{
+	close(m_eventFd);
+	close(m_epollFd);
+}
+
+int64_t EpollTaskScheduler::now()
+{
+	timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// ---------------------------------
+// delayed tasks in a binary heap
+// ---------------------------------
+TaskToken EpollTaskScheduler::scheduleDelayedTask(int64_t microseconds, TaskFunc *proc, void *clientData)
+{
+	if (microseconds < 0)
+	{
+		microseconds = 0;
+	}
+	DelayedTask task;
+	task.m_time = now() + microseconds;
+	task.m_id = ++m_lastTaskId;
+	task.m_proc = proc;
+	task.m_clientData = clientData;
+	m_delayedTasks.push(task);
+	m_scheduledTasks.insert(task.m_id);
+	return (TaskToken)task.m_id;
+}
+
+void EpollTaskScheduler::unscheduleDelayedTask(TaskToken &prevTask)
+{
+	m_scheduledTasks.erase((uintptr_t)prevTask);
+	prevTask = NULL;
+	if ((m_delayedTasks.size() >= EPOLL_SCHEDULER_MIN_COMPACT_SIZE) && (m_delayedTasks.size() > 2 * m_scheduledTasks.size()))
+	{
+		this->compactDelayedTasks();
+	}
+}
+
+// timeouts rescheduled on each request would stay in the heap until they expire
+void EpollTaskScheduler::compactDelayedTasks()
+{
+	std::vector<DelayedTask> tasks;
+	tasks.reserve(m_scheduledTasks.size());
+	while (!m_delayedTasks.empty())
+	{
+		if (m_scheduledTasks.count(m_delayedTasks.top().m_id) != 0)
+		{
+			tasks.push_back(m_delayedTasks.top());
+		}
+		m_delayedTasks.pop();
+	}
+	m_delayedTasks = std::priority_queue<DelayedTask, std::vector<DelayedTask>, std::greater<DelayedTask>>(std::greater<DelayedTask>(), std::move(tasks));
+}
+
+// run the tasks that expired, not the ones they schedule
+void EpollTaskScheduler::handleDelayedTasks()
+{
+	int64_t time = now();
+	uintptr_t lastTaskId = m_lastTaskId;
+	while (!m_delayedTasks.empty() && (m_delayedTasks.top().m_time <= time) && (m_delayedTasks.top().m_id <= lastTaskId))
+	{
+		DelayedTask task = m_delayedTasks.top();
+		m_delayedTasks.pop();
+		if (m_scheduledTasks.erase(task.m_id) != 0)
+		{
+			(*task.m_proc)(task.m_clientData);
+		}
+	}
+}
+
+// ---------------------------------
+// event triggers
+// ---------------------------------
+EventTriggerId EpollTaskScheduler::createEventTrigger(TaskFunc *eventHandlerProc)
+{
+	EventTriggerId eventTriggerId = 0;
+	for (unsigned int i = 0; i < EPOLL_SCHEDULER_MAX_EVENT_TRIGGERS; i++)
+	{
+		if (m_triggers[i].m_handlerProc == NULL)
+		{
+			m_triggers[i].m_handlerProc = eventHandlerProc;
+			m_triggers[i].m_clientData = NULL;
+			m_triggers[i].m_pending = false;
+			eventTriggerId = (1u << i);
+			break;
+		}
+	}
+	return eventTriggerId;
+}
+
+void EpollTaskScheduler::deleteEventTrigger(EventTriggerId eventTriggerId)
+{
+	for (unsigned int i = 0; i < EPOLL_SCHEDULER_MAX_EVENT_TRIGGERS; i++)
+	{
+		if (eventTriggerId & (1u << i))
+		{
+			m_triggers[i].m_handlerProc = NULL;
+			m_triggers[i].m_clientData = NULL;
+			m_triggers[i].m_pending = false;
+		}
+	}
+}
+
+// could be called from any thread
+void EpollTaskScheduler::triggerEvent(EventTriggerId eventTriggerId, void *clientData)
+{
+	for (unsigned int i = 0; i < EPOLL_SCHEDULER_MAX_EVENT_TRIGGERS; i++)
+	{
+		if (eventTriggerId & (1u << i))
+		{
+			m_triggers[i].m_clientData.store(clientData, std::memory_order_relaxed);
+			m_triggers[i].m_pending.store(true, std::memory_order_release);
+		}
+	}
+	if (!m_triggerPending.exchange(true, std::memory_order_acq_rel))
+	{
+		uint64_t value = 1;
+		if (write(m_eventFd, &value, sizeof(value)) < 0)
+		{
+			LOG(DEBUG) << "eventfd write error:" << strerror(errno);
+		}
+	}
+}
+
+void EpollTaskScheduler::handleTriggers()
+{
+	m_triggerPending.store(false, std::memory_order_release);
+	for (unsigned int i = 0; i < EPOLL_SCHEDULER_MAX_EVENT_TRIGGERS; i++)
+	{
+		Trigger &trigger = m_triggers[i];
+		if (trigger.m_pending.exchange(false, std::memory_order_acq_rel) && (trigger.m_handlerProc != NULL))
+		{
+			(*trigger.m_handlerProc)(trigger.m_clientData.load(std::memory_order_relaxed));
+		}
+	}
+}
+
+// ---------------------------------
+// sockets
+// ---------------------------------
+void EpollTaskScheduler::setBackgroundHandling(int socketNum, int conditionSet, BackgroundHandlerProc *handlerProc, void *clientData)
+{
+	if (socketNum < 0)
+	{
+		return;
+	}
+	if ((size_t)socketNum >= m_handlers.size())
+	{
+		m_handlers.resize(socketNum + 1);
+	}
+	Handler &handler = m_handlers[socketNum];
+	bool registered = (handler.m_conditionSet != 0);
+
+	if ((conditionSet == 0) || (handlerProc == NULL))
+	{
+		if (handler.m_alwaysReady)
+		{
+			m_alwaysReady.erase(socketNum);
+		}
+		else if (registered)
+		{
+			epoll_ctl(m_epollFd, EPOLL_CTL_DEL, socketNum, NULL);
+		}
+		handler = Handler();
+	}
+	else
+	{
+		epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		if (conditionSet & SOCKET_READABLE)
+			ev.events |= EPOLLIN;
+		if (conditionSet & SOCKET_WRITABLE)
+			ev.events |= EPOLLOUT;
+		if (conditionSet & SOCKET_EXCEPTION)
+			ev.events |= EPOLLPRI;
+		ev.data.fd = socketNum;
+		int op = (registered && !handler.m_alwaysReady) ? EPOLL_CTL_MOD : EPOLL_CTL_ADD;
+		int res = epoll_ctl(m_epollFd, op, socketNum, &ev);
+		if ((res != 0) && (op == EPOLL_CTL_MOD) && (errno == ENOENT))
+		{
+			// the socket was closed and its number reused without disabling its handler
+			res = epoll_ctl(m_epollFd, EPOLL_CTL_ADD, socketNum, &ev);
+		}
+		else if ((res != 0) && (op == EPOLL_CTL_ADD) && (errno == EEXIST))
+		{
+			// the kernel still watches the socket while its handler was reset
+			res = epoll_ctl(m_epollFd, EPOLL_CTL_MOD, socketNum, &ev);
+		}
+		if (res != 0)
+		{
+			if (errno == EPERM)
+			{
+				// regular files cannot be polled, select() reports them always ready
+				handler.m_alwaysReady = true;
+				m_alwaysReady.insert(socketNum);
+			}
+			else
+			{
+				LOG(ERROR) << "epoll_ctl socket:" << socketNum << " error:" << strerror(errno);
+			}
+		}
+		handler.m_conditionSet = conditionSet;
+		handler.m_handlerProc = handlerProc;
+		handler.m_clientData = clientData;
+	}
+}
+
+void EpollTaskScheduler::moveSocketHandling(int oldSocketNum, int newSocketNum)
+{
+	if ((oldSocketNum < 0) || (newSocketNum < 0) || ((size_t)oldSocketNum >= m_handlers.size()))
+	{
+		return;
+	}
+	Handler handler = m_handlers[oldSocketNum];
+	this->setBackgroundHandling(oldSocketNum, 0, NULL, NULL);
+	this->setBackgroundHandling(newSocketNum, handler.m_conditionSet, handler.m_handlerProc, handler.m_clientData);
+}
+
+// ---------------------------------
+// one loop iteration, every ready socket is handled
+// ---------------------------------
+void EpollTaskScheduler::SingleStep(unsigned maxDelayTime)
+{
+	// forget the unscheduled tasks that would wake up the loop for nothing
+	while (!m_delayedTasks.empty() && (m_scheduledTasks.count(m_delayedTasks.top().m_id) == 0))
+	{
+		m_delayedTasks.pop();
+	}
+
+	int timeout = -1;
+	if (m_triggerPending || !m_alwaysReady.empty())
+	{
+		timeout = 0;
+	}
+	else if (!m_delayedTasks.empty())
+	{
+		int64_t delay = m_delayedTasks.top().m_time - now();
+		timeout = (delay > 0) ? (int)std::min<int64_t>((delay + 999) / 1000, EPOLL_SCHEDULER_MAX_TIMEOUT_MS) : 0;
+	}
+	if (maxDelayTime > 0)
+	{
+		int maxTimeout = (maxDelayTime + 999) / 1000;
+		if ((timeout < 0) || (timeout > maxTimeout))
+		{
+			timeout = maxTimeout;
+		}
+	}
+
+	epoll_event events[EPOLL_SCHEDULER_MAX_EVENTS];
+	int nbEvents = epoll_wait(m_epollFd, events, EPOLL_SCHEDULER_MAX_EVENTS, timeout);
+	if ((nbEvents < 0) && (errno != EINTR))
+	{
+		LOG(ERROR) << "epoll_wait error:" << strerror(errno);
+		internalError();
+	}
+
+	for (int i = 0; i < nbEvents; i++)
+	{
+		int fd = events[i].data.fd;
+		if (fd == m_eventFd)
+		{
+			uint64_t value = 0;
+			while (read(m_eventFd, &value, sizeof(value)) > 0)
+				;
+			continue;
+		}
+
+		int resultConditionSet = 0;
+		if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR))
+			resultConditionSet |= SOCKET_READABLE;
+		if (events[i].events & (EPOLLOUT | EPOLLERR))
+			resultConditionSet |= SOCKET_WRITABLE;
+		if (events[i].events & EPOLLPRI)
+			resultConditionSet |= SOCKET_EXCEPTION;
+
+		// a previous handler may have changed or removed this one
+		if ((size_t)fd < m_handlers.size())
+		{
+			Handler handler = m_handlers[fd];
+			if ((handler.m_handlerProc != NULL) && ((resultConditionSet & handler.m_conditionSet) != 0))
+			{
+				(*handler.m_handlerProc)(handler.m_clientData, resultConditionSet);
+			}
+		}
+	}
+
+	if (!m_alwaysReady.empty())
+	{
+		std::vector<int> alwaysReady(m_alwaysReady.begin(), m_alwaysReady.end());
+		for (int fd : alwaysReady)
+		{
+			Handler handler = m_handlers[fd];
+			int resultConditionSet = handler.m_conditionSet & (SOCKET_READABLE | SOCKET_WRITABLE);
+			if ((handler.m_handlerProc != NULL) && (resultConditionSet != 0))
+			{
+				(*handler.m_handlerProc)(handler.m_clientData, resultConditionSet);
+			}
+		}
+	}
+
+	this->handleTriggers();
+	this->handleDelayedTasks();
+}
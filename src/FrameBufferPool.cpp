@@ -0,0 +1,206 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameBufferPool.cpp
+**
+** Pool of reusable capture buffers
+**
+** -------------------------------------------------------------------------*/
+
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+// project
+#include "logger.h"
+#include "FrameBufferPool.h"
+
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE 23
+#endif
+
+static const size_t HUGEPAGE_SIZE = 2 * 1024 * 1024;
+
+bool FrameBufferPool::m_hugePages = false;
+bool FrameBufferPool::m_prefault = true;
+
+// ---------------------------------
+// Reference counted buffer
+// ---------------------------------
+void FrameBufferPool::Buffer::release()
+{
+	if (m_refCount.fetch_sub(1, std::memory_order_acq_rel) == 1)
+	{
+		m_pool->recycle(this);
+	}
+}
+
+// ---------------------------------
+// Pool of capture buffers
+// ---------------------------------
+FrameBufferPool::FrameBufferPool(size_t bufferSize, unsigned int nbBuffers)
+	: m_bufferSize(bufferSize), m_nbBuffers(nbBuffers), m_outstanding(0), m_closed(false), m_highWaterMark(0), m_hits(0), m_misses(0)
+{
+	m_freeList.reserve(m_nbBuffers);
+}
+
+FrameBufferPool::~FrameBufferPool()
+{
+	LOG(INFO) << "FrameBufferPool bufferSize:" << m_bufferSize << " hits:" << m_hits << " misses:" << m_misses;
+	for (Buffer *buffer : m_freeList)
+	{
+		this->free(buffer);
+	}
+}
+
+void FrameBufferPool::close()
+{
+	bool release = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_closed = true;
+		release = (m_outstanding == 0);
+	}
+	if (release)
+	{
+		delete this;
+	}
+}
+
+void FrameBufferPool::addBuffers(unsigned int nbBuffers)
+{
+	std::lock_guard<std::mutex> lock(m_mutex);
+	m_nbBuffers += nbBuffers;
+	m_freeList.reserve(m_nbBuffers);
+}
+
+FrameBufferPool::Buffer *FrameBufferPool::acquire()
+{
+	Buffer *buffer = NULL;
+	size_t highWaterMark = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		highWaterMark = m_highWaterMark;
+		if (!m_freeList.empty())
+		{
+			buffer = m_freeList.back();
+			m_freeList.pop_back();
+		}
+		m_outstanding++;
+	}
+
+	if (buffer != NULL)
+	{
+		m_hits++;
+	}
+	else
+	{
+		m_misses++;
+		buffer = this->allocate(highWaterMark);
+		if (buffer == NULL)
+		{
+			std::lock_guard<std::mutex> lock(m_mutex);
+			m_outstanding--;
+			return NULL;
+		}
+	}
+	buffer->m_size = 0;
+	buffer->m_refCount.store(1, std::memory_order_relaxed);
+	return buffer;
+}
+
+FrameBufferPool::Buffer *FrameBufferPool::allocate(size_t prefaultSize)
+{
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size_t capacity = (m_bufferSize > 0) ? m_bufferSize : pageSize;
+	void *data = MAP_FAILED;
+	size_t mappedSize = 0;
+
+	if (m_hugePages)
+	{
+		mappedSize = (capacity + HUGEPAGE_SIZE - 1) & ~(HUGEPAGE_SIZE - 1);
+		data = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+		if (data == MAP_FAILED)
+		{
+			LOG(INFO) << "FrameBufferPool hugetlb allocation failed, fallback to transparent hugepages err:" << strerror(errno);
+		}
+	}
+	if (data == MAP_FAILED)
+	{
+		mappedSize = (capacity + pageSize - 1) & ~(pageSize - 1);
+		data = mmap(NULL, mappedSize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+		if ((data != MAP_FAILED) && m_hugePages)
+		{
+			madvise(data, mappedSize, MADV_HUGEPAGE);
+		}
+	}
+	if (data == MAP_FAILED)
+	{
+		LOG(ERROR) << "FrameBufferPool cannot allocate buffer size:" << mappedSize << " err:" << strerror(errno);
+		return NULL;
+	}
+
+	Buffer *buffer = new Buffer(this, (char *)data, capacity, mappedSize);
+	if (m_prefault)
+	{
+		// only touch the pages that frames really use, the rest of the worst case size stays virtual
+		this->prefault(buffer, prefaultSize);
+	}
+	return buffer;
+}
+
+void FrameBufferPool::prefault(Buffer *buffer, size_t size)
+{
+	size_t pageSize = sysconf(_SC_PAGESIZE);
+	size = std::min((size + pageSize - 1) & ~(pageSize - 1), buffer->m_mappedSize);
+	if (size > 0)
+	{
+		if (madvise(buffer->m_data, size, MADV_POPULATE_WRITE) != 0)
+		{
+			// kernel older than 5.14
+			for (size_t offset = 0; offset < size; offset += pageSize)
+			{
+				buffer->m_data[offset] = 0;
+			}
+		}
+	}
+}
+
+void FrameBufferPool::free(Buffer *buffer)
+{
+	munmap(buffer->m_data, buffer->m_mappedSize);
+	delete buffer;
+}
+
+void FrameBufferPool::recycle(Buffer *buffer)
+{
+	bool release = false;
+	bool keep = false;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		m_outstanding--;
+		if (buffer->m_size > m_highWaterMark)
+		{
+			m_highWaterMark = buffer->m_size;
+		}
+		if (!m_closed && (m_freeList.size() < m_nbBuffers))
+		{
+			m_freeList.push_back(buffer);
+			keep = true;
+		}
+		release = m_closed && (m_outstanding == 0);
+	}
+	if (!keep)
+	{
+		this->free(buffer);
+	}
+	if (release)
+	{
+		delete this;
+	}
+}
@@ -0,0 +1,337 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** FrameReplicator.cpp
+**
+** Fan-out of the frames of a V4L2DeviceSource to several consumers
+**
+** -------------------------------------------------------------------------*/
+
+#include <algorithm>
+
+#include "logger.h"
+#include "FrameReplicator.h"
+
+// ---------------------------------
+// FrameReplicator
+// ---------------------------------
+FrameReplicator::FrameReplicator(UsageEnvironment &env, V4L2DeviceSource *source, FrameReplicator *parent)
+	: Medium(env), m_source(source), m_startOfAccessUnit(true), m_gopCacheEnabled(source->hasInterFrames() && (parent == NULL)), m_parent(parent), m_pendingOverflow(false), m_pendingTrigger(0)
+{
+	if (m_parent)
+	{
+		m_pendingTrigger = envir().taskScheduler().createEventTrigger(FrameReplicator::pendingFramesStub);
+	}
+	else
+	{
+		m_source->setFrameHandler(FrameReplicator::incomingFrameStub, this);
+		if (m_gopCacheEnabled)
+		{
+			// buffers held by the cache come back to the pool instead of being mapped again
+			m_source->getBufferPool()->addBuffers(GOP_CACHE_MAX_BUFFERS);
+		}
+	}
+}
+
+FrameReplicator::~FrameReplicator()
+{
+	for (FrameReplica *replica : m_replicas)
+	{
+		replica->m_replicator = NULL;
+		m_source->removeConsumer();
+	}
+	if (m_parent)
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_parent->m_mirrorsMutex);
+			m_parent->m_mirrors.erase(std::remove(m_parent->m_mirrors.begin(), m_parent->m_mirrors.end(), this), m_parent->m_mirrors.end());
+		}
+		envir().taskScheduler().deleteEventTrigger(m_pendingTrigger);
+	}
+	else
+	{
+		m_source->setFrameHandler(NULL, NULL);
+		Medium::close(m_source);
+	}
+}
+
+FrameReplicator *FrameReplicator::createMirror(UsageEnvironment &env)
+{
+	FrameReplicator *mirror = new FrameReplicator(env, m_source, this);
+	std::lock_guard<std::mutex> lock(m_mirrorsMutex);
+	m_mirrors.push_back(mirror);
+	return mirror;
+}
+
+FramedSource *FrameReplicator::createStreamReplica(bool rebaseGop)
+{
+	FrameReplica *replica = new FrameReplica(envir(), this, m_source->getQueueSize());
+	m_replicas.push_back(replica);
+	m_source->addConsumer();
+
+	// the new consumer starts at the last keyframe instead of waiting the next one
+	std::vector<V4L2DeviceSource::FrameRef> frames;
+	size_t skipFrames = 0;
+	this->getGopFrames(frames, skipFrames, rebaseGop);
+	replica->prime(frames, skipFrames);
+	if (frames.empty())
+	{
+		m_source->requestKeyFrame("new replica");
+	}
+	LOG(NOTICE) << "replica added count:" << m_replicas.size() << " primed frames:" << frames.size();
+	return replica;
+}
+
+void FrameReplicator::getGopFrames(std::vector<V4L2DeviceSource::FrameRef> &frames, size_t &skipFrames, bool rebase)
+{
+	FrameReplicator *root = m_parent ? m_parent : this;
+	std::lock_guard<std::mutex> lock(root->m_mirrorsMutex);
+	if (root->m_gopCacheEnabled)
+	{
+		frames = root->m_gopCache.getFrames(rebase);
+	}
+	if (m_parent)
+	{
+		// the frames posted to this mirror and not yet dispatched are in the cache
+		std::lock_guard<std::mutex> pendingLock(m_pendingMutex);
+		skipFrames = m_pending.size();
+	}
+}
+
+void FrameReplicator::removeReplica(FrameReplica *replica)
+{
+	m_replicas.erase(std::remove(m_replicas.begin(), m_replicas.end(), replica), m_replicas.end());
+	m_source->removeConsumer();
+	LOG(NOTICE) << "replica removed count:" << m_replicas.size();
+}
+
+// each replica keeps a reference on the frame until its consumer read it
+void FrameReplicator::incomingFrame(const V4L2DeviceSource::FrameRef &frame)
+{
+	bool startOfAccessUnit = m_startOfAccessUnit;
+	m_startOfAccessUnit = frame->m_endOfAccessUnit;
+
+	{
+		std::lock_guard<std::mutex> lock(m_mirrorsMutex);
+		if (m_gopCacheEnabled)
+		{
+			m_gopCache.addFrame(frame, startOfAccessUnit);
+		}
+		for (FrameReplicator *mirror : m_mirrors)
+		{
+			mirror->postFrame(frame, startOfAccessUnit);
+		}
+	}
+
+	this->dispatchFrame(frame, startOfAccessUnit);
+}
+
+void FrameReplicator::dispatchFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit)
+{
+	for (FrameReplica *replica : m_replicas)
+	{
+		replica->pushFrame(frame, startOfAccessUnit);
+	}
+
+	// a consumer may close its replica while it gets the frame
+	std::vector<FrameReplica *> replicas(m_replicas);
+	for (FrameReplica *replica : replicas)
+	{
+		if (std::find(m_replicas.begin(), m_replicas.end(), replica) != m_replicas.end())
+		{
+			replica->deliverFrame();
+		}
+	}
+}
+
+// ---------------------------------
+// mirror of a replicator in another event loop
+// ---------------------------------
+void FrameReplicator::postFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		// the loop of the mirror is late, its replicas restart at the next keyframe
+		size_t maxPending = 4 * std::max(m_source->getQueueSize(), 1u);
+		if (m_pending.size() >= maxPending)
+		{
+			m_pending.clear();
+			m_pendingOverflow = true;
+		}
+		m_pending.push_back(std::make_pair(frame, startOfAccessUnit));
+	}
+	envir().taskScheduler().triggerEvent(m_pendingTrigger, this);
+}
+
+void FrameReplicator::pendingFrames()
+{
+	std::deque<std::pair<V4L2DeviceSource::FrameRef, bool>> pending;
+	bool overflow = false;
+	{
+		std::lock_guard<std::mutex> lock(m_pendingMutex);
+		pending.swap(m_pending);
+		overflow = m_pendingOverflow;
+		m_pendingOverflow = false;
+	}
+	if (overflow)
+	{
+		LOG(NOTICE) << "mirror too slow, replicas wait for the next keyframe";
+		m_source->requestKeyFrame("slow mirror");
+		for (FrameReplica *replica : m_replicas)
+		{
+			replica->resync();
+		}
+	}
+	for (const std::pair<V4L2DeviceSource::FrameRef, bool> &frame : pending)
+	{
+		this->dispatchFrame(frame.first, frame.second);
+	}
+}
+
+// ---------------------------------
+// FrameReplica
+// ---------------------------------
+FrameReplica::FrameReplica(UsageEnvironment &env, FrameReplicator *replicator, unsigned int maxAccessUnits)
+	: FramedSource(env), m_replicator(replicator), m_queuedAccessUnits(0), m_maxAccessUnits(std::max(maxAccessUnits, 1u)), m_interFrames(replicator->m_source->hasInterFrames()), m_waitKeyFrame(m_interFrames), m_dropped(0), m_primedAccessUnits(0), m_skipFrames(0), m_deliverTask(NULL)
+{
+}
+
+FrameReplica::~FrameReplica()
+{
+	envir().taskScheduler().unscheduleDelayedTask(m_deliverTask);
+	if (m_replicator)
+	{
+		m_replicator->removeReplica(this);
+	}
+	if (m_dropped != 0)
+	{
+		LOG(NOTICE) << "replica dropped frames:" << m_dropped;
+	}
+}
+
+// a new or late consumer starts at the beginning of a keyframe
+void FrameReplica::pushFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit)
+{
+	if (m_skipFrames > 0)
+	{
+		m_skipFrames--;
+		return;
+	}
+	if (m_waitKeyFrame)
+	{
+		if (!frame->m_keyFrame || !startOfAccessUnit)
+		{
+			return;
+		}
+		m_waitKeyFrame = false;
+	}
+
+	// the primed GOP is read in a burst, it does not count in the budget
+	if (startOfAccessUnit && (m_queuedAccessUnits >= m_maxAccessUnits + m_primedAccessUnits))
+	{
+		LOG(DEBUG) << "replica too slow drop access units:" << m_queuedAccessUnits;
+		m_dropped += m_queue.size();
+		m_queue.clear();
+		m_queuedAccessUnits = 0;
+		m_primedAccessUnits = 0;
+		if (m_interFrames && !frame->m_keyFrame)
+		{
+			m_waitKeyFrame = true;
+			m_replicator->m_source->requestKeyFrame("slow replica");
+			return;
+		}
+	}
+
+	m_queue.push_back(frame);
+	if (frame->m_endOfAccessUnit)
+	{
+		m_queuedAccessUnits++;
+	}
+}
+
+void FrameReplica::resync()
+{
+	m_dropped += m_queue.size();
+	m_queue.clear();
+	m_queuedAccessUnits = 0;
+	m_primedAccessUnits = 0;
+	m_skipFrames = 0;
+	m_waitKeyFrame = m_interFrames;
+}
+
+void FrameReplica::prime(const std::vector<V4L2DeviceSource::FrameRef> &frames, size_t skipFrames)
+{
+	if (frames.empty())
+	{
+		return;
+	}
+	for (const V4L2DeviceSource::FrameRef &frame : frames)
+	{
+		m_queue.push_back(frame);
+		if (frame->m_endOfAccessUnit)
+		{
+			m_queuedAccessUnits++;
+			m_primedAccessUnits++;
+		}
+	}
+	m_waitKeyFrame = false;
+	m_skipFrames = skipFrames;
+}
+
+// a consumer reading in its afterGetting callback would recurse over the whole primed GOP
+void FrameReplica::doGetNextFrame()
+{
+	if (!m_queue.empty() && (m_deliverTask == NULL))
+	{
+		m_deliverTask = envir().taskScheduler().scheduleDelayedTask(0, FrameReplica::deliverFrameStub, this);
+	}
+}
+
+void FrameReplica::doStopGettingFrames()
+{
+	envir().taskScheduler().unscheduleDelayedTask(m_deliverTask);
+	FramedSource::doStopGettingFrames();
+}
+
+void FrameReplica::deliverTask()
+{
+	m_deliverTask = NULL;
+	this->deliverFrame();
+}
+
+// the only copy, into the buffer of the consumer
+void FrameReplica::deliverFrame()
+{
+	if (isCurrentlyAwaitingData() && !m_queue.empty())
+	{
+		V4L2DeviceSource::FrameRef frame = m_queue.front();
+		m_queue.pop_front();
+		if (frame->m_endOfAccessUnit && (m_queuedAccessUnits > 0))
+		{
+			m_queuedAccessUnits--;
+		}
+		if (frame->m_endOfAccessUnit && (m_primedAccessUnits > 0))
+		{
+			m_primedAccessUnits--;
+		}
+
+		if (frame->m_size > fMaxSize)
+		{
+			fFrameSize = fMaxSize;
+			fNumTruncatedBytes = frame->m_size - fMaxSize;
+		}
+		else
+		{
+			fFrameSize = frame->m_size;
+			fNumTruncatedBytes = 0;
+		}
+		fDurationInMicroseconds = 0;
+		fPresentationTime = frame->m_timestamp;
+		memcpy(fTo, frame->m_buffer, fFrameSize);
+
+		// send Frame to the consumer
+		FramedSource::afterGetting(this);
+	}
+}
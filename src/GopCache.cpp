@@ -0,0 +1,113 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** GopCache.cpp
+**
+** Frames since the last keyframe, to start a new consumer on a decodable picture
+**
+** -------------------------------------------------------------------------*/
+
+#include <sys/time.h>
+
+#include "logger.h"
+#include "GopCache.h"
+
+// a keyframe starts a new GOP, the previous frames are released
+void GopCache::addFrame(const V4L2DeviceSource::FrameRef &frame, bool startOfAccessUnit)
+{
+	if (startOfAccessUnit && frame->m_keyFrame)
+	{
+		if (m_overflow)
+		{
+			LOG(DEBUG) << "gop cache restart at keyframe";
+		}
+		this->clear();
+	}
+	else if (m_frames.empty() || m_overflow)
+	{
+		return;
+	}
+
+	bool newBuffer = (frame->m_allocatedBuffer != NULL) && (frame->m_allocatedBuffer != m_lastBuffer);
+	if (startOfAccessUnit && ((m_accessUnits >= m_maxAccessUnits) || (m_bytes + frame->m_size > m_maxBytes) || (newBuffer && (m_buffers >= m_maxBuffers))))
+	{
+		LOG(DEBUG) << "gop cache overflow accessUnits:" << m_accessUnits << " bytes:" << m_bytes << " buffers:" << m_buffers;
+		this->clear();
+		m_overflow = true;
+		return;
+	}
+
+	m_frames.push_back(frame);
+	m_bytes += frame->m_size;
+	if (newBuffer)
+	{
+		m_buffers++;
+		m_lastBuffer = frame->m_allocatedBuffer;
+	}
+	if (frame->m_endOfAccessUnit)
+	{
+		m_accessUnits++;
+	}
+}
+
+void GopCache::clear()
+{
+	m_frames.clear();
+	m_accessUnits = 0;
+	m_bytes = 0;
+	m_buffers = 0;
+	m_lastBuffer = NULL;
+	m_overflow = false;
+}
+
+std::vector<V4L2DeviceSource::FrameRef> GopCache::getFrames(bool rebase) const
+{
+	std::vector<V4L2DeviceSource::FrameRef> frames;
+	if (m_frames.empty())
+	{
+		return frames;
+	}
+	timeval now;
+	gettimeofday(&now, NULL);
+	timeval age;
+	timersub(&now, &m_frames.back()->m_timestamp, &age);
+	if ((age.tv_sec * 1000 + age.tv_usec / 1000) > GOP_CACHE_MAX_AGE_MS)
+	{
+		LOG(DEBUG) << "gop cache too old age:" << (age.tv_sec * 1000 + age.tv_usec / 1000) << "ms";
+		return frames;
+	}
+
+	if (!rebase)
+	{
+		// segmenters need the real durations of the cached access units
+		frames = m_frames;
+		return frames;
+	}
+
+	// the access unit in progress is included, its next frames follow live
+	unsigned int accessUnits = m_accessUnits + (m_frames.back()->m_endOfAccessUnit ? 0 : 1);
+
+	// the data stays in the capture buffers, only the timestamps are rebased
+	timeval last = m_frames.back()->m_timestamp;
+	unsigned int accessUnit = 0;
+	frames.reserve(m_frames.size());
+	for (const V4L2DeviceSource::FrameRef &frame : m_frames)
+	{
+		long offset = (long)(accessUnits - 1 - accessUnit) * GOP_CACHE_REBASE_INTERVAL_US;
+		timeval delta = {offset / 1000000, offset % 1000000};
+		timeval timestamp;
+		timersub(&last, &delta, &timestamp);
+
+		std::shared_ptr<V4L2DeviceSource::Frame> rebased = std::make_shared<V4L2DeviceSource::Frame>(frame->m_buffer, frame->m_size, timestamp, frame->m_allocatedBuffer, frame->m_owner);
+		rebased->m_keyFrame = frame->m_keyFrame;
+		rebased->m_endOfAccessUnit = frame->m_endOfAccessUnit;
+		frames.push_back(rebased);
+		if (frame->m_endOfAccessUnit)
+		{
+			accessUnit++;
+		}
+	}
+	return frames;
+}
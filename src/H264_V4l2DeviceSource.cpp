@@ -27,65 +27,60 @@ std::list<std::pair<unsigned char *, size_t>> H264_V4L2DeviceSource::splitFrames
 {
 	std::list<std::pair<unsigned char *, size_t>> frameList;
 
-	size_t bufSize = frameSize;
-	size_t size = 0;
-	int frameType = 0;
-	unsigned char *buffer = this->extractFrame(frame, bufSize, size, frameType);
-	while (buffer != NULL)
+	const std::vector<StartCodeScanner::NalUnit> &nalList = this->extractFrames(frame, frameSize);
+	for (const StartCodeScanner::NalUnit &nal : nalList)
 	{
+		unsigned char *buffer = m_keepMarker ? nal.m_marker : nal.m_data;
+		size_t size = m_keepMarker ? nal.m_size + nal.m_markerLength : nal.m_size;
+		int frameType = nal.m_type;
 		switch (frameType & 0x1F)
 		{
 		case 7:
-			LOG(INFO) << "SPS size:" << size << " bufSize:" << bufSize;
-			m_sps.assign((char *)buffer, size);
-			m_pps.clear();
+			LOG(INFO) << "SPS size:" << size << " bufSize:" << frameSize;
+			if (this->updateParameterSet(m_sps, buffer, size))
+			{
+				this->clearParameterSet(m_pps);
+			}
 			break;
 		case 8:
-			LOG(INFO) << "PPS size:" << size << " bufSize:" << bufSize;
-			m_pps.assign((char *)buffer, size);
+			LOG(INFO) << "PPS size:" << size << " bufSize:" << frameSize;
+			this->updateParameterSet(m_pps, buffer, size);
 			break;
 		case 5:
-			LOG(INFO) << "IDR size:" << size << " bufSize:" << bufSize;
-			if (m_repeatConfig && !m_sps.empty() && !m_pps.empty())
+			LOG(INFO) << "IDR size:" << size << " bufSize:" << frameSize;
+			if (m_repeatConfig && m_sps && m_pps)
 			{
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_sps.c_str(), m_sps.size()));
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_pps.c_str(), m_pps.size()));
-			}
-			if (!m_sps.empty() && !m_pps.empty())
-			{
-				std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-				m_lastFrame.assign(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_sps.c_str(), m_sps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_pps.c_str(), m_pps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append((char *)buffer, size);
+				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_sps->c_str(), m_sps->size()));
+				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_pps->c_str(), m_pps->size()));
 			}
 			break;
 		default:
 			break;
 		}
 
-		if (!m_sps.empty() && !m_pps.empty())
-		{
-			u_int32_t profile_level_id = 0;
-			if (m_sps.size() >= 4)
-				profile_level_id = (((unsigned char)m_sps[1]) << 16) | (((unsigned char)m_sps[2]) << 8) | ((unsigned char)m_sps[3]);
+		frameList.push_back(std::pair<unsigned char *, size_t>(buffer, size));
+	}
 
-			char *sps_base64 = base64Encode(m_sps.c_str(), m_sps.size());
-			char *pps_base64 = base64Encode(m_pps.c_str(), m_pps.size());
+	// regenerate the SDP parameters only when SPS/PPS changed
+	if (m_parameterSetsChanged && m_sps && m_pps)
+	{
+		const std::string &sps = *m_sps;
+		u_int32_t profile_level_id = 0;
+		if (sps.size() >= 4)
+			profile_level_id = (((unsigned char)sps[1]) << 16) | (((unsigned char)sps[2]) << 8) | ((unsigned char)sps[3]);
 
-			std::ostringstream os;
-			os << "profile-level-id=" << std::hex << std::setw(6) << std::setfill('0') << profile_level_id;
-			os << ";sprop-parameter-sets=" << sps_base64 << "," << pps_base64;
-			m_auxLine.assign(os.str());
+		char *sps_base64 = base64Encode(sps.c_str(), sps.size());
+		char *pps_base64 = base64Encode(m_pps->c_str(), m_pps->size());
 
-			delete[] sps_base64;
-			delete[] pps_base64;
-		}
-		frameList.push_back(std::pair<unsigned char *, size_t>(buffer, size));
+		std::ostringstream os;
+		os << "profile-level-id=" << std::hex << std::setw(6) << std::setfill('0') << profile_level_id;
+		os << ";sprop-parameter-sets=" << sps_base64 << "," << pps_base64;
+		this->setAuxLine(os.str());
+		this->updateSnapshotHeader();
+		m_parameterSetsChanged = false;
 
-		buffer = this->extractFrame(&buffer[size], bufSize, size, frameType);
+		delete[] sps_base64;
+		delete[] pps_base64;
 	}
 	return frameList;
 }
@@ -93,6 +88,7 @@ std::list<std::pair<unsigned char *, size_t>> H264_V4L2DeviceSource::splitFrames
 std::list<std::string> H264_V4L2DeviceSource::getInitFrames()
 {
 	std::list<std::string> frameList;
+	std::lock_guard<std::mutex> lock(m_parameterSetsMutex);
 	frameList.push_back(this->getFrameWithMarker(m_sps));
 	frameList.push_back(this->getFrameWithMarker(m_pps));
 	return frameList;
@@ -101,9 +97,10 @@ std::list<std::string> H264_V4L2DeviceSource::getInitFrames()
 bool H264_V4L2DeviceSource::isKeyFrame(const char *buffer, int size)
 {
 	bool res = false;
-	if (size > 4)
+	const unsigned char *header = getNalHeader(buffer, size);
+	if (header != NULL)
 	{
-		int frameType = buffer[4] & 0x1F;
+		int frameType = header[0] & 0x1F;
 		res = (frameType == 5);
 	}
 	return res;
@@ -23,73 +23,65 @@ std::list<std::pair<unsigned char *, size_t>> H265_V4L2DeviceSource::splitFrames
 {
 	std::list<std::pair<unsigned char *, size_t>> frameList;
 
-	size_t bufSize = frameSize;
-	size_t size = 0;
-	int frameType = 0;
-	unsigned char *buffer = this->extractFrame(frame, bufSize, size, frameType);
-	while (buffer != NULL)
+	const std::vector<StartCodeScanner::NalUnit> &nalList = this->extractFrames(frame, frameSize);
+	for (const StartCodeScanner::NalUnit &nal : nalList)
 	{
+		unsigned char *buffer = m_keepMarker ? nal.m_marker : nal.m_data;
+		size_t size = m_keepMarker ? nal.m_size + nal.m_markerLength : nal.m_size;
+		int frameType = nal.m_type;
 		switch ((frameType & 0x7E) >> 1)
 		{
 		case 32:
-			LOG(INFO) << "VPS size:" << size << " bufSize:" << bufSize;
-			m_vps.assign((char *)buffer, size);
-			m_sps.clear();
-			m_pps.clear();
+			LOG(INFO) << "VPS size:" << size << " bufSize:" << frameSize;
+			if (this->updateParameterSet(m_vps, buffer, size))
+			{
+				this->clearParameterSet(m_sps);
+				this->clearParameterSet(m_pps);
+			}
 			break;
 		case 33:
-			LOG(INFO) << "SPS size:" << size << " bufSize:" << bufSize;
-			m_sps.assign((char *)buffer, size);
+			LOG(INFO) << "SPS size:" << size << " bufSize:" << frameSize;
+			this->updateParameterSet(m_sps, buffer, size);
 			break;
 		case 34:
-			LOG(INFO) << "PPS size:" << size << " bufSize:" << bufSize;
-			m_pps.assign((char *)buffer, size);
+			LOG(INFO) << "PPS size:" << size << " bufSize:" << frameSize;
+			this->updateParameterSet(m_pps, buffer, size);
 			break;
 		case 19:
 		case 20:
-			LOG(INFO) << "IDR size:" << size << " bufSize:" << bufSize;
-			if (m_repeatConfig && !m_vps.empty() && !m_sps.empty() && !m_pps.empty())
+			LOG(INFO) << "IDR size:" << size << " bufSize:" << frameSize;
+			if (m_repeatConfig && m_vps && m_sps && m_pps)
 			{
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_vps.c_str(), m_vps.size()));
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_sps.c_str(), m_sps.size()));
-				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_pps.c_str(), m_pps.size()));
-			}
-			if (!m_vps.empty() && !m_sps.empty() && !m_pps.empty())
-			{
-				std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-				m_lastFrame.assign(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_vps.c_str(), m_vps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_sps.c_str(), m_sps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append(m_pps.c_str(), m_pps.size());
-				m_lastFrame.append(H264marker, sizeof(H264marker));
-				m_lastFrame.append((char *)buffer, size);
+				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_vps->c_str(), m_vps->size()));
+				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_sps->c_str(), m_sps->size()));
+				frameList.push_back(std::pair<unsigned char *, size_t>((unsigned char *)m_pps->c_str(), m_pps->size()));
 			}
 			break;
 		default:
 			break;
 		}
 
-		if (!m_vps.empty() && !m_sps.empty() && !m_pps.empty())
-		{
-			char *vps_base64 = base64Encode(m_vps.c_str(), m_vps.size());
-			char *sps_base64 = base64Encode(m_sps.c_str(), m_sps.size());
-			char *pps_base64 = base64Encode(m_pps.c_str(), m_pps.size());
+		frameList.push_back(std::pair<unsigned char *, size_t>(buffer, size));
+	}
 
-			std::ostringstream os;
-			os << "sprop-vps=" << vps_base64;
-			os << ";sprop-sps=" << sps_base64;
-			os << ";sprop-pps=" << pps_base64;
-			m_auxLine.assign(os.str());
+	// regenerate the SDP parameters only when VPS/SPS/PPS changed
+	if (m_parameterSetsChanged && m_vps && m_sps && m_pps)
+	{
+		char *vps_base64 = base64Encode(m_vps->c_str(), m_vps->size());
+		char *sps_base64 = base64Encode(m_sps->c_str(), m_sps->size());
+		char *pps_base64 = base64Encode(m_pps->c_str(), m_pps->size());
 
-			delete[] vps_base64;
-			delete[] sps_base64;
-			delete[] pps_base64;
-		}
-		frameList.push_back(std::pair<unsigned char *, size_t>(buffer, size));
+		std::ostringstream os;
+		os << "sprop-vps=" << vps_base64;
+		os << ";sprop-sps=" << sps_base64;
+		os << ";sprop-pps=" << pps_base64;
+		this->setAuxLine(os.str());
+		this->updateSnapshotHeader();
+		m_parameterSetsChanged = false;
 
-		buffer = this->extractFrame(&buffer[size], bufSize, size, frameType);
+		delete[] vps_base64;
+		delete[] sps_base64;
+		delete[] pps_base64;
 	}
 	return frameList;
 }
@@ -97,6 +89,7 @@ std::list<std::pair<unsigned char *, size_t>> H265_V4L2DeviceSource::splitFrames
 std::list<std::string> H265_V4L2DeviceSource::getInitFrames()
 {
 	std::list<std::string> frameList;
+	std::lock_guard<std::mutex> lock(m_parameterSetsMutex);
 	frameList.push_back(this->getFrameWithMarker(m_vps));
 	frameList.push_back(this->getFrameWithMarker(m_sps));
 	frameList.push_back(this->getFrameWithMarker(m_pps));
@@ -106,9 +99,10 @@ std::list<std::string> H265_V4L2DeviceSource::getInitFrames()
 bool H265_V4L2DeviceSource::isKeyFrame(const char *buffer, int size)
 {
 	bool res = false;
-	if (size > 4)
+	const unsigned char *header = getNalHeader(buffer, size);
+	if (header != NULL)
 	{
-		int frameType = (buffer[4] & 0x7E) >> 1;
+		int frameType = (header[0] & 0x7E) >> 1;
 		res = (frameType == 19 || frameType == 20);
 	}
 	return res;
@@ -18,71 +18,108 @@
 #include "logger.h"
 #include "H26x_V4l2DeviceSource.h"
 
-// extract a frame
-unsigned char *H26X_V4L2DeviceSource::extractFrame(unsigned char *frame, size_t &size, size_t &outsize, int &frameType)
+// extract all the frames of a buffer
+const std::vector<StartCodeScanner::NalUnit> &H26X_V4L2DeviceSource::extractFrames(unsigned char *frame, size_t size)
 {
-	unsigned char *outFrame = NULL;
-	outsize = 0;
-	unsigned int markerlength = 0;
-	frameType = 0;
+	const std::vector<StartCodeScanner::NalUnit> &nalList = m_scanner.scan(frame, size);
+	if (nalList.empty() && (size >= sizeof(H264shortmarker)))
+	{
+		LOG(INFO) << "No marker found";
+	}
+	return nalList;
+}
 
-	unsigned char *startFrame = (unsigned char *)memmem(frame, size, H264marker, sizeof(H264marker));
-	if (startFrame != NULL)
+std::string H26X_V4L2DeviceSource::getFrameWithMarker(const ParameterSet &frame)
+{
+	std::string frameWithMarker;
+	frameWithMarker.append(H264marker, sizeof(H264marker));
+	if (frame)
 	{
-		markerlength = sizeof(H264marker);
+		frameWithMarker.append(*frame);
 	}
-	else
+	return frameWithMarker;
+}
+
+// NAL header of a frame with or without start code
+const unsigned char *H26X_V4L2DeviceSource::getNalHeader(const char *buffer, int size)
+{
+	const unsigned char *header = NULL;
+	if ((size > (int)sizeof(H264marker)) && (memcmp(buffer, H264marker, sizeof(H264marker)) == 0))
 	{
-		startFrame = (unsigned char *)memmem(frame, size, H264shortmarker, sizeof(H264shortmarker));
-		if (startFrame != NULL)
-		{
-			markerlength = sizeof(H264shortmarker);
-		}
+		header = (const unsigned char *)&buffer[sizeof(H264marker)];
+	}
+	else if ((size > (int)sizeof(H264shortmarker)) && (memcmp(buffer, H264shortmarker, sizeof(H264shortmarker)) == 0))
+	{
+		header = (const unsigned char *)&buffer[sizeof(H264shortmarker)];
 	}
-	if (startFrame != NULL)
+	else if (size > 0)
 	{
-		frameType = startFrame[markerlength];
+		header = (const unsigned char *)buffer;
+	}
+	return header;
+}
 
-		int remainingSize = size - (startFrame - frame + markerlength);
-		unsigned char *endFrame = (unsigned char *)memmem(&startFrame[markerlength], remainingSize, H264marker, sizeof(H264marker));
-		if (endFrame == NULL)
-		{
-			endFrame = (unsigned char *)memmem(&startFrame[markerlength], remainingSize, H264shortmarker, sizeof(H264shortmarker));
-		}
+// store a parameter set, return true when its content changed
+bool H26X_V4L2DeviceSource::updateParameterSet(ParameterSet &parameterSet, const unsigned char *buffer, size_t size)
+{
+	bool changed = !parameterSet || (parameterSet->size() != size) || (memcmp(parameterSet->c_str(), buffer, size) != 0);
+	if (changed)
+	{
+		ParameterSet newParameterSet = std::make_shared<const std::string>((const char *)buffer, size);
+		std::lock_guard<std::mutex> lock(m_parameterSetsMutex);
+		parameterSet = newParameterSet;
+		m_parameterSetsChanged = true;
+	}
+	return changed;
+}
 
-		if (m_keepMarker)
-		{
-			size -= startFrame - frame;
-			outFrame = startFrame;
-		}
-		else
-		{
-			size -= startFrame - frame + markerlength;
-			outFrame = &startFrame[markerlength];
-		}
+void H26X_V4L2DeviceSource::clearParameterSet(ParameterSet &parameterSet)
+{
+	std::lock_guard<std::mutex> lock(m_parameterSetsMutex);
+	parameterSet.reset();
+}
 
-		if (endFrame != NULL)
-		{
-			outsize = endFrame - outFrame;
-		}
-		else
+// repeated parameter sets are not in the capture buffer, the queued frame holds a reference on them
+std::shared_ptr<const std::string> H26X_V4L2DeviceSource::getFrameOwner(const unsigned char *frame)
+{
+	const ParameterSet *parameterSets[] = {&m_vps, &m_sps, &m_pps};
+	for (const ParameterSet *parameterSet : parameterSets)
+	{
+		if (*parameterSet && ((const unsigned char *)(*parameterSet)->c_str() == frame))
 		{
-			outsize = size;
+			return *parameterSet;
 		}
-		size -= outsize;
 	}
-	else if (size >= sizeof(H264shortmarker))
+	return ParameterSet();
+}
+
+// prefix of the snapshots, rebuilt when the parameter sets change
+void H26X_V4L2DeviceSource::updateSnapshotHeader()
+{
+	std::string header;
+	std::list<std::string> initFrames = this->getInitFrames();
+	for (const std::string &frame : initFrames)
 	{
-		LOG(INFO) << "No marker found";
+		header.append(frame);
 	}
-
-	return outFrame;
+	m_snapshotHeader = std::make_shared<const std::string>(header);
 }
 
-std::string H26X_V4L2DeviceSource::getFrameWithMarker(const std::string &frame)
+// the snapshot starts at the first keyframe NAL of the capture buffer, the slices that follow belong to the same picture
+void H26X_V4L2DeviceSource::updateLastFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref)
 {
-	std::string frameWithMarker;
-	frameWithMarker.append(H264marker, sizeof(H264marker));
-	frameWithMarker.append(frame);
-	return frameWithMarker;
+	if (m_snapshotHeader)
+	{
+		const std::vector<StartCodeScanner::NalUnit> &nalList = m_scanner.getNalList();
+		for (const StartCodeScanner::NalUnit &nal : nalList)
+		{
+			if (this->isKeyFrame((const char *)nal.m_data, nal.m_size))
+			{
+				const char *data = (const char *)nal.m_marker;
+				size_t size = buffer->data() + frameSize - data;
+				m_lastFrame.store(std::make_shared<const FrameSnapshot>(buffer, data, size, ref, m_snapshotHeader));
+				break;
+			}
+		}
+	}
 }
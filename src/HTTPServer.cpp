@@ -12,19 +12,136 @@
 ** -------------------------------------------------------------------------*/
 
 #include <sstream>
-#include <fstream>
 #include <algorithm>
+#include <functional>
 
+#include <errno.h>
+#include <math.h>
+#include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
 #include "ByteStreamMemoryBufferSource.hh"
 #include "HTTPServer.h"
 
 #include "BaseServerMediaSubsession.h"
+#include "TSServerMediaSubsession.h"
+#include "CMAFSink.h"
+
+#define HTTP_SERVER_PEEK_SIZE 4096
+// seconds an accepted connection waits for its first request
+#define HTTP_SERVER_PENDING_TIMEOUT 5
+// milliseconds before peeking again at a request without the end of its headers
+#define HTTP_SERVER_PEEK_RETRY 10
 
 u_int32_t HTTPServer::HTTPClientConnection::m_ClientSessionId = 0;
+std::atomic<unsigned int> HTTPServer::m_keepAliveConnections(0);
+std::atomic<unsigned int> HTTPServer::m_httpRequests(0);
+std::atomic<unsigned int> HTTPServer::m_httpConnections(0);
 
-void HTTPServer::HTTPClientConnection::sendHeader(const char *contentType, unsigned int contentLength)
+// ---------------------------------
+// segment sent with sendmsg from the chunks it references
+// ---------------------------------
+SegmentWriter::SegmentWriter(UsageEnvironment &env, int socketNum, const std::string &header, const std::shared_ptr<const MemorySegment> &segment, const std::string &trailer, TaskFunc *afterFunc, void *afterClientData)
+	: m_env(env), m_socketNum(socketNum), m_header(header), m_segment(segment), m_trailer(trailer), m_offset(0), m_afterFunc(afterFunc), m_afterClientData(afterClientData)
+{
+	ignoreSigPipeOnSocket(socketNum);
+}
+
+SegmentWriter::~SegmentWriter()
+{
+	m_env.taskScheduler().disableBackgroundHandling(m_socketNum);
+}
+
+void SegmentWriter::write()
+{
+	size_t segmentSize = m_segment ? m_segment->size() : 0;
+	size_t total = m_header.size() + segmentSize + m_trailer.size();
+	bool done = false;
+	while (!done && (m_offset < total))
+	{
+		// iovecs from the current offset, the header, the spans of the segment then the trailer
+		iovec iov[SEGMENT_WRITER_MAX_IOV];
+		int iovcnt = 0;
+		size_t position = 0;
+		if (m_offset < m_header.size())
+		{
+			iov[iovcnt].iov_base = (void *)(m_header.c_str() + m_offset);
+			iov[iovcnt].iov_len = m_header.size() - m_offset;
+			iovcnt++;
+		}
+		position = m_header.size();
+		if (m_segment)
+		{
+			for (const MemorySegment::Span &span : m_segment->getSpans())
+			{
+				if (iovcnt >= SEGMENT_WRITER_MAX_IOV - 1)
+				{
+					break;
+				}
+				if (m_offset < position + span.m_size)
+				{
+					size_t skip = (m_offset > position) ? m_offset - position : 0;
+					iov[iovcnt].iov_base = (void *)(span.data() + skip);
+					iov[iovcnt].iov_len = span.m_size - skip;
+					iovcnt++;
+				}
+				position += span.m_size;
+			}
+		}
+		if ((position == m_header.size() + segmentSize) && (m_offset < total))
+		{
+			size_t skip = (m_offset > position) ? m_offset - position : 0;
+			iov[iovcnt].iov_base = (void *)(m_trailer.c_str() + skip);
+			iov[iovcnt].iov_len = m_trailer.size() - skip;
+			iovcnt++;
+		}
+
+		msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = iovcnt;
+		ssize_t numBytesWritten = sendmsg(m_socketNum, &msg, MSG_NOSIGNAL | MSG_DONTWAIT);
+		if (numBytesWritten > 0)
+		{
+			m_offset += numBytesWritten;
+		}
+		else if ((numBytesWritten < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK) || (errno == EINTR)))
+		{
+			// wait the socket to be writable again
+			m_env.taskScheduler().setBackgroundHandling(m_socketNum, SOCKET_WRITABLE, socketWritableHandler, this);
+			return;
+		}
+		else
+		{
+			LOG(DEBUG) << "segment send error:" << strerror(errno);
+			done = true;
+		}
+	}
+
+	// We're now done, this object could be deleted by the callback
+	m_env.taskScheduler().disableBackgroundHandling(m_socketNum);
+	(*m_afterFunc)(m_afterClientData);
+}
+
+// ---------------------------------
+// HTTP responses
+// ---------------------------------
+void HTTPServer::HTTPClientConnection::formatHeader(const char *contentType, unsigned int contentLength, const std::string &headers, bool chunked)
 {
+	// the size of a chunked body is not known when the header is sent
+	char length[64];
+	if (chunked)
+	{
+		snprintf(length, sizeof(length), "%s", m_ChunkedFraming ? "Transfer-Encoding: chunked\r\n" : "");
+	}
+	else
+	{
+		snprintf(length, sizeof(length), "Content-Length: %d\r\n", contentLength);
+	}
+
 	// Construct our response:
 	snprintf((char *)fResponseBuffer, sizeof fResponseBuffer,
 			 "HTTP/1.1 200 OK\r\n"
@@ -32,12 +149,157 @@ void HTTPServer::HTTPClientConnection::sendHeader(const char *contentType, unsig
 			 "Server: LIVE555 Streaming Media v%s\r\n"
 			 "Access-Control-Allow-Origin: *\r\n"
 			 "Content-Type: %s\r\n"
-			 "Content-Length: %d\r\n"
+			 "%s"
+			 "%s"
+			 "%s"
 			 "\r\n",
 			 dateHeader(),
 			 LIVEMEDIA_LIBRARY_VERSION_STRING,
 			 contentType,
-			 contentLength);
+			 length,
+			 this->getConnectionHeader().c_str(),
+			 headers.c_str());
+}
+
+// ---------------------------------
+// persistent connections (HTTP/1.1 keep-alive)
+// ---------------------------------
+std::string HTTPServer::HTTPClientConnection::getConnectionHeader()
+{
+	std::ostringstream os;
+	if (m_KeepAlive)
+	{
+		// no max parameter, the number of requests of a connection is not limited
+		os << "Connection: keep-alive\r\nKeep-Alive: timeout=" << ((HTTPServer &)fOurServer).m_keepAliveTimeout << "\r\n";
+	}
+	else
+	{
+		os << "Connection: close\r\n";
+	}
+	return os.str();
+}
+
+bool HTTPServer::HTTPClientConnection::isKeepAliveRequested(const char *fullRequestStr)
+{
+	// HTTP/1.1 connections are persistent unless the client close it, HTTP/1.0 ones only when asked
+	std::string request(fullRequestStr);
+	request = request.substr(0, request.find("\r\n\r\n"));
+	std::transform(request.begin(), request.end(), request.begin(), ::tolower);
+	size_t endOfLine = request.find("\r\n");
+	bool keepAlive = (request.substr(0, endOfLine).find("http/1.1") != std::string::npos);
+	size_t pos = request.find("\r\nconnection:");
+	if (pos != std::string::npos)
+	{
+		pos += strlen("\r\nconnection:");
+		std::string value(request.substr(pos, request.find("\r\n", pos) - pos));
+		if (value.find("close") != std::string::npos)
+		{
+			keepAlive = false;
+		}
+		else if (value.find("keep-alive") != std::string::npos)
+		{
+			keepAlive = true;
+		}
+	}
+	return keepAlive;
+}
+
+void HTTPServer::HTTPClientConnection::updateKeepAlive(const char *fullRequestStr)
+{
+	HTTPServer &httpServer = (HTTPServer &)fOurServer;
+	bool keepAlive = (httpServer.m_keepAliveTimeout > 0) && this->isKeepAliveRequested(fullRequestStr);
+	if (keepAlive && !m_KeepAliveCounted)
+	{
+		// the persistent connections are limited, the others are closed after their response
+		if (m_keepAliveConnections++ < httpServer.m_keepAliveMaxConnections)
+		{
+			m_KeepAliveCounted = true;
+		}
+		else
+		{
+			m_keepAliveConnections--;
+		}
+	}
+	m_KeepAlive = keepAlive && m_KeepAliveCounted;
+}
+
+bool HTTPServer::HTTPClientConnection::isBusy()
+{
+	return (m_TCPSink != NULL) || (m_SegmentWriter != NULL) || m_Chunked || (m_WaitingSink != NULL) || (m_WaitingTask != NULL) || (m_NextTask != NULL);
+}
+
+void HTTPServer::HTTPClientConnection::responseDone()
+{
+	// the sink or the writer is released from the event loop, this could be called from its callback
+	if (m_NextTask == NULL)
+	{
+		m_NextTask = envir().taskScheduler().scheduleDelayedTask(0, nextRequest, this);
+	}
+}
+
+void HTTPServer::HTTPClientConnection::nextRequest(void *clientData)
+{
+	HTTPClientConnection *clientConnection = (HTTPClientConnection *)clientData;
+	clientConnection->m_NextTask = NULL;
+	clientConnection->nextRequest();
+}
+
+void HTTPServer::HTTPClientConnection::nextRequest()
+{
+	this->streamSource(NULL);
+	if (m_Subsession)
+	{
+		m_Subsession->deleteStream(m_ClientSessionId, m_StreamToken);
+		m_Subsession = NULL;
+	}
+	if (!m_KeepAlive)
+	{
+		delete this;
+		return;
+	}
+
+	// the socket handler was replaced to send the response, the connection reads the next requests again
+	envir().taskScheduler().setBackgroundHandling(fClientInputSocket, SOCKET_READABLE | SOCKET_EXCEPTION, incomingRequestHandler, this);
+	if (m_PendingRequests.empty())
+	{
+		m_IdleTask = envir().taskScheduler().scheduleDelayedTask((int64_t)((HTTPServer &)fOurServer).m_keepAliveTimeout * 1000000, idleTimeout, this);
+		return;
+	}
+
+	// same as the processing of a request by live555
+	std::pair<std::string, std::string> request(m_PendingRequests.front());
+	m_PendingRequests.pop_front();
+	++fRecursionCount;
+	this->updateKeepAlive(request.second.c_str());
+	this->handleRequest(request.first.c_str(), request.second.c_str());
+	if (fResponseBuffer[0] != '\0')
+	{
+		send(fClientOutputSocket, (char const *)fResponseBuffer, strlen((char *)fResponseBuffer), 0);
+		fResponseBuffer[0] = '\0';
+	}
+	--fRecursionCount;
+
+	if (!fIsActive)
+	{
+		delete this;
+	}
+	else if (!this->isBusy())
+	{
+		this->responseDone();
+	}
+}
+
+void HTTPServer::HTTPClientConnection::idleTimeout(void *clientData)
+{
+	HTTPClientConnection *clientConnection = (HTTPClientConnection *)clientData;
+	clientConnection->m_IdleTask = NULL;
+	LOG(DEBUG) << "close idle connection requests:" << clientConnection->m_RequestCount;
+	delete clientConnection;
+}
+
+void HTTPServer::HTTPClientConnection::sendHeader(const char *contentType, unsigned int contentLength)
+{
+	this->formatHeader(contentType, contentLength);
 
 	// Send the response header
 	send(fClientOutputSocket, (char const *)fResponseBuffer, strlen((char *)fResponseBuffer), 0);
@@ -51,16 +313,213 @@ void HTTPServer::HTTPClientConnection::streamSource(const std::string &content)
 	this->streamSource(ByteStreamMemoryBufferSource::createNew(envir(), buffer, content.size()));
 }
 
+void HTTPServer::HTTPClientConnection::streamSegment(const char *contentType, const std::shared_ptr<const MemorySegment> &segment, const std::string &headers)
+{
+	// header and body leave in the same sendmsg, the bytes of the segment are not copied
+	this->formatHeader(contentType, segment->size(), headers);
+	std::string header((char *)fResponseBuffer);
+	fResponseBuffer[0] = '\0'; // the response is sent by the writer
+
+	this->writeSegment(header, segment, std::string(), afterStreaming);
+}
+
+// ---------------------------------
+// conditional requests, a caching proxy only checks that its copy is still valid
+// ---------------------------------
+void HTTPServer::HTTPClientConnection::streamCachedSegment(const char *contentType, const std::shared_ptr<const MemorySegment> &segment, const std::string &etag, const std::string &cacheControl, const std::string &extraHeaders, time_t lastModified)
+{
+	std::string headers("ETag: " + etag + "\r\nCache-Control: " + cacheControl + "\r\n" + extraHeaders);
+	if (this->isNotModified(etag, lastModified))
+	{
+		snprintf((char *)fResponseBuffer, sizeof fResponseBuffer,
+				 "HTTP/1.1 304 Not Modified\r\n"
+				 "%s"
+				 "Server: LIVE555 Streaming Media v%s\r\n"
+				 "Access-Control-Allow-Origin: *\r\n"
+				 "%s"
+				 "%s"
+				 "\r\n",
+				 dateHeader(),
+				 LIVEMEDIA_LIBRARY_VERSION_STRING,
+				 this->getConnectionHeader().c_str(),
+				 headers.c_str());
+	}
+	else
+	{
+		this->streamSegment(contentType, segment, headers);
+	}
+}
+
+// If-None-Match is "*" or a list of entity-tags, compared with the weak comparison
+static bool matchEntityTag(const std::string &ifNoneMatch, const std::string &etag)
+{
+	std::string opaqueTag(etag.compare(0, 2, "W/") == 0 ? etag.substr(2) : etag);
+	size_t pos = 0;
+	while (pos < ifNoneMatch.size())
+	{
+		pos = ifNoneMatch.find_first_not_of(" \t,", pos);
+		if (pos == std::string::npos)
+		{
+			break;
+		}
+		if (ifNoneMatch[pos] == '*')
+		{
+			return true;
+		}
+		if (ifNoneMatch.compare(pos, 2, "W/") == 0)
+		{
+			pos += 2;
+		}
+		if (ifNoneMatch[pos] != '"')
+		{
+			// not an entity-tag, the rest of the list cannot be parsed
+			break;
+		}
+		size_t end = ifNoneMatch.find('"', pos + 1);
+		if (end == std::string::npos)
+		{
+			break;
+		}
+		if (ifNoneMatch.compare(pos, end + 1 - pos, opaqueTag) == 0)
+		{
+			return true;
+		}
+		pos = end + 1;
+	}
+	return false;
+}
+
+bool HTTPServer::HTTPClientConnection::isNotModified(const std::string &etag, time_t lastModified)
+{
+	bool notModified = false;
+	std::string ifNoneMatch = this->getRequestHeader("if-none-match");
+	if (!ifNoneMatch.empty())
+	{
+		notModified = matchEntityTag(ifNoneMatch, etag);
+	}
+	else if (lastModified != 0)
+	{
+		// the date is only checked when the client has no ETag
+		std::string ifModifiedSince = this->getRequestHeader("if-modified-since");
+		struct tm tm;
+		memset(&tm, 0, sizeof(tm));
+		if (!ifModifiedSince.empty() && (strptime(ifModifiedSince.c_str(), "%a, %d %b %Y %H:%M:%S GMT", &tm) != NULL))
+		{
+			notModified = (lastModified <= timegm(&tm));
+		}
+	}
+	return notModified;
+}
+
+std::string HTTPServer::HTTPClientConnection::getRequestHeader(const char *name)
+{
+	std::string value;
+	std::string request(m_RequestStr ? m_RequestStr : "");
+	std::string headers(request);
+	std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+	std::string field("\r\n" + std::string(name) + ":");
+	size_t pos = headers.find(field);
+	if (pos != std::string::npos)
+	{
+		pos = headers.find_first_not_of(" \t", pos + field.size());
+		if (pos != std::string::npos)
+		{
+			size_t end = headers.find("\r\n", pos);
+			value = request.substr(pos, (end == std::string::npos) ? std::string::npos : end - pos);
+		}
+	}
+	return value;
+}
+
+void HTTPServer::HTTPClientConnection::writeSegment(const std::string &header, const std::shared_ptr<const MemorySegment> &segment, const std::string &trailer, TaskFunc *afterFunc)
+{
+	this->streamSource(NULL);
+	m_SegmentWriter = new SegmentWriter(envir(), fClientOutputSocket, header, segment, trailer, afterFunc, this);
+	m_SegmentWriter->start();
+}
+
+// ---------------------------------
+// segment in progress sent part by part with chunked transfer encoding (low latency CMAF)
+// ---------------------------------
+void HTTPServer::HTTPClientConnection::streamChunkedSegment(const char *streamName, const char *contentType, unsigned int sequence)
+{
+	// chunked transfer encoding is HTTP/1.1, older clients read until the connection is closed
+	std::string requestLine(m_RequestStr, strcspn(m_RequestStr, "\r\n"));
+	m_ChunkedFraming = (requestLine.find("HTTP/1.1") != std::string::npos);
+	if (!m_ChunkedFraming)
+	{
+		m_KeepAlive = false;
+	}
+	this->formatHeader(contentType, 0, "Cache-Control: no-cache\r\n", true);
+	m_ChunkedHeader.assign((char *)fResponseBuffer);
+	fResponseBuffer[0] = '\0'; // the response is sent by the writer
+
+	m_Chunked = true;
+	m_ChunkedStream.assign(streamName);
+	m_ChunkedSequence = sequence;
+	m_ChunkedPart = 0;
+	this->sendNextChunk();
+}
+
+void HTTPServer::HTTPClientConnection::afterChunk(void *clientData)
+{
+	HTTPClientConnection *clientConnection = (HTTPClientConnection *)clientData;
+	clientConnection->sendNextChunk();
+}
+
+void HTTPServer::HTTPClientConnection::sendNextChunk()
+{
+	// the sink is looked up again, it could be closed while waiting
+	TSServerMediaSubsession *subsession = this->getHlsSubsession(m_ChunkedStream.c_str());
+	MemoryBufferSink *sink = (subsession != NULL) ? subsession->getHlsSink() : NULL;
+	std::shared_ptr<const MemorySegment> part;
+	if (sink != NULL)
+	{
+		part = sink->getPart(m_ChunkedSequence, m_ChunkedPart);
+	}
+
+	if (part)
+	{
+		std::ostringstream os;
+		os << m_ChunkedHeader;
+		if (m_ChunkedFraming)
+		{
+			os << std::hex << part->size() << "\r\n";
+		}
+		m_ChunkedHeader.clear();
+		m_ChunkedPart++;
+		this->writeSegment(os.str(), part, m_ChunkedFraming ? "\r\n" : "", afterChunk);
+	}
+	else if ((sink != NULL) && (m_ChunkedSequence >= sink->getCurrentSequence()) && this->waitFor(sink))
+	{
+		return;
+	}
+	else
+	{
+		// last chunk, the segment is complete
+		m_Chunked = false;
+		this->writeSegment(m_ChunkedHeader + (m_ChunkedFraming ? "0\r\n\r\n" : ""), std::shared_ptr<const MemorySegment>(), std::string(), afterStreaming);
+		m_ChunkedHeader.clear();
+	}
+}
+
 void HTTPServer::HTTPClientConnection::streamSource(FramedSource *source)
 {
+	if (m_SegmentWriter != NULL)
+	{
+		delete m_SegmentWriter;
+		m_SegmentWriter = NULL;
+	}
 	if (m_TCPSink != NULL)
 	{
 		m_TCPSink->stopPlaying();
 		Medium::close(m_TCPSink);
+		m_TCPSink = NULL;
 	}
 	if (m_Source != NULL)
 	{
 		Medium::close(m_Source);
+		m_Source = NULL;
 	}
 	if (source != NULL)
 	{
@@ -93,144 +552,426 @@ ServerMediaSubsession *HTTPServer::HTTPClientConnection::getSubsesion(const char
 	return subsession;
 }
 
-bool HTTPServer::HTTPClientConnection::sendM3u8PlayList(char const *urlSuffix)
+// ---------------------------------
+// requests held until a segment or a part is available (LL-HLS blocking reload and preload hint)
+// ---------------------------------
+bool HTTPServer::HTTPClientConnection::waitFor(MemoryBufferSink *sink, unsigned int timeout)
 {
-	ServerMediaSubsession *subsession = this->getSubsesion(urlSuffix);
-	if (subsession == NULL)
+	if (m_WaitingExpired)
 	{
 		return false;
 	}
-
-	float duration = subsession->duration();
-	if (duration <= 0.0)
+	m_WaitingSink = sink;
+	if (!m_Chunked)
 	{
-		return false;
+		m_WaitingUrl.assign(m_RequestUrl);
+		m_WaitingRequest.assign(m_RequestStr);
 	}
+	sink->addWaiter(segmentAvailable, this);
+	if (m_WaitingTask == NULL)
+	{
+		int64_t delay = (int64_t)((timeout != 0) ? timeout : HLS_BLOCKING_TIMEOUT_FACTOR * sink->getTargetDuration()) * 1000000;
+		m_WaitingTask = envir().taskScheduler().scheduleDelayedTask(delay, waitingTimeout, this);
+	}
+	fResponseBuffer[0] = '\0'; // the response is sent later
+	return true;
+}
 
-	unsigned int startTime = subsession->getCurrentNPT(NULL);
-	HTTPServer *httpServer = (HTTPServer *)(&fOurServer);
-	unsigned sliceDuration = httpServer->m_hlsSegment;
-	std::ostringstream os;
-	os << "#EXTM3U\r\n"
-	   << "#EXT-X-ALLOW-CACHE:NO\r\n"
-	   << "#EXT-X-MEDIA-SEQUENCE:" << startTime << "\r\n"
-	   << "#EXT-X-TARGETDURATION:" << sliceDuration << "\r\n";
+void HTTPServer::HTTPClientConnection::segmentAvailable(void *clientData)
+{
+	// the sink could be closing, the request is handled again from the event loop
+	HTTPClientConnection *clientConnection = (HTTPClientConnection *)clientData;
+	clientConnection->m_WaitingSink = NULL;
+	clientConnection->envir().taskScheduler().unscheduleDelayedTask(clientConnection->m_WaitingTask);
+	clientConnection->m_WaitingTask = clientConnection->envir().taskScheduler().scheduleDelayedTask(0, retryRequest, clientConnection);
+}
 
-	for (unsigned int slice = 0; slice * sliceDuration < duration; slice++)
+void HTTPServer::HTTPClientConnection::waitingTimeout(void *clientData)
+{
+	HTTPClientConnection *clientConnection = (HTTPClientConnection *)clientData;
+	clientConnection->m_WaitingExpired = true;
+	retryRequest(clientData);
+}
+
+void HTTPServer::HTTPClientConnection::retryRequest(void *clientData)
+{
+	HTTPClientConnection *clientConnection = (HTTPClientConnection *)clientData;
+	clientConnection->retryRequest();
+}
+
+void HTTPServer::HTTPClientConnection::retryRequest()
+{
+	m_WaitingTask = NULL;
+	if (m_WaitingSink != NULL)
+	{
+		m_WaitingSink->removeWaiter(this);
+		m_WaitingSink = NULL;
+	}
+	std::string urlSuffix(m_WaitingUrl);
+	std::string fullRequestStr(m_WaitingRequest);
+
+	// same as the processing of a request by live555
+	++fRecursionCount;
+	if (m_Chunked)
+	{
+		this->sendNextChunk();
+	}
+	else
 	{
-		os << "#EXTINF:" << sliceDuration << ",\r\n";
-		os << urlSuffix << "?segment=" << (startTime + slice * sliceDuration) << "\r\n";
+		this->handleRequest(urlSuffix.c_str(), fullRequestStr.c_str());
 	}
+	if (fResponseBuffer[0] != '\0')
+	{
+		send(fClientOutputSocket, (char const *)fResponseBuffer, strlen((char *)fResponseBuffer), 0);
+		fResponseBuffer[0] = '\0';
+	}
+	--fRecursionCount;
+	m_WaitingExpired = false;
 
-	envir() << "send M3u8 playlist:" << urlSuffix << "\n";
-	const std::string &playList(os.str());
+	// the response is flushed, nextRequest closes the connection without keep-alive
+	if (!fIsActive)
+	{
+		delete this;
+	}
+	else if (!this->isBusy())
+	{
+		this->responseDone();
+	}
+}
 
-	// send response header
-	this->sendHeader("application/vnd.apple.mpegurl", playList.size());
+void HTTPServer::HTTPClientConnection::sendBadRequest()
+{
+	snprintf((char *)fResponseBuffer, sizeof fResponseBuffer,
+			 "HTTP/1.1 400 Bad Request\r\n"
+			 "%s"
+			 "Content-Length: 0\r\n"
+			 "%s"
+			 "\r\n",
+			 dateHeader(),
+			 this->getConnectionHeader().c_str());
+}
 
-	// stream body
-	this->streamSource(playList);
+void HTTPServer::HTTPClientConnection::sendServiceUnavailable(unsigned int retryAfter)
+{
+	snprintf((char *)fResponseBuffer, sizeof fResponseBuffer,
+			 "HTTP/1.1 503 Service Unavailable\r\n"
+			 "%s"
+			 "Retry-After: %u\r\n"
+			 "Content-Length: 0\r\n"
+			 "%s"
+			 "\r\n",
+			 dateHeader(),
+			 std::max(retryAfter, 1u),
+			 this->getConnectionHeader().c_str());
+}
 
+// the playlist of a pipeline just started is held until its first segments are cut, never answered with a 404
+bool HTTPServer::HTTPClientConnection::waitForPipeline(TSServerMediaSubsession *subsession)
+{
+	MemoryBufferSink *sink = subsession->getHlsSink();
+	if (subsession->isPipelineRunning() && this->waitFor(sink, HLS_START_TIMEOUT))
+	{
+		return true;
+	}
+	LOG(NOTICE) << "no segment yet for:" << subsession->trackId();
+	this->sendServiceUnavailable(sink->getTargetDuration());
 	return true;
 }
 
-bool HTTPServer::HTTPClientConnection::sendMpdPlayList(char const *urlSuffix)
+// ---------------------------------
+// playlists, rendered once per version of the segment list
+// ---------------------------------
+TSServerMediaSubsession *HTTPServer::HTTPClientConnection::getHlsSubsession(char const *urlSuffix)
 {
-	ServerMediaSubsession *subsession = this->getSubsesion(urlSuffix);
+	return dynamic_cast<TSServerMediaSubsession *>(this->getSubsesion(urlSuffix));
+}
+
+// the ETag is a hash of the content, it changes only when a new version is rendered
+static void setPlayList(TSServerMediaSubsession::PlayList &playList, unsigned int version, const std::string &content)
+{
+	std::ostringstream etag;
+	etag << "\"" << std::hex << std::hash<std::string>()(content) << "\"";
+	playList.m_version = version;
+	playList.m_content.reset(new MemorySegment(content));
+	playList.m_etag = etag.str();
+}
+
+static std::string getPlayListCacheControl()
+{
+	std::ostringstream os;
+	os << "public, max-age=" << HTTP_PLAYLIST_MAX_AGE;
+	return os.str();
+}
+
+bool HTTPServer::HTTPClientConnection::sendM3u8PlayList(char const *urlSuffix, char const *query)
+{
+	TSServerMediaSubsession *subsession = this->getHlsSubsession(urlSuffix);
 	if (subsession == NULL)
 	{
 		return false;
 	}
+	MemoryBufferSink *sink = subsession->getHlsSink();
 
-	float duration = subsession->duration();
-	if (duration <= 0.0)
+	// blocking playlist reload
+	unsigned int msn = 0;
+	unsigned int part = 0;
+	const char *msnPos = (query != NULL) ? strstr(query, "_HLS_msn=") : NULL;
+	const char *partPos = (query != NULL) ? strstr(query, "_HLS_part=") : NULL;
+	if ((msnPos != NULL) && (sscanf(msnPos, "_HLS_msn=%u", &msn) == 1))
 	{
-		return false;
+		bool hasPart = (partPos != NULL) && (sscanf(partPos, "_HLS_part=%u", &part) == 1);
+		unsigned int current = sink->getCurrentSequence();
+		if (msn > current + 2)
+		{
+			this->sendBadRequest();
+			return true;
+		}
+		bool available = (msn < current) || ((msn == current) && hasPart && (part < sink->getCurrentParts()));
+		if (!available && this->waitFor(sink))
+		{
+			return true;
+		}
 	}
 
-	unsigned int startTime = subsession->getCurrentNPT(NULL);
-	HTTPServer *httpServer = (HTTPServer *)(&fOurServer);
-	unsigned sliceDuration = httpServer->m_hlsSegment;
+	TSServerMediaSubsession::PlayList &playList = subsession->getPlayList("m3u8");
+	if (!playList.m_content || (playList.m_version != sink->getVersion()))
+	{
+		std::string content = renderM3u8PlayList(urlSuffix, sink);
+		if (content.empty())
+		{
+			return this->waitForPipeline(subsession);
+		}
+		LOG(DEBUG) << "render M3u8 playlist:" << urlSuffix << " version:" << sink->getVersion();
+		setPlayList(playList, sink->getVersion(), content);
+	}
+	this->streamCachedSegment("application/vnd.apple.mpegurl", playList.m_content, playList.m_etag, getPlayListCacheControl());
+	return true;
+}
+
+std::string HTTPServer::HTTPClientConnection::renderM3u8PlayList(char const *urlSuffix, MemoryBufferSink *sink)
+{
+	std::vector<MemoryBufferSink::SegmentInfo> segments = sink->getSegmentList();
+	if ((segments.size() < 2) || (sink->duration() <= 0.0))
+	{
+		return std::string();
+	}
+
+	unsigned int partDuration = sink->getPartDuration();
 	std::ostringstream os;
+	os << "#EXTM3U\r\n"
+	   << "#EXT-X-VERSION:6\r\n"
+	   << "#EXT-X-MEDIA-SEQUENCE:" << segments.front().m_sequence << "\r\n"
+	   << "#EXT-X-TARGETDURATION:" << sink->getTargetDuration() << "\r\n"
+	   << "#EXT-X-INDEPENDENT-SEGMENTS\r\n";
+	if (sink->getInitSegment())
+	{
+		os << "#EXT-X-MAP:URI=\"" << urlSuffix << "?init\"\r\n";
+	}
+	if (partDuration != 0)
+	{
+		os << "#EXT-X-SERVER-CONTROL:CAN-BLOCK-RELOAD=YES,PART-HOLD-BACK=" << (3 * partDuration) / 1000.0 << "\r\n"
+		   << "#EXT-X-PART-INF:PART-TARGET=" << partDuration / 1000.0 << "\r\n";
+	}
 
-	os << "<?xml version='1.0' encoding='UTF-8'?>\r\n"
-	   << "<MPD type='dynamic' xmlns='urn:mpeg:DASH:schema:MPD:2011' profiles='urn:mpeg:dash:profile:full:2011' minimumUpdatePeriod='PT" << sliceDuration << "S' minBufferTime='" << sliceDuration << "'>\r\n"
-	   << "<Period start='PT0S'><AdaptationSet segmentAlignment='true'><Representation mimeType='video/mp2t' codecs='' >\r\n";
+	for (size_t i = 0; i < segments.size(); i++)
+	{
+		const MemoryBufferSink::SegmentInfo &segment = segments[i];
+		// parts are only listed near the live edge
+		if ((partDuration != 0) && (i + HLS_PART_SEGMENTS >= segments.size()))
+		{
+			for (size_t j = 0; j < segment.m_parts.size(); j++)
+			{
+				os << "#EXT-X-PART:DURATION=" << segment.m_parts[j].m_duration << ",URI=\"" << urlSuffix << "?segment=" << segment.m_sequence << "&part=" << j << "\"";
+				if (segment.m_parts[j].m_independent)
+				{
+					os << ",INDEPENDENT=YES";
+				}
+				os << "\r\n";
+			}
+		}
+		if (segment.m_complete)
+		{
+			os << "#EXTINF:" << segment.m_duration << ",\r\n";
+			os << urlSuffix << "?segment=" << segment.m_sequence << "\r\n";
+		}
+		else if (partDuration != 0)
+		{
+			os << "#EXT-X-PRELOAD-HINT:TYPE=PART,URI=\"" << urlSuffix << "?segment=" << segment.m_sequence << "&part=" << segment.m_parts.size() << "\"\r\n";
+		}
+	}
 
-	os << "<SegmentTemplate duration='" << sliceDuration << "' media='" << urlSuffix << "?segment=$Number$' startNumber='" << startTime << "' />\r\n";
-	os << "</Representation></AdaptationSet></Period>\r\n";
-	os << "</MPD>\r\n";
+	return os.str();
+}
 
-	envir() << "send MPEG-DASH playlist:" << urlSuffix << "\n";
-	const std::string &playList(os.str());
 
-	// send response header
-	this->sendHeader("application/dash+xml", playList.size());
+// ISO 8601 UTC time with milliseconds
+static std::string formatUtcTime(double time)
+{
+	time_t seconds = (time_t)time;
+	struct tm tm;
+	gmtime_r(&seconds, &tm);
+	char buffer[64];
+	size_t size = strftime(buffer, sizeof(buffer), "%Y-%m-%dT%H:%M:%S", &tm);
+	snprintf(buffer + size, sizeof(buffer) - size, ".%03dZ", (int)((time - seconds) * 1000));
+	return std::string(buffer);
+}
 
-	// stream body
-	this->streamSource(playList);
+bool HTTPServer::HTTPClientConnection::sendMpdPlayList(char const *urlSuffix)
+{
+	TSServerMediaSubsession *subsession = this->getHlsSubsession(urlSuffix);
+	if (subsession == NULL)
+	{
+		return false;
+	}
+	MemoryBufferSink *sink = subsession->getHlsSink();
 
+	TSServerMediaSubsession::PlayList &playList = subsession->getPlayList("mpd");
+	if (!playList.m_content || (playList.m_version != sink->getVersion()))
+	{
+		std::string content = renderMpdPlayList(urlSuffix, subsession);
+		if (content.empty())
+		{
+			return this->waitForPipeline(subsession);
+		}
+		LOG(DEBUG) << "render MPEG-DASH playlist:" << urlSuffix << " version:" << sink->getVersion();
+		setPlayList(playList, sink->getVersion(), content);
+	}
+	this->streamCachedSegment("application/dash+xml", playList.m_content, playList.m_etag, getPlayListCacheControl());
 	return true;
 }
 
-bool HTTPServer::HTTPClientConnection::sendFile(char const *urlSuffix)
+std::string HTTPServer::HTTPClientConnection::renderMpdPlayList(char const *urlSuffix, TSServerMediaSubsession *subsession)
 {
-	bool ok = false;
+	MemoryBufferSink *sink = subsession->getHlsSink();
+	std::vector<MemoryBufferSink::SegmentInfo> segments = sink->getSegmentList();
+	if ((segments.size() < 2) || (sink->duration() <= 0.0))
+	{
+		return std::string();
+	}
 
-	std::string url(urlSuffix);
-	size_t pos = url.find_first_of(" ");
-	if (pos != std::string::npos)
+	// media time is the presentation time, the clock offset gives its wall clock time
+	double duration = 0;
+	size_t size = 0;
+	for (const MemoryBufferSink::SegmentInfo &segment : segments)
 	{
-		url.erase(0, pos + 1);
+		if (segment.m_complete)
+		{
+			duration += segment.m_duration;
+			size += segment.m_size;
+		}
 	}
-	pos = url.find_first_of(" ");
-	if (pos != std::string::npos)
+	unsigned int bandwidth = (duration > 0) ? (unsigned int)(size * 8 / duration) : 0;
+	unsigned int targetDuration = sink->getTargetDuration();
+	bool fragmented = (sink->getInitSegment() != NULL);
+	timeval now;
+	gettimeofday(&now, NULL);
+
+	// the adaptation set follows the media of the session, MPEG-TS is video/mp2t even without video
+	std::string format = subsession->getFormat();
+	std::string contentType = format.substr(0, format.find('/'));
+	std::string mimeType = sink->getContentType();
+	if (fragmented)
 	{
-		url.erase(pos);
+		mimeType = contentType + "/mp4";
 	}
-	pos = url.find_first_of("/");
-	if (pos != std::string::npos)
+
+	std::ostringstream os;
+	os << "<?xml version='1.0' encoding='UTF-8'?>\r\n"
+	   << "<MPD type='dynamic' xmlns='urn:mpeg:dash:schema:mpd:2011'"
+	   << " profiles='" << (fragmented ? "urn:mpeg:dash:profile:isoff-live:2011" : "urn:mpeg:dash:profile:mp2t-simple:2011") << "'"
+	   << " availabilityStartTime='" << formatUtcTime(sink->getClockOffset()) << "'"
+	   << " publishTime='" << formatUtcTime(now.tv_sec + now.tv_usec / 1000000.0) << "'"
+	   << " minimumUpdatePeriod='PT" << targetDuration << "S'"
+	   << " minBufferTime='PT" << targetDuration << "S'"
+	   << " timeShiftBufferDepth='PT" << (unsigned int)duration << "S'"
+	   << " maxSegmentDuration='PT" << targetDuration << "S'>\r\n"
+	   << "<Period id='0' start='PT0S'>\r\n"
+	   << "<AdaptationSet contentType='" << contentType << "' segmentAlignment='true' startWithSAP='1'>\r\n"
+	   << "<Representation id='0' mimeType='" << mimeType << "' bandwidth='" << bandwidth << "'";
+	std::string codecs = subsession->getCodecs();
+	if (!codecs.empty())
 	{
-		url.erase(0, 1);
+		os << " codecs='" << codecs << "'";
 	}
-	std::string pattern("../");
-	while ((pos = url.find(pattern, pos)) != std::string::npos)
+	if (subsession->getWidth() > 0)
 	{
-		url.erase(pos, pattern.length());
+		os << " width='" << subsession->getWidth() << "' height='" << subsession->getHeight() << "'";
 	}
+	os << ">\r\n";
 
-	std::string ext;
-	pos = url.find_last_of(".");
-	if (pos != std::string::npos)
+	os << "<SegmentTemplate timescale='" << CMAF_TIMESCALE << "' media='" << urlSuffix << "?segment=$Number$' startNumber='" << segments.front().m_sequence << "'";
+	if (fragmented)
 	{
-		ext.assign(url.substr(pos + 1));
+		os << " initialization='" << urlSuffix << "?init'";
+		if (sink->getPartDuration() != 0)
+		{
+			// the segment in progress is sent with chunked transfer encoding
+			os << " availabilityTimeOffset='" << targetDuration - sink->getPartDuration() / 1000.0 << "' availabilityTimeComplete='false'";
+		}
+	}
+	os << ">\r\n<SegmentTimeline>\r\n";
+	for (const MemoryBufferSink::SegmentInfo &segment : segments)
+	{
+		if (segment.m_complete)
+		{
+			os << "<S t='" << (uint64_t)llround(segment.m_start * CMAF_TIMESCALE) << "' d='" << (uint64_t)llround(segment.m_duration * CMAF_TIMESCALE) << "' />\r\n";
+		}
+	}
+	os << "</SegmentTimeline>\r\n</SegmentTemplate>\r\n";
+	os << "</Representation></AdaptationSet></Period>\r\n";
+	os << "</MPD>\r\n";
+
+	return os.str();
+}
+
+bool HTTPServer::HTTPClientConnection::sendFile(char const *urlSuffix)
+{
+	HTTPServer *httpServer = (HTTPServer *)(&fOurServer);
+	if (!httpServer->m_staticFiles)
+	{
+		return false;
 	}
 
-	if (url.empty())
+	// path of the request line, files are looked up in memory, never on the disk
+	std::string url(urlSuffix);
+	size_t pos = url.find_first_of(" ");
+	if (pos != std::string::npos)
 	{
-		url = "index.html";
-		ext = "html";
+		url.erase(0, pos + 1);
 	}
-	if (ext == "js") {
-		ext = "javascript";
+	pos = url.find_first_of(" ");
+	if (pos != std::string::npos)
+	{
+		url.erase(pos);
 	}
-	HTTPServer *httpServer = (HTTPServer *)(&fOurServer);
-	if (!httpServer->m_webroot.empty())
+	url = url.substr(0, url.find_first_of("?"));
+	pos = url.find_first_not_of("/");
+	url = (pos != std::string::npos) ? url.substr(pos) : "";
+
+	std::shared_ptr<const StaticFileCache::File> file = httpServer->m_staticFiles->getFile(url);
+	if (!file)
 	{
-		url.insert(0, httpServer->m_webroot);
+		return false;
 	}
-	std::ifstream file(url.c_str());
-	if (file.is_open())
+
+	// each variant has its own ETag, the proxies keep them apart with Vary
+	StaticFileCache::Encoding encoding = StaticFileCache::negotiate(*file, this->getRequestHeader("accept-encoding"));
+	std::string etag("\"" + file->m_etag);
+	std::string headers("Vary: Accept-Encoding\r\nLast-Modified: ");
+	char date[64];
+	struct tm tm;
+	gmtime_r(&file->m_lastModified, &tm);
+	strftime(date, sizeof(date), "%a, %d %b %Y %H:%M:%S GMT", &tm);
+	headers.append(date).append("\r\n");
+	if (encoding != StaticFileCache::ENCODING_IDENTITY)
 	{
-		envir() << "send file:" << url.c_str() << "\n";
-		std::string content((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
-		std::string mime("text/");
-		mime.append(ext);
-		this->sendHeader(mime.c_str(), content.size());
-		this->streamSource(content);
-		ok = true;
+		etag.append("-").append(StaticFileCache::getEncodingName(encoding));
+		headers.append("Content-Encoding: ").append(StaticFileCache::getEncodingName(encoding)).append("\r\n");
 	}
-	return ok;
+	etag.append("\"");
+	LOG(DEBUG) << "send file:" << url << " encoding:" << StaticFileCache::getEncodingName(encoding);
+	this->streamCachedSegment(file->m_mime.c_str(), file->m_content[encoding], etag, "no-cache", headers, file->m_lastModified);
+	return true;
 }
 
 std::list<std::string> getSubsessionFormats(ServerMediaSession *session)
@@ -252,6 +993,43 @@ std::list<std::string> getSubsessionFormats(ServerMediaSession *session)
 
 void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *urlSuffix, char const *fullRequestStr)
 {
+	if (m_RequestCount++ == 0)
+	{
+		m_httpConnections++;
+	}
+	m_httpRequests++;
+	envir().taskScheduler().unscheduleDelayedTask(m_IdleTask);
+
+	// requests pipelined during a response are answered in order once it is sent
+	if (this->isBusy())
+	{
+		if (m_KeepAlive && (m_PendingRequests.size() < HTTP_MAX_PIPELINED_REQUESTS))
+		{
+			std::string request(fullRequestStr);
+			m_PendingRequests.push_back(std::make_pair(std::string(urlSuffix), request.substr(0, request.find("\r\n\r\n"))));
+		}
+		else
+		{
+			// the connection is closed after the response, the client sends again the requests not answered
+			m_KeepAlive = false;
+		}
+		fResponseBuffer[0] = '\0';
+		return;
+	}
+
+	this->updateKeepAlive(fullRequestStr);
+	this->handleRequest(urlSuffix, fullRequestStr);
+	if (fIsActive && !this->isBusy())
+	{
+		// the response is sent by live555 when this returns
+		this->responseDone();
+	}
+}
+
+void HTTPServer::HTTPClientConnection::handleRequest(char const *urlSuffix, char const *fullRequestStr)
+{
+	m_RequestUrl = urlSuffix;
+	m_RequestStr = fullRequestStr;
 	char const *questionMarkPos = strrchr(urlSuffix, '?');
 	if (strcmp(urlSuffix, "version") == 0)
 	{
@@ -301,9 +1079,23 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *ur
 			{
 				format.replace(pos, 5, "image");
 			}
-			std::string content = baseSubsession->getLastFrame();
-			this->sendHeader(format.c_str(), content.size());
-			this->streamSource(content);
+			bool lazyCapture = baseSubsession->wakeCapture();
+			std::shared_ptr<const FrameSnapshot> snapshot = baseSubsession->getLastFrame();
+			if (snapshot)
+			{
+				this->sendHeader(format.c_str(), snapshot->size());
+				this->streamSource(FrameSnapshotSource::createNew(envir(), snapshot));
+			}
+			else if (lazyCapture)
+			{
+				// the capture was paused, the client retries once a keyframe is captured
+				this->sendServiceUnavailable(1);
+			}
+			else
+			{
+				this->sendHeader(format.c_str(), 0);
+				this->streamSource(std::string());
+			}
 		}
 		else
 		{
@@ -346,12 +1138,12 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *ur
 		this->sendHeader("text/plain", content.size());
 		this->streamSource(content);
 	}
-	else if (questionMarkPos == NULL)
+	else if ((questionMarkPos == NULL) || (strncmp(questionMarkPos, "?_HLS_", strlen("?_HLS_")) == 0))
 	{
-		std::string streamName(urlSuffix);
+		std::string url(urlSuffix, (questionMarkPos != NULL) ? questionMarkPos - urlSuffix : strlen(urlSuffix));
+		std::string streamName(url);
 		std::string ext;
 
-		std::string url(urlSuffix);
 		size_t pos = url.find_last_of(".");
 		if (pos != std::string::npos)
 		{
@@ -367,7 +1159,7 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *ur
 		else
 		{
 			// HLS Playlist
-			ok = this->sendM3u8PlayList(streamName.c_str());
+			ok = this->sendM3u8PlayList(streamName.c_str(), questionMarkPos);
 		}
 
 		if (!ok)
@@ -382,10 +1174,44 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *ur
 			fIsActive = False;
 		}
 	}
+	else if (strcmp(questionMarkPos, "?init") == 0)
+	{
+		// initialization segment of fragmented MP4 streams
+		std::string streamName(urlSuffix, questionMarkPos - urlSuffix);
+		TSServerMediaSubsession *subsession = this->getHlsSubsession(streamName.c_str());
+		std::shared_ptr<const MemorySegment> init;
+		if (subsession != NULL)
+		{
+			init = subsession->getHlsSink()->getInitSegment();
+		}
+		if (!init)
+		{
+			handleHTTPCmd_notSupported();
+			fIsActive = False;
+		}
+		else
+		{
+			// the init segment changes only with the parameter sets
+			TSServerMediaSubsession::PlayList &cached = subsession->getPlayList("init");
+			if (cached.m_content != init)
+			{
+				std::string content;
+				for (const MemorySegment::Span &span : init->getSpans())
+				{
+					content.append(span.data(), span.m_size);
+				}
+				setPlayList(cached, 0, content);
+				cached.m_content = init;
+			}
+			this->streamCachedSegment(subsession->getHlsSink()->getContentType(), init, cached.m_etag, getPlayListCacheControl());
+		}
+	}
 	else
 	{
 		unsigned offsetInSeconds;
-		if (sscanf(questionMarkPos, "?segment=%u", &offsetInSeconds) != 1)
+		unsigned partIndex = 0;
+		int nbParams = sscanf(questionMarkPos, "?segment=%u&part=%u", &offsetInSeconds, &partIndex);
+		if (nbParams < 1)
 		{
 			handleHTTPCmd_notSupported();
 			return;
@@ -400,6 +1226,59 @@ void HTTPServer::HTTPClientConnection::handleHTTPCmd_StreamingGET(char const *ur
 			return;
 		}
 
+		// HLS segments are served from memory by media sequence number, the segment is only known by this request
+		TSServerMediaSubsession *tsSubsession = dynamic_cast<TSServerMediaSubsession *>(subsession);
+		if (tsSubsession != NULL)
+		{
+			MemoryBufferSink *sink = tsSubsession->getHlsSink();
+			unsigned int sequence = offsetInSeconds;
+			std::shared_ptr<const MemorySegment> segment;
+			if (nbParams == 2)
+			{
+				segment = sink->getPart(sequence, partIndex);
+
+				// the part of the preload hint is sent as soon as it is available
+				unsigned int current = sink->getCurrentSequence();
+				bool next = ((sequence == current) && (partIndex == sink->getCurrentParts())) || ((sequence == current + 1) && (partIndex == 0));
+				if (!segment && next && this->waitFor(sink))
+				{
+					return;
+				}
+			}
+			else
+			{
+				segment = sink->getSegment(sequence);
+
+				// low latency DASH clients ask the segment in progress, its parts are sent as they come
+				unsigned int current = sink->getCurrentSequence();
+				if (!segment && sink->getInitSegment() && (sink->getPartDuration() != 0) && ((sequence == current) || (sequence == current + 1)))
+				{
+					this->streamChunkedSegment(streamName.c_str(), sink->getContentType(), sequence);
+					return;
+				}
+			}
+			if (!segment || (segment->size() == 0))
+			{
+				handleHTTPCmd_notSupported();
+				fIsActive = False;
+			}
+			else
+			{
+				// a segment never change, it is identified by the start of the sink and its position
+				std::ostringstream etag;
+				etag << "\"" << std::hex << (uint64_t)(sink->getClockOffset() * 1000) << "-" << sequence;
+				if (nbParams == 2)
+				{
+					etag << "-" << partIndex;
+				}
+				etag << "\"";
+				std::ostringstream cacheControl;
+				cacheControl << "public, max-age=" << (unsigned int)ceil(sink->duration()) + sink->getTargetDuration() << ", immutable";
+				this->streamCachedSegment(sink->getContentType(), segment, etag.str(), cacheControl.str());
+			}
+			return;
+		}
+
 		// Call "getStreamParameters()" to create the stream's source.  (Because we're not actually streaming via RTP/RTCP, most
 		// of the parameters to the call are dummy.)
 		++m_ClientSessionId;
@@ -468,6 +1347,13 @@ void HTTPServer::HTTPClientConnection::afterStreaming(void *clientData)
 {
 	HTTPServer::HTTPClientConnection *clientConnection = (HTTPServer::HTTPClientConnection *)clientData;
 
+	// persistent connection waits the next request
+	if (clientConnection->m_KeepAlive && clientConnection->fIsActive)
+	{
+		clientConnection->responseDone();
+		return;
+	}
+
 	// Arrange to delete the 'client connection' object:
 	if (clientConnection->fRecursionCount > 0)
 	{
@@ -485,8 +1371,145 @@ HTTPServer::HTTPClientConnection::~HTTPClientConnection()
 {
 	this->streamSource(NULL);
 
+	if (m_WaitingSink != NULL)
+	{
+		m_WaitingSink->removeWaiter(this);
+	}
+	envir().taskScheduler().unscheduleDelayedTask(m_WaitingTask);
+	envir().taskScheduler().unscheduleDelayedTask(m_NextTask);
+	envir().taskScheduler().unscheduleDelayedTask(m_IdleTask);
+
 	if (m_Subsession)
 	{
 		m_Subsession->deleteStream(m_ClientSessionId, m_StreamToken);
 	}
+	if (m_KeepAliveCounted)
+	{
+		m_keepAliveConnections--;
+	}
+	if (m_RequestCount > 0)
+	{
+		// reuse rate of the connections, the handshakes saved by keep-alive
+		unsigned int requests = m_httpRequests;
+		unsigned int connections = m_httpConnections;
+		LOG(INFO) << "http connection closed requests:" << m_RequestCount << " total requests:" << requests << " connections:" << connections << " reuse:" << ((requests > 0) ? 100.0 * (requests - connections) / requests : 0) << "%";
+	}
+	((HTTPServer &)fOurRTSPServer).m_connections--;
+}
+
+// ---------------------------------
+// dispatch of the accepted connections
+// ---------------------------------
+HTTPServer::PendingConnection::PendingConnection(HTTPServer &ourServer, int clientSocket, struct SOCKETCLIENT clientAddr)
+	: m_server(ourServer), m_clientSocket(clientSocket), m_clientAddr(clientAddr), m_IdleTask(NULL), m_RetryTask(NULL)
+{
+	m_IdleTask = m_server.envir().taskScheduler().scheduleDelayedTask((int64_t)HTTP_SERVER_PENDING_TIMEOUT * 1000000, idleTimeout, this);
+}
+
+HTTPServer::PendingConnection::~PendingConnection()
+{
+	m_server.envir().taskScheduler().unscheduleDelayedTask(m_IdleTask);
+	m_server.envir().taskScheduler().unscheduleDelayedTask(m_RetryTask);
+}
+
+void HTTPServer::PendingConnection::retryPeek(void *clientData)
+{
+	PendingConnection *pending = (PendingConnection *)clientData;
+	pending->m_RetryTask = NULL;
+	pending->m_server.envir().taskScheduler().setBackgroundHandling(pending->m_clientSocket, SOCKET_READABLE | SOCKET_EXCEPTION, PendingConnection::incomingRequestHandler, pending);
+}
+
+// a client that connects and sends nothing does not keep its socket
+void HTTPServer::PendingConnection::idleTimeout(void *clientData)
+{
+	PendingConnection *pending = (PendingConnection *)clientData;
+	pending->m_IdleTask = NULL;
+	LOG(DEBUG) << "close connection without request";
+	pending->m_server.envir().taskScheduler().disableBackgroundHandling(pending->m_clientSocket);
+	::close(pending->m_clientSocket);
+	delete pending;
+}
+
+void HTTPServer::PendingConnection::incomingRequestHandler()
+{
+	char buffer[HTTP_SERVER_PEEK_SIZE];
+	int size = recv(m_clientSocket, buffer, sizeof(buffer), MSG_PEEK);
+	if ((size < 0) && ((errno == EAGAIN) || (errno == EWOULDBLOCK)))
+	{
+		return;
+	}
+
+	m_server.envir().taskScheduler().disableBackgroundHandling(m_clientSocket);
+	if (size <= 0)
+	{
+		::close(m_clientSocket);
+	}
+	else if ((unsigned char)buffer[0] == 0x16)
+	{
+		// TLS handshake, RTSPS connections cannot be peeked and are not sharded
+		LOG(INFO) << "RTSPS connection served by the main loop";
+		m_server.addClientConnection(m_clientSocket, m_clientAddr);
+	}
+	else if ((size < (int)sizeof(buffer)) && (std::string(buffer, size).find("\r\n\r\n") == std::string::npos))
+	{
+		// the headers are not complete, the cookie of a tunnel could be missing, the socket is peeked again later
+		m_RetryTask = m_server.envir().taskScheduler().scheduleDelayedTask(HTTP_SERVER_PEEK_RETRY * 1000, retryPeek, this);
+		return;
+	}
+	else
+	{
+		// the request stays in the socket for the server that handles the connection
+		std::string path;
+		std::string sessionCookie;
+		HTTPServer::parseRequest(std::string(buffer, size), path, sessionCookie);
+		if (path.empty() || !m_server.m_connectionHandler(m_server.m_connectionHandlerData, m_clientSocket, m_clientAddr, path, sessionCookie))
+		{
+			m_server.addClientConnection(m_clientSocket, m_clientAddr);
+		}
+	}
+	delete this;
+}
+
+void HTTPServer::parseRequest(const std::string &request, std::string &path, std::string &sessionCookie)
+{
+	size_t endOfLine = request.find("\r\n");
+	if (endOfLine == std::string::npos)
+	{
+		return;
+	}
+	std::istringstream is(request.substr(0, endOfLine));
+	std::string method;
+	std::string url;
+	std::string version;
+	is >> method >> url >> version;
+
+	// both connections of an RTSP over HTTP tunnel share the same cookie
+	std::string headers(request.substr(endOfLine));
+	std::transform(headers.begin(), headers.end(), headers.begin(), ::tolower);
+	size_t cookie = headers.find("\r\nx-sessioncookie:");
+	if (cookie != std::string::npos)
+	{
+		size_t begin = headers.find_first_not_of(" \t", cookie + strlen("\r\nx-sessioncookie:"));
+		size_t end = headers.find("\r\n", cookie + 2);
+		if ((begin != std::string::npos) && (end != std::string::npos) && (begin < end))
+		{
+			sessionCookie = request.substr(endOfLine + begin, end - begin);
+		}
+	}
+
+	// HLS, MPEG-DASH and files stay on this server
+	if ((version.compare(0, 5, "RTSP/") != 0) && sessionCookie.empty())
+	{
+		return;
+	}
+
+	size_t pos = url.find("://");
+	if (pos != std::string::npos)
+	{
+		pos = url.find('/', pos + 3);
+		url = (pos != std::string::npos) ? url.substr(pos) : "";
+	}
+	url = url.substr(0, url.find('?'));
+	pos = url.find_first_not_of('/');
+	path = (pos != std::string::npos) ? url.substr(pos) : "";
 }
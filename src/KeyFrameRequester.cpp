@@ -0,0 +1,56 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** KeyFrameRequester.cpp
+**
+** Keyframe requests to the encoder of a device
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+
+#include "KeyFrameRequester.h"
+
+KeyFrameRequester::KeyFrameRequester(DeviceInterface *device, unsigned int intervalMs)
+	: m_device(device), m_intervalMs(intervalMs), m_requested(false), m_lastRequest({0, 0}), m_supported(device != NULL), m_requests(0)
+{
+}
+
+bool KeyFrameRequester::request()
+{
+	bool requested = false;
+	if (m_supported && (m_intervalMs != 0))
+	{
+		requested = !m_requested.exchange(true);
+	}
+	return requested;
+}
+
+bool KeyFrameRequester::send(const timeval &tv)
+{
+	bool sent = false;
+	if (m_requested)
+	{
+		timeval diff;
+		timersub(&tv, &m_lastRequest, &diff);
+		if ((diff.tv_sec * 1000 + diff.tv_usec / 1000) >= (long)m_intervalMs)
+		{
+			m_requested = false;
+			m_lastRequest = tv;
+			errno = 0;
+			if (m_device->requestKeyFrame())
+			{
+				m_requests++;
+				sent = true;
+			}
+			else if ((errno == EINVAL) || (errno == ENOTTY) || (errno == 0))
+			{
+				// the control does not exist, EBUSY or EAGAIN are retried with the next request
+				m_supported = false;
+			}
+		}
+	}
+	return sent;
+}
@@ -7,103 +7,321 @@
 **
 ** -------------------------------------------------------------------------*/
 
+#include <math.h>
+#include <sys/time.h>
+
+#include <algorithm>
+
+#include "logger.h"
 #include "MemoryBufferSink.h"
 
 // -----------------------------------------
 //    MemoryBufferSink
 // -----------------------------------------
-MemoryBufferSink::MemoryBufferSink(UsageEnvironment &env, unsigned bufferSize, unsigned int sliceDuration, unsigned int nbSlices) : MediaSink(env), m_bufferSize(bufferSize), m_refTime(0), m_sliceDuration(sliceDuration), m_nbSlices(nbSlices)
+MemoryBufferSink::MemoryBufferSink(UsageEnvironment &env, unsigned chunkSize, unsigned int sliceDuration, unsigned int partDuration, unsigned int nbSlices)
+	: MediaSink(env), m_chunkUsed(0), m_sequence(0), m_version(0), m_started(false), m_sliceDuration(sliceDuration), m_partDuration(partDuration), m_nbSlices(nbSlices), m_maxDuration(sliceDuration), m_clockOffset(0),
+	  m_hasAccessUnit(false), m_accessUnitTime(0), m_accessUnitOffset(0), m_accessUnitKey(false)
 {
-	m_buffer = new unsigned char[m_bufferSize];
+	if (chunkSize < MEMORY_BUFFER_SINK_MIN_CHUNK_SIZE)
+	{
+		chunkSize = MEMORY_BUFFER_SINK_MIN_CHUNK_SIZE;
+	}
+	m_arena = SegmentArena::createNew(chunkSize);
 }
 
 MemoryBufferSink::~MemoryBufferSink()
 {
-	delete[] m_buffer;
+	// waiters forget this sink before looking for the stream again
+	this->notifyWaiters();
+}
+
+// ---------------------------------
+// segmentation on access units
+// ---------------------------------
+void MemoryBufferSink::onAccessUnit(const timeval &presentationTime, bool keyFrame)
+{
+	double time = presentationTime.tv_sec + presentationTime.tv_usec / 1000000.0;
+	Slice &slice = m_outputBuffers[m_sequence];
+
+	// the bytes of the previous access units are already in the slice
+	if (!m_hasAccessUnit || (time != m_accessUnitTime))
+	{
+		double interval = m_hasAccessUnit ? time - m_accessUnitTime : 0;
+		m_hasAccessUnit = true;
+		m_accessUnitTime = time;
+		m_accessUnitOffset = slice.m_size;
+		m_accessUnitKey = false;
+
+		// the part is closed before the next access unit makes it longer than the part target
+		if (m_started && (m_partDuration != 0) && ((time - slice.m_partStart + interval) * 1000 > m_partDuration) && (slice.m_size > slice.m_partOffset))
+		{
+			this->closePart(slice, m_accessUnitOffset, time);
+			this->notifyWaiters();
+		}
+	}
+
+	if (keyFrame && !m_accessUnitKey)
+	{
+		m_accessUnitKey = true;
+		if (!m_started || (time - slice.m_start >= m_sliceDuration))
+		{
+			this->cutSlice(time, m_accessUnitOffset);
+		}
+		else if (slice.m_partOffset == m_accessUnitOffset)
+		{
+			slice.m_partIndependent = true;
+		}
+	}
+}
+
+void MemoryBufferSink::closePart(Slice &slice, size_t offset, double time)
+{
+	Part part;
+	part.m_offset = slice.m_partOffset;
+	part.m_size = offset - slice.m_partOffset;
+	part.m_duration = time - slice.m_partStart;
+	part.m_independent = slice.m_partIndependent;
+	slice.m_parts.push_back(part);
+
+	slice.m_partOffset = offset;
+	slice.m_partStart = time;
+	slice.m_partIndependent = false;
+	m_version++;
 }
 
-Boolean MemoryBufferSink::continuePlaying()
+// bytes after offset start a new slice
+void MemoryBufferSink::cutSlice(double time, size_t offset)
 {
-	Boolean ret = False;
-	if (fSource != NULL)
+	Slice tail;
+	Slice &slice = m_outputBuffers[m_sequence];
+	this->splitSlice(slice, offset, tail);
+
+	// a segment is decoded on its own only when it starts with the program tables
+	size_t tablesSize = 0;
+	std::shared_ptr<SegmentArena::Chunk> tables = this->createSegmentTables();
+	if (tables)
+	{
+		MemorySegment::Span span = {tables, 0, tables->capacity()};
+		tail.m_spans.insert(tail.m_spans.begin(), span);
+		tail.m_size += span.m_size;
+		tablesSize = span.m_size;
+	}
+	tail.m_start = time;
+	tail.m_partStart = time;
+	tail.m_partIndependent = true;
+	m_accessUnitOffset = tablesSize;
+
+	if (m_started)
+	{
+		if (slice.m_size > slice.m_partOffset)
+		{
+			this->closePart(slice, slice.m_size, time);
+		}
+		slice.m_duration = time - slice.m_start;
+		slice.m_complete = true;
+		slice.m_segment.reset();
+		m_maxDuration = std::max(m_maxDuration, slice.m_duration);
+		LOG(DEBUG) << "segment:" << m_sequence << " duration:" << slice.m_duration << " size:" << slice.m_size << " parts:" << slice.m_parts.size();
+		m_sequence++;
+	}
+	else
+	{
+		// what was received before the first keyframe cannot be decoded
+		m_outputBuffers.erase(m_sequence);
+		m_started = true;
+
+		timeval now;
+		gettimeofday(&now, NULL);
+		m_clockOffset = now.tv_sec + now.tv_usec / 1000000.0 - time;
+	}
+	m_outputBuffers[m_sequence] = tail;
+
+	// remove old buffers, chunks are recycled once the segments being sent are released
+	while (m_outputBuffers.size() > m_nbSlices + 1)
 	{
-		fSource->getNextFrame(m_buffer, m_bufferSize,
-							  afterGettingFrame, this,
-							  onSourceClosure, this);
-		ret = True;
+		m_outputBuffers.erase(m_outputBuffers.begin());
 	}
-	return ret;
+	m_version++;
+	this->notifyWaiters();
 }
 
-void MemoryBufferSink::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime)
+// contiguous bytes of a chunk stay in one span
+void MemoryBufferSink::appendSpan(Slice &slice, const MemorySegment::Span &span)
 {
-	if (numTruncatedBytes > 0)
+	if (!slice.m_spans.empty() && (slice.m_spans.back().m_chunk == span.m_chunk) && (slice.m_spans.back().m_offset + slice.m_spans.back().m_size == span.m_offset))
 	{
-		envir() << "FileSink::afterGettingFrame(): The input frame data was too large for our buffer size \n";
-		// realloc a bigger buffer
-		m_bufferSize += numTruncatedBytes;
-		delete[] m_buffer;
-		m_buffer = new unsigned char[m_bufferSize];
+		slice.m_spans.back().m_size += span.m_size;
 	}
 	else
 	{
-		// append buffer to slice buffer
-		if (m_refTime == 0)
+		slice.m_spans.push_back(span);
+	}
+	slice.m_size += span.m_size;
+	slice.m_segment.reset();
+}
+
+// bytes after offset move to the tail, spans are split without copy
+void MemoryBufferSink::splitSlice(Slice &slice, size_t offset, Slice &tail)
+{
+	std::vector<MemorySegment::Span> head;
+	size_t position = 0;
+	for (const MemorySegment::Span &span : slice.m_spans)
+	{
+		if (position + span.m_size <= offset)
+		{
+			head.push_back(span);
+		}
+		else if (position >= offset)
+		{
+			tail.m_spans.push_back(span);
+		}
+		else
 		{
-			m_refTime = presentationTime.tv_sec;
+			size_t headSize = offset - position;
+			MemorySegment::Span first = {span.m_chunk, span.m_offset, headSize};
+			MemorySegment::Span second = {span.m_chunk, span.m_offset + headSize, span.m_size - headSize};
+			head.push_back(first);
+			tail.m_spans.push_back(second);
 		}
-		unsigned int slice = (presentationTime.tv_sec - m_refTime) / m_sliceDuration;
-		std::string &outputBuffer = m_outputBuffers[slice];
-		outputBuffer.append((const char *)m_buffer, frameSize);
+		position += span.m_size;
+	}
+	tail.m_size = slice.m_size - offset;
+	slice.m_spans.swap(head);
+	slice.m_size = offset;
+	slice.m_segment.reset();
+}
 
-		// remove old buffers
-		while (m_outputBuffers.size() > m_nbSlices)
+// ---------------------------------
+// access to the segments
+// ---------------------------------
+std::shared_ptr<const MemorySegment> MemoryBufferSink::createSegment(const Slice &slice, size_t offset, size_t size)
+{
+	std::vector<MemorySegment::Span> spans;
+	size_t position = 0;
+	for (const MemorySegment::Span &span : slice.m_spans)
+	{
+		size_t begin = std::max(position, offset);
+		size_t end = std::min(position + span.m_size, offset + size);
+		if (begin < end)
 		{
-			m_outputBuffers.erase(m_outputBuffers.begin());
+			MemorySegment::Span part = {span.m_chunk, span.m_offset + (begin - position), end - begin};
+			spans.push_back(part);
 		}
+		position += span.m_size;
 	}
+	return std::shared_ptr<const MemorySegment>(new MemorySegment(spans, size));
+}
 
-	continuePlaying();
+std::shared_ptr<const MemorySegment> MemoryBufferSink::getSegment(unsigned int sequence)
+{
+	std::shared_ptr<const MemorySegment> segment;
+	std::map<unsigned int, Slice>::iterator it = m_outputBuffers.find(sequence);
+	if ((it != m_outputBuffers.end()) && it->second.m_complete)
+	{
+		Slice &outputBuffer = it->second;
+		if (!outputBuffer.m_segment)
+		{
+			outputBuffer.m_segment.reset(new MemorySegment(outputBuffer.m_spans, outputBuffer.m_size));
+		}
+		segment = outputBuffer.m_segment;
+	}
+	return segment;
 }
 
-unsigned int MemoryBufferSink::getBufferSize(unsigned int slice)
+std::shared_ptr<const MemorySegment> MemoryBufferSink::getPart(unsigned int sequence, unsigned int partIndex)
 {
-	unsigned int size = 0;
-	std::map<unsigned int, std::string>::iterator it = m_outputBuffers.find(slice);
-	if (it != m_outputBuffers.end())
+	std::shared_ptr<const MemorySegment> segment;
+	std::map<unsigned int, Slice>::iterator it = m_outputBuffers.find(sequence);
+	if ((it != m_outputBuffers.end()) && (partIndex < it->second.m_parts.size()))
+	{
+		Part &part = it->second.m_parts[partIndex];
+		if (!part.m_segment)
+		{
+			part.m_segment = this->createSegment(it->second, part.m_offset, part.m_size);
+		}
+		segment = part.m_segment;
+	}
+	return segment;
+}
+
+std::vector<MemoryBufferSink::SegmentInfo> MemoryBufferSink::getSegmentList()
+{
+	std::vector<SegmentInfo> segments;
+	if (m_started)
 	{
-		size = it->second.size();
+		for (std::map<unsigned int, Slice>::iterator it = m_outputBuffers.begin(); it != m_outputBuffers.end(); ++it)
+		{
+			SegmentInfo info;
+			info.m_sequence = it->first;
+			info.m_start = it->second.m_start;
+			info.m_duration = it->second.m_duration;
+			info.m_size = it->second.m_size;
+			info.m_complete = it->second.m_complete;
+			for (const Part &part : it->second.m_parts)
+			{
+				info.m_parts.push_back(part);
+			}
+			segments.push_back(info);
+		}
 	}
-	return size;
+	return segments;
 }
 
-std::string MemoryBufferSink::getBuffer(unsigned int slice)
+unsigned int MemoryBufferSink::getCurrentParts()
 {
-	std::string content;
-	std::map<unsigned int, std::string>::iterator it = m_outputBuffers.find(slice);
+	unsigned int parts = 0;
+	std::map<unsigned int, Slice>::iterator it = m_outputBuffers.find(m_sequence);
 	if (it != m_outputBuffers.end())
 	{
-		content = it->second;
+		parts = it->second.m_parts.size();
+	}
+	return parts;
+}
+
+unsigned int MemoryBufferSink::getTargetDuration()
+{
+	return (unsigned int)ceil(m_maxDuration);
+}
+
+double MemoryBufferSink::firstTime()
+{
+	double firstTime = 0;
+	if (m_started && (m_outputBuffers.size() != 0))
+	{
+		firstTime = m_outputBuffers.begin()->second.m_start;
 	}
-	return content;
+	return firstTime;
 }
 
-unsigned int MemoryBufferSink::firstTime()
+double MemoryBufferSink::duration()
 {
-	unsigned int firstTime = 0;
-	if (m_outputBuffers.size() != 0)
+	double duration = 0;
+	for (std::map<unsigned int, Slice>::iterator it = m_outputBuffers.begin(); it != m_outputBuffers.end(); ++it)
 	{
-		firstTime = m_outputBuffers.begin()->first;
+		duration += it->second.m_duration;
 	}
-	return firstTime * m_sliceDuration;
+	return duration;
+}
+
+// ---------------------------------
+// requests waiting for a part or a segment
+// ---------------------------------
+void MemoryBufferSink::addWaiter(TaskFunc *func, void *clientData)
+{
+	m_waiters.push_back(std::make_pair(func, clientData));
+}
+
+void MemoryBufferSink::removeWaiter(void *clientData)
+{
+	m_waiters.remove_if([clientData](const std::pair<TaskFunc *, void *> &waiter) { return waiter.second == clientData; });
 }
 
-unsigned int MemoryBufferSink::duration()
+void MemoryBufferSink::notifyWaiters()
 {
-	unsigned int duration = 0;
-	if (m_outputBuffers.size() != 0)
+	std::list<std::pair<TaskFunc *, void *>> waiters;
+	waiters.swap(m_waiters);
+	for (const std::pair<TaskFunc *, void *> &waiter : waiters)
 	{
-		duration = m_outputBuffers.rbegin()->first - m_outputBuffers.begin()->first;
+		(*waiter.first)(waiter.second);
 	}
-	return (duration)*m_sliceDuration;
 }
@@ -0,0 +1,66 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** MemorySegment.cpp
+**
+** Immutable HLS/DASH segment referencing chunks of an arena
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include "MemorySegment.h"
+
+SegmentArena::~SegmentArena()
+{
+	for (Chunk *chunk : m_freeList)
+	{
+		delete chunk;
+	}
+}
+
+std::shared_ptr<SegmentArena::Chunk> SegmentArena::acquire()
+{
+	Chunk *chunk = NULL;
+	{
+		std::lock_guard<std::mutex> lock(m_mutex);
+		if (!m_freeList.empty())
+		{
+			chunk = m_freeList.back();
+			m_freeList.pop_back();
+		}
+	}
+	if (chunk == NULL)
+	{
+		chunk = new Chunk(m_chunkSize);
+	}
+
+	// the chunk could be released after the arena
+	std::weak_ptr<SegmentArena> arena(shared_from_this());
+	return std::shared_ptr<Chunk>(chunk, [arena](Chunk *chunk) { SegmentArena::release(arena, chunk); });
+}
+
+void SegmentArena::release(const std::weak_ptr<SegmentArena> &weakArena, Chunk *chunk)
+{
+	std::shared_ptr<SegmentArena> arena = weakArena.lock();
+	if (arena)
+	{
+		std::lock_guard<std::mutex> lock(arena->m_mutex);
+		if (arena->m_freeList.size() < arena->m_maxFreeChunks)
+		{
+			arena->m_freeList.push_back(chunk);
+			chunk = NULL;
+		}
+	}
+	delete chunk;
+}
+
+MemorySegment::MemorySegment(const std::string &content) : m_size(content.size())
+{
+	std::shared_ptr<SegmentArena::Chunk> chunk = std::make_shared<SegmentArena::Chunk>(content.size());
+	memcpy(chunk->data(), content.c_str(), content.size());
+	Span span = {chunk, 0, content.size()};
+	m_spans.push_back(span);
+}
@@ -12,26 +12,26 @@
 // -----------------------------------------
 //    ServerMediaSubsession for Multicast
 // -----------------------------------------
-MulticastServerMediaSubsession *MulticastServerMediaSubsession::createNew(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, StreamReplicator *replicator)
+MulticastServerMediaSubsession *MulticastServerMediaSubsession::createNew(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, FrameReplicator *replicator, bool alwaysOn, const RtpSendOptions &rtpSendOptions)
 {
-	return new MulticastServerMediaSubsession(env, destinationAddress, rtpPortNum, rtcpPortNum, ttl, replicator);
+	return new MulticastServerMediaSubsession(env, destinationAddress, rtpPortNum, rtcpPortNum, ttl, replicator, alwaysOn, rtpSendOptions);
 }
 
-RTPSink *MulticastServerMediaSubsession::createRtpSink(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, StreamReplicator *replicator)
+RTPSink *MulticastServerMediaSubsession::createRtpSink(UsageEnvironment &env, struct in_addr destinationAddress, Port rtpPortNum, Port rtcpPortNum, int ttl, FrameReplicator *replicator, bool alwaysOn, const RtpSendOptions &rtpSendOptions)
 {
-	// Create a source
-	FramedSource *source = replicator->createStreamReplica();
-	FramedSource *videoSource = createSource(env, source, m_format);
+	m_videoSource = NULL;
+	m_alwaysOn = alwaysOn;
 
 	// Create RTP/RTCP groupsock
 #if LIVEMEDIA_LIBRARY_VERSION_INT < 1607644800
 	struct in_addr groupAddress = destinationAddress;
+	Groupsock *rtpGroupsock = new Groupsock(env, groupAddress, rtpPortNum, ttl);
 #else
 	struct sockaddr_storage groupAddress;
 	groupAddress.ss_family = AF_INET;
 	((struct sockaddr_in &)groupAddress).sin_addr = destinationAddress;
+	Groupsock *rtpGroupsock = BatchGroupsock::createNew(env, groupAddress, rtpPortNum, ttl, rtpSendOptions);
 #endif
-	Groupsock *rtpGroupsock = new Groupsock(env, groupAddress, rtpPortNum, ttl);
 
 	// Create a RTP sink
 	m_rtpSink = createSink(env, rtpGroupsock, 96, m_format, dynamic_cast<V4L2DeviceSource *>(replicator->inputSource()));
@@ -41,13 +41,43 @@ RTPSink *MulticastServerMediaSubsession::createRtpSink(UsageEnvironment &env, st
 	unsigned char CNAME[maxCNAMElen + 1];
 	gethostname((char *)CNAME, maxCNAMElen);
 	CNAME[maxCNAMElen] = '\0';
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1607644800
 	Groupsock *rtcpGroupsock = new Groupsock(env, groupAddress, rtcpPortNum, ttl);
+#else
+	// receivers of the group send their PLI/FIR to the RTCP group
+	RTCPFeedbackGroupsock *rtcpGroupsock = new RTCPFeedbackGroupsock(env, groupAddress, rtcpPortNum, ttl);
+	rtcpGroupsock->setKeyFrameRequestHandler(BaseServerMediaSubsession::rtcpKeyFrameRequest, static_cast<BaseServerMediaSubsession *>(this));
+#endif
 	m_rtcpInstance = RTCPInstance::createNew(env, rtcpGroupsock, 500, CNAME, m_rtpSink, NULL);
 
+	if (m_alwaysOn)
+	{
+		this->startSending(env);
+	}
+	return m_rtpSink;
+}
+
+// ---------------------------------
+// the group receives packets only while RTSP clients play the session
+// ---------------------------------
+void MulticastServerMediaSubsession::startSending(UsageEnvironment &env)
+{
+	// Create a source
+	FramedSource *source = m_replicator->createStreamReplica();
+	m_videoSource = createSource(env, source, m_format);
+
 	// Start Playing the Sink
-	m_rtpSink->startPlaying(*videoSource, NULL, NULL);
+	m_rtpSink->startPlaying(*m_videoSource, NULL, NULL);
+	LOG(NOTICE) << "Start multicast sending format:" << m_format;
+}
 
-	return m_rtpSink;
+void MulticastServerMediaSubsession::stopSending()
+{
+	LOG(NOTICE) << "Stop multicast sending format:" << m_format;
+	m_rtpSink->stopPlaying();
+	// closing the framer closes the replica
+	Medium::close(m_videoSource);
+	m_videoSource = NULL;
 }
 
 #if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
@@ -58,6 +88,17 @@ char const *MulticastServerMediaSubsession::sdpLines()
 char const *MulticastServerMediaSubsession::sdpLines(int addressFamily)
 {
 #endif
+	// parameter sets changed since the SDP was cached
+	unsigned int version = this->getAuxLineVersion();
+	if (m_SDPLinesVersion != version)
+	{
+		if (!m_SDPLines.empty())
+		{
+			LOG(NOTICE) << "Refresh SDP of " << this->trackId() << " version:" << version;
+		}
+		m_SDPLines.clear();
+		m_SDPLinesVersion = version;
+	}
 	if (m_SDPLines[addressFamily].empty())
 	{
 		// Ugly workaround to give SPS/PPS that are get from the RTPSink
@@ -71,6 +112,27 @@ char const *MulticastServerMediaSubsession::sdpLines(int addressFamily)
 	return m_SDPLines[addressFamily].c_str();
 }
 
+void MulticastServerMediaSubsession::startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData)
+{
+	m_clientSessions.insert(clientSessionId);
+	if (m_videoSource == NULL)
+	{
+		this->startSending(envir());
+	}
+	this->requestKeyFrame("play");
+	PassiveServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp, serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
+}
+
+void MulticastServerMediaSubsession::deleteStream(unsigned clientSessionId, void *&streamToken)
+{
+	PassiveServerMediaSubsession::deleteStream(clientSessionId, streamToken);
+	m_clientSessions.erase(clientSessionId);
+	if (m_clientSessions.empty() && !m_alwaysOn && (m_videoSource != NULL))
+	{
+		this->stopSending();
+	}
+}
+
 char const *MulticastServerMediaSubsession::getAuxSDPLine(RTPSink *rtpSink, FramedSource *inputSource)
 {
 	return this->getAuxLine(dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource()), rtpSink);
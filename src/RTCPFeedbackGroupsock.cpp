@@ -0,0 +1,50 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** RTCPFeedbackGroupsock.cpp
+**
+** Groupsock that reports the keyframe requests (RTCP PLI/FIR) of the clients
+**
+** -------------------------------------------------------------------------*/
+
+#include "logger.h"
+#include "RTCPFeedbackGroupsock.h"
+
+// RFC 4585 payload specific feedback, RFC 5104 full intra request
+#define RTCP_PT_PSFB 206
+#define RTCP_PSFB_PLI 1
+#define RTCP_PSFB_FIR 4
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800
+
+bool RTCPFeedbackGroupsock::isKeyFrameRequest(const unsigned char *buffer, unsigned size)
+{
+	bool keyFrameRequest = false;
+	unsigned offset = 0;
+	while (!keyFrameRequest && (offset + 4 <= size))
+	{
+		const unsigned char *header = buffer + offset;
+		if ((header[0] >> 6) != 2)
+		{
+			break;
+		}
+		unsigned char format = header[0] & 0x1f;
+		keyFrameRequest = (header[1] == RTCP_PT_PSFB) && ((format == RTCP_PSFB_PLI) || (format == RTCP_PSFB_FIR));
+		offset += (((header[2] << 8) | header[3]) + 1) * 4;
+	}
+	return keyFrameRequest;
+}
+
+Boolean RTCPFeedbackGroupsock::handleRead(unsigned char *buffer, unsigned bufferMaxSize, unsigned &bytesRead, struct sockaddr_storage &fromAddressAndPort)
+{
+	Boolean result = Groupsock::handleRead(buffer, bufferMaxSize, bytesRead, fromAddressAndPort);
+	if (result && (m_handler != NULL) && isKeyFrameRequest(buffer, bytesRead))
+	{
+		LOG(DEBUG) << "RTCP keyframe request socket:" << this->socketNum();
+		m_handler(m_handlerClientData);
+	}
+	return result;
+}
+#endif
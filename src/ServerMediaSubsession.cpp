@@ -14,6 +14,8 @@
 #include "BaseServerMediaSubsession.h"
 #include "MJPEGVideoSource.h"
 
+unsigned int BaseServerMediaSubsession::m_rtpPacketSize = 0;
+
 // ---------------------------------
 //   BaseServerMediaSubsession
 // ---------------------------------
@@ -125,6 +127,12 @@ RTPSink *BaseServerMediaSubsession::createSink(UsageEnvironment &env, Groupsock
 	{
 		videoSink = MPEG1or2AudioRTPSink::createNew(env, rtpGroupsock);
 	}
+
+	MultiFramedRTPSink *multiFramedSink = dynamic_cast<MultiFramedRTPSink *>(videoSink);
+	if ((multiFramedSink != NULL) && (m_rtpPacketSize != 0))
+	{
+		multiFramedSink->setPacketSizes(m_rtpPacketSize, m_rtpPacketSize);
+	}
 	return videoSink;
 }
 
@@ -133,24 +141,35 @@ char const *BaseServerMediaSubsession::getAuxLine(V4L2DeviceSource *source, RTPS
 	const char *auxLine = NULL;
 	if (rtpSink)
 	{
-		std::ostringstream os;
 		if (rtpSink->auxSDPLine())
 		{
-			os << rtpSink->auxSDPLine();
+			auxLine = rtpSink->auxSDPLine();
 		}
 		else if (source)
 		{
-			unsigned char rtpPayloadType = rtpSink->rtpPayloadType();
-			DeviceInterface *device = source->getDevice();
-			os << "a=fmtp:" << int(rtpPayloadType) << " " << source->getAuxLine() << "\r\n";
-			int width = device->getWidth();
-			int height = device->getHeight();
-			if ((width > 0) && (height > 0))
+			unsigned int version = source->getAuxLineVersion();
+			int rtpPayloadType = rtpSink->rtpPayloadType();
+			if ((m_auxSDPLinePayloadType != rtpPayloadType) || (m_auxSDPLineVersion != version))
 			{
-				os << "a=x-dimensions:" << width << "," << height << "\r\n";
+				DeviceInterface *device = source->getDevice();
+				std::ostringstream os;
+				os << "a=fmtp:" << rtpPayloadType << " " << source->getAuxLine() << "\r\n";
+				int width = device->getWidth();
+				int height = device->getHeight();
+				if ((width > 0) && (height > 0))
+				{
+					os << "a=x-dimensions:" << width << "," << height << "\r\n";
+				}
+				m_auxSDPLine.assign(os.str());
+				m_auxSDPLineVersion = version;
+				m_auxSDPLinePayloadType = rtpPayloadType;
 			}
+			auxLine = m_auxSDPLine.c_str();
+		}
+		else
+		{
+			auxLine = "";
 		}
-		auxLine = strdup(os.str().c_str());
 	}
 	return auxLine;
 }
@@ -0,0 +1,227 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** StartCodeScanner.cpp
+**
+** Annex-B start code scanner
+**
+** -------------------------------------------------------------------------*/
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#define HAVE_X86_SIMD
+#elif defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include <string.h>
+
+#include "StartCodeScanner.h"
+
+// ---------------------------------
+// scalar implementation
+// ---------------------------------
+static size_t findStartCodeScalar(const unsigned char *buffer, size_t size, size_t pos)
+{
+	while (pos + 3 <= size)
+	{
+		if (buffer[pos + 2] > 1)
+		{
+			// no start code can begin at pos, pos+1 or pos+2
+			pos += 3;
+		}
+		else if ((buffer[pos] == 0) && (buffer[pos + 1] == 0) && (buffer[pos + 2] == 1))
+		{
+			return pos;
+		}
+		else
+		{
+			pos++;
+		}
+	}
+	return size;
+}
+
+#ifdef HAVE_X86_SIMD
+// ---------------------------------
+// SSE2 implementation
+// ---------------------------------
+__attribute__((target("sse2"))) static size_t findStartCodeSSE2(const unsigned char *buffer, size_t size, size_t pos)
+{
+	const __m128i zero = _mm_setzero_si128();
+	const __m128i one = _mm_set1_epi8(1);
+	while (pos + 16 + 2 <= size)
+	{
+		__m128i b0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[pos]), zero);
+		__m128i b1 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[pos + 1]), zero);
+		__m128i b2 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *)&buffer[pos + 2]), one);
+		int mask = _mm_movemask_epi8(_mm_and_si128(_mm_and_si128(b0, b1), b2));
+		if (mask != 0)
+		{
+			return pos + __builtin_ctz(mask);
+		}
+		pos += 16;
+	}
+	return findStartCodeScalar(buffer, size, pos);
+}
+
+// ---------------------------------
+// AVX2 implementation
+// ---------------------------------
+__attribute__((target("avx2"))) static size_t findStartCodeAVX2(const unsigned char *buffer, size_t size, size_t pos)
+{
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i one = _mm256_set1_epi8(1);
+	while (pos + 32 + 2 <= size)
+	{
+		__m256i b0 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[pos]), zero);
+		__m256i b1 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[pos + 1]), zero);
+		__m256i b2 = _mm256_cmpeq_epi8(_mm256_loadu_si256((const __m256i *)&buffer[pos + 2]), one);
+		unsigned int mask = _mm256_movemask_epi8(_mm256_and_si256(_mm256_and_si256(b0, b1), b2));
+		if (mask != 0)
+		{
+			return pos + __builtin_ctz(mask);
+		}
+		pos += 32;
+	}
+	return findStartCodeSSE2(buffer, size, pos);
+}
+#endif
+
+#ifdef __ARM_NEON
+// ---------------------------------
+// NEON implementation
+// ---------------------------------
+static size_t findStartCodeNEON(const unsigned char *buffer, size_t size, size_t pos)
+{
+	const uint8x16_t zero = vdupq_n_u8(0);
+	const uint8x16_t one = vdupq_n_u8(1);
+	while (pos + 16 + 2 <= size)
+	{
+		uint8x16_t b0 = vceqq_u8(vld1q_u8(&buffer[pos]), zero);
+		uint8x16_t b1 = vceqq_u8(vld1q_u8(&buffer[pos + 1]), zero);
+		uint8x16_t b2 = vceqq_u8(vld1q_u8(&buffer[pos + 2]), one);
+		uint64x2_t mask = vreinterpretq_u64_u8(vandq_u8(vandq_u8(b0, b1), b2));
+		if ((vgetq_lane_u64(mask, 0) | vgetq_lane_u64(mask, 1)) != 0)
+		{
+			// locate the match inside this block
+			return findStartCodeScalar(buffer, pos + 16 + 2, pos);
+		}
+		pos += 16;
+	}
+	return findStartCodeScalar(buffer, size, pos);
+}
+#endif
+
+// ---------------------------------
+// runtime selection
+// ---------------------------------
+StartCodeScanner::FindFunction StartCodeScanner::m_find = StartCodeScanner::selectImplementation();
+
+StartCodeScanner::FindFunction StartCodeScanner::selectImplementation()
+{
+	FindFunction find = findStartCodeScalar;
+#if defined(HAVE_X86_SIMD)
+	__builtin_cpu_init();
+	if (__builtin_cpu_supports("avx2"))
+	{
+		find = findStartCodeAVX2;
+	}
+	else if (__builtin_cpu_supports("sse2"))
+	{
+		find = findStartCodeSSE2;
+	}
+#elif defined(__ARM_NEON)
+	find = findStartCodeNEON;
+#endif
+	return find;
+}
+
+const char *StartCodeScanner::getImplementation()
+{
+	const char *name = "scalar";
+#if defined(HAVE_X86_SIMD)
+	if (m_find == findStartCodeAVX2)
+	{
+		name = "avx2";
+	}
+	else if (m_find == findStartCodeSSE2)
+	{
+		name = "sse2";
+	}
+#elif defined(__ARM_NEON)
+	name = "neon";
+#endif
+	return name;
+}
+
+bool StartCodeScanner::setImplementation(const char *name)
+{
+	FindFunction find = NULL;
+	if (strcmp(name, "scalar") == 0)
+	{
+		find = findStartCodeScalar;
+	}
+#if defined(HAVE_X86_SIMD)
+	else if ((strcmp(name, "avx2") == 0) && __builtin_cpu_supports("avx2"))
+	{
+		find = findStartCodeAVX2;
+	}
+	else if ((strcmp(name, "sse2") == 0) && __builtin_cpu_supports("sse2"))
+	{
+		find = findStartCodeSSE2;
+	}
+#elif defined(__ARM_NEON)
+	else if (strcmp(name, "neon") == 0)
+	{
+		find = findStartCodeNEON;
+	}
+#endif
+	if (find != NULL)
+	{
+		m_find = find;
+	}
+	return (find != NULL);
+}
+
+// ---------------------------------
+// split a buffer in NAL units
+// ---------------------------------
+const std::vector<StartCodeScanner::NalUnit> &StartCodeScanner::scan(unsigned char *buffer, size_t size)
+{
+	m_nalList.clear();
+
+	size_t pos = m_find(buffer, size, 0);
+	while (pos < size)
+	{
+		NalUnit nal;
+		nal.m_marker = &buffer[pos];
+		nal.m_markerLength = 3;
+		if ((pos > 0) && (buffer[pos - 1] == 0))
+		{
+			nal.m_marker--;
+			nal.m_markerLength = 4;
+		}
+
+		size_t start = pos + 3;
+		size_t next = m_find(buffer, size, start);
+		size_t end = next;
+		if ((next < size) && (next > start) && (buffer[next - 1] == 0))
+		{
+			// the leading zero of a 4 bytes start code belongs to the next NAL
+			end--;
+		}
+
+		if (end > start)
+		{
+			nal.m_data = &buffer[start];
+			nal.m_size = end - start;
+			nal.m_type = buffer[start];
+			m_nalList.push_back(nal);
+		}
+		pos = next;
+	}
+	return m_nalList;
+}
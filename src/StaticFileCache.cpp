@@ -0,0 +1,369 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** StaticFileCache.cpp
+**
+** Files of the webroot held in memory with their precompressed variants
+**
+** -------------------------------------------------------------------------*/
+
+#include <dirent.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <fstream>
+#include <functional>
+#include <sstream>
+
+#ifdef HAVE_ZLIB
+#include <zlib.h>
+#endif
+#ifdef HAVE_BROTLI
+#include <brotli/encode.h>
+#endif
+
+#include "logger.h"
+#include "StaticFileCache.h"
+
+// ---------------------------------
+// compression, the variant is kept only when it is smaller
+// ---------------------------------
+static std::string gzipCompress(const std::string &content)
+{
+	std::string compressed;
+#ifdef HAVE_ZLIB
+	z_stream stream;
+	memset(&stream, 0, sizeof(stream));
+	// 16 + MAX_WBITS writes a gzip header
+	if (deflateInit2(&stream, STATIC_CACHE_GZIP_LEVEL, Z_DEFLATED, 16 + MAX_WBITS, 9, Z_DEFAULT_STRATEGY) == Z_OK)
+	{
+		compressed.resize(deflateBound(&stream, content.size()));
+		stream.next_in = (Bytef *)content.c_str();
+		stream.avail_in = content.size();
+		stream.next_out = (Bytef *)&compressed[0];
+		stream.avail_out = compressed.size();
+		if (deflate(&stream, Z_FINISH) == Z_STREAM_END)
+		{
+			compressed.resize(stream.total_out);
+		}
+		else
+		{
+			compressed.clear();
+		}
+		deflateEnd(&stream);
+	}
+#endif
+	return compressed;
+}
+
+static std::string brotliCompress(const std::string &content)
+{
+	std::string compressed;
+#ifdef HAVE_BROTLI
+	size_t size = BrotliEncoderMaxCompressedSize(content.size());
+	if (size != 0)
+	{
+		compressed.resize(size);
+		if (BrotliEncoderCompress(STATIC_CACHE_BROTLI_QUALITY, BROTLI_DEFAULT_WINDOW, BROTLI_MODE_TEXT, content.size(), (const uint8_t *)content.c_str(), &size, (uint8_t *)&compressed[0]))
+		{
+			compressed.resize(size);
+		}
+		else
+		{
+			compressed.clear();
+		}
+	}
+#endif
+	return compressed;
+}
+
+static bool isCompressible(const std::string &mime)
+{
+	return (mime.compare(0, 5, "text/") == 0) || (mime.find("javascript") != std::string::npos) || (mime.find("json") != std::string::npos) || (mime.find("xml") != std::string::npos) || (mime.find("mpegurl") != std::string::npos);
+}
+
+// ---------------------------------
+// load of the webroot
+// ---------------------------------
+StaticFileCache::StaticFileCache(UsageEnvironment &env, const std::string &webroot)
+	: m_env(env), m_webroot(webroot), m_files(new std::map<std::string, std::shared_ptr<const File>>()), m_inotifyFd(-1), m_reloadTask(NULL)
+{
+	if ((!m_webroot.empty()) && (m_webroot.back() != '/'))
+	{
+		m_webroot += "/";
+	}
+
+	m_inotifyFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if (m_inotifyFd < 0)
+	{
+		LOG(WARN) << "inotify not available, webroot changes are ignored:" << strerror(errno);
+	}
+	else
+	{
+		m_env.taskScheduler().setBackgroundHandling(m_inotifyFd, SOCKET_READABLE, inotifyHandler, this);
+	}
+	this->load();
+}
+
+StaticFileCache::~StaticFileCache()
+{
+	m_env.taskScheduler().unscheduleDelayedTask(m_reloadTask);
+	if (m_inotifyFd >= 0)
+	{
+		m_env.taskScheduler().disableBackgroundHandling(m_inotifyFd);
+		::close(m_inotifyFd);
+	}
+}
+
+void StaticFileCache::load()
+{
+	// directories are watched again, some could be added or removed
+	for (int watch : m_watches)
+	{
+		inotify_rm_watch(m_inotifyFd, watch);
+	}
+	m_watches.clear();
+
+	std::map<std::string, std::shared_ptr<const File>> *files = new std::map<std::string, std::shared_ptr<const File>>();
+	size_t totalSize = 0;
+	this->loadDirectory(m_webroot, "", 0, totalSize, *m_files, *files);
+	m_files.reset(files);
+	LOG(NOTICE) << "webroot:" << m_webroot << " files:" << files->size() << " size:" << totalSize;
+}
+
+void StaticFileCache::loadDirectory(const std::string &directory, const std::string &prefix, unsigned int depth, size_t &totalSize, const std::map<std::string, std::shared_ptr<const File>> &previousFiles, std::map<std::string, std::shared_ptr<const File>> &files)
+{
+	if (m_inotifyFd >= 0)
+	{
+		int watch = inotify_add_watch(m_inotifyFd, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_CREATE | IN_DELETE);
+		if (watch >= 0)
+		{
+			m_watches.push_back(watch);
+		}
+	}
+
+	DIR *dir = opendir(directory.c_str());
+	if (dir == NULL)
+	{
+		LOG(WARN) << "cannot open webroot:" << directory << " " << strerror(errno);
+		return;
+	}
+	struct dirent *entry = NULL;
+	while ((entry = readdir(dir)) != NULL)
+	{
+		// hidden files and parent directories are never served
+		if (entry->d_name[0] == '.')
+		{
+			continue;
+		}
+		std::string path(directory + entry->d_name);
+		struct stat info;
+		if (stat(path.c_str(), &info) != 0)
+		{
+			continue;
+		}
+		if (S_ISDIR(info.st_mode))
+		{
+			if (depth + 1 < STATIC_CACHE_MAX_DEPTH)
+			{
+				this->loadDirectory(path + "/", prefix + entry->d_name + "/", depth + 1, totalSize, previousFiles, files);
+			}
+		}
+		else if (S_ISREG(info.st_mode))
+		{
+			if (totalSize + info.st_size > STATIC_CACHE_MAX_SIZE)
+			{
+				LOG(WARN) << "webroot cache full, ignore:" << path;
+				continue;
+			}
+			// an unchanged file keeps its content and its compressed variants
+			std::shared_ptr<const File> file;
+			std::map<std::string, std::shared_ptr<const File>>::const_iterator it = previousFiles.find(prefix + entry->d_name);
+			if ((it != previousFiles.end()) && (it->second->m_lastModified == info.st_mtime) && (it->second->m_content[ENCODING_IDENTITY]->size() == (size_t)info.st_size))
+			{
+				file = it->second;
+			}
+			else
+			{
+				file = this->loadFile(path, entry->d_name, info.st_mtime);
+			}
+			if (file)
+			{
+				totalSize += file->m_content[ENCODING_IDENTITY]->size();
+				files[prefix + entry->d_name] = file;
+			}
+		}
+	}
+	closedir(dir);
+}
+
+std::shared_ptr<const StaticFileCache::File> StaticFileCache::loadFile(const std::string &path, const std::string &name, time_t lastModified)
+{
+	std::shared_ptr<File> file;
+	std::ifstream is(path.c_str(), std::ios::binary);
+	if (is.is_open())
+	{
+		std::string content((std::istreambuf_iterator<char>(is)), std::istreambuf_iterator<char>());
+		file.reset(new File());
+		file->m_mime = getMimeType(name);
+		file->m_lastModified = lastModified;
+		std::ostringstream etag;
+		etag << std::hex << std::hash<std::string>()(content) << "-" << lastModified;
+		file->m_etag = etag.str();
+		file->m_content[ENCODING_IDENTITY].reset(new MemorySegment(content));
+
+		if (isCompressible(file->m_mime) && (content.size() >= STATIC_CACHE_MIN_COMPRESS_SIZE))
+		{
+			std::string gzip = gzipCompress(content);
+			if (!gzip.empty() && (gzip.size() < content.size()))
+			{
+				file->m_content[ENCODING_GZIP].reset(new MemorySegment(gzip));
+			}
+			std::string brotli = brotliCompress(content);
+			if (!brotli.empty() && (brotli.size() < content.size()))
+			{
+				file->m_content[ENCODING_BROTLI].reset(new MemorySegment(brotli));
+			}
+		}
+		LOG(DEBUG) << "webroot file:" << path << " size:" << content.size()
+				   << " gzip:" << (file->m_content[ENCODING_GZIP] ? file->m_content[ENCODING_GZIP]->size() : 0)
+				   << " br:" << (file->m_content[ENCODING_BROTLI] ? file->m_content[ENCODING_BROTLI]->size() : 0);
+	}
+	return file;
+}
+
+// ---------------------------------
+// reload when the webroot changes, events of an update are coalesced
+// ---------------------------------
+void StaticFileCache::inotifyHandler()
+{
+	char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+	while (read(m_inotifyFd, buffer, sizeof(buffer)) > 0)
+	{
+	}
+	m_env.taskScheduler().unscheduleDelayedTask(m_reloadTask);
+	m_reloadTask = m_env.taskScheduler().scheduleDelayedTask(STATIC_CACHE_RELOAD_DELAY_MS * 1000, reload, this);
+}
+
+void StaticFileCache::reload(void *clientData)
+{
+	StaticFileCache *cache = (StaticFileCache *)clientData;
+	cache->m_reloadTask = NULL;
+	cache->load();
+}
+
+// ---------------------------------
+// lookup and negotiation
+// ---------------------------------
+std::shared_ptr<const StaticFileCache::File> StaticFileCache::getFile(const std::string &path)
+{
+	std::shared_ptr<const File> file;
+	std::map<std::string, std::shared_ptr<const File>>::const_iterator it = m_files->find(path.empty() ? "index.html" : path);
+	if (it != m_files->end())
+	{
+		file = it->second;
+	}
+	return file;
+}
+
+StaticFileCache::Encoding StaticFileCache::negotiate(const File &file, const std::string &acceptEncoding)
+{
+	bool gzip = false;
+	bool brotli = false;
+	std::string header(acceptEncoding);
+	std::transform(header.begin(), header.end(), header.begin(), ::tolower);
+	std::istringstream is(header);
+	std::string token;
+	while (getline(is, token, ','))
+	{
+		// coding and its quality, q=0 refuses the coding
+		std::string coding(token.substr(0, token.find(';')));
+		coding.erase(0, coding.find_first_not_of(" \t"));
+		coding.erase(coding.find_last_not_of(" \t") + 1);
+		size_t q = token.find("q=");
+		bool accepted = (q == std::string::npos) || (atof(token.c_str() + q + 2) > 0);
+		if (coding == "gzip")
+		{
+			gzip = accepted;
+		}
+		else if (coding == "br")
+		{
+			brotli = accepted;
+		}
+	}
+
+	Encoding encoding = ENCODING_IDENTITY;
+	if (brotli && file.m_content[ENCODING_BROTLI])
+	{
+		encoding = ENCODING_BROTLI;
+	}
+	else if (gzip && file.m_content[ENCODING_GZIP])
+	{
+		encoding = ENCODING_GZIP;
+	}
+	return encoding;
+}
+
+const char *StaticFileCache::getEncodingName(Encoding encoding)
+{
+	const char *name = "identity";
+	if (encoding == ENCODING_GZIP)
+	{
+		name = "gzip";
+	}
+	else if (encoding == ENCODING_BROTLI)
+	{
+		name = "br";
+	}
+	return name;
+}
+
+std::string StaticFileCache::getMimeType(const std::string &path)
+{
+	static const std::map<std::string, std::string> mimeTypes = {
+		{"html", "text/html; charset=utf-8"},
+		{"htm", "text/html; charset=utf-8"},
+		{"js", "application/javascript"},
+		{"mjs", "application/javascript"},
+		{"css", "text/css"},
+		{"json", "application/json"},
+		{"map", "application/json"},
+		{"txt", "text/plain; charset=utf-8"},
+		{"xml", "application/xml"},
+		{"svg", "image/svg+xml"},
+		{"png", "image/png"},
+		{"jpg", "image/jpeg"},
+		{"jpeg", "image/jpeg"},
+		{"gif", "image/gif"},
+		{"ico", "image/x-icon"},
+		{"webp", "image/webp"},
+		{"woff", "font/woff"},
+		{"woff2", "font/woff2"},
+		{"wasm", "application/wasm"},
+		{"m3u8", "application/vnd.apple.mpegurl"},
+		{"mpd", "application/dash+xml"},
+		{"ts", "video/mp2t"},
+		{"mp4", "video/mp4"},
+	};
+
+	std::string mime("application/octet-stream");
+	size_t pos = path.find_last_of(".");
+	if (pos != std::string::npos)
+	{
+		std::string ext(path.substr(pos + 1));
+		std::transform(ext.begin(), ext.end(), ext.begin(), ::tolower);
+		std::map<std::string, std::string>::const_iterator it = mimeTypes.find(ext);
+		if (it != mimeTypes.end())
+		{
+			mime = it->second;
+		}
+	}
+	return mime;
+}
@@ -0,0 +1,470 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** TSMuxerSink.cpp
+**
+** Implement a live555 Sink that mux elementary streams in MPEG-TS segments in memory
+**
+** -------------------------------------------------------------------------*/
+
+#include <string.h>
+
+#include <algorithm>
+
+#include "logger.h"
+#include "TSMuxerSink.h"
+
+// ---------------------------------
+// PSI and timestamps
+// ---------------------------------
+
+// MPEG-2 CRC32, polynomial 0x04C11DB7 most significant bit first
+static uint32_t crc32(const unsigned char *data, unsigned int size)
+{
+	struct CrcTable
+	{
+		CrcTable()
+		{
+			for (uint32_t i = 0; i < 256; i++)
+			{
+				uint32_t crc = i << 24;
+				for (int bit = 0; bit < 8; bit++)
+				{
+					crc = (crc & 0x80000000) ? (crc << 1) ^ 0x04C11DB7 : (crc << 1);
+				}
+				m_values[i] = crc;
+			}
+		}
+		uint32_t m_values[256];
+	};
+	static const CrcTable table;
+
+	uint32_t crc = 0xFFFFFFFF;
+	for (unsigned int i = 0; i < size; i++)
+	{
+		crc = (crc << 8) ^ table.m_values[((crc >> 24) ^ data[i]) & 0xFF];
+	}
+	return crc;
+}
+
+// section in one packet, the CRC is appended and the rest of the packet stuffed
+static std::string psiPacket(uint16_t pid, const unsigned char *section, unsigned int size)
+{
+	unsigned char packet[MEMORY_BUFFER_SINK_TS_PACKET_SIZE];
+	memset(packet, 0xFF, sizeof(packet));
+	packet[0] = 0x47;
+	packet[1] = 0x40 | ((pid >> 8) & 0x1F);
+	packet[2] = pid & 0xFF;
+	packet[3] = 0x10;
+	packet[4] = 0; // pointer_field
+	memcpy(packet + 5, section, size);
+	uint32_t crc = crc32(section, size);
+	packet[5 + size] = crc >> 24;
+	packet[6 + size] = crc >> 16;
+	packet[7 + size] = crc >> 8;
+	packet[8 + size] = crc;
+	return std::string((const char *)packet, sizeof(packet));
+}
+
+// 90kHz clock of the capture time, on 33 bits
+static uint64_t toTicks(const timeval &presentationTime)
+{
+	return ((uint64_t)presentationTime.tv_sec * 90000 + (uint64_t)presentationTime.tv_usec * 9 / 100) & 0x1FFFFFFFFULL;
+}
+
+uint8_t TSMuxerSink::getStreamType(const std::string &format)
+{
+	uint8_t streamType = 0;
+	if (format == "video/H264")
+	{
+		streamType = 0x1B;
+	}
+	else if (format == "video/H265")
+	{
+		streamType = 0x24;
+	}
+	else if ((format.find("audio/AAC") == 0) || (format.find("audio/MPEG4-GENERIC") == 0))
+	{
+		// AAC frames with their ADTS header
+		streamType = 0x0F;
+	}
+	else if (format.find("audio/MPEG") == 0)
+	{
+		streamType = 0x03;
+	}
+	return streamType;
+}
+
+// -----------------------------------------
+//    TSMuxerSink
+// -----------------------------------------
+TSMuxerSink::TSMuxerSink(UsageEnvironment &env, const std::string &format, V4L2DeviceSource *device, unsigned int chunkSize, unsigned int sliceDuration, unsigned int partDuration, unsigned int nbSlices)
+	: MemoryBufferSink(env, chunkSize, sliceDuration, partDuration, nbSlices), m_format(format), m_device(device),
+	  m_audioSource(NULL), m_audioBuffer(NULL), m_audioBufferSize(0),
+	  m_patContinuity(0), m_pmtContinuity(0)
+{
+	m_bufferSize = OutPacketBuffer::maxSize;
+	m_buffer = new unsigned char[m_bufferSize];
+
+	// the source of the sink is the video, or the audio when there is no video
+	if (format.find("video/") == 0)
+	{
+		m_video.m_pid = TS_MUXER_VIDEO_PID;
+		m_video.m_streamType = getStreamType(format);
+		m_video.m_streamId = 0xE0;
+	}
+	else
+	{
+		m_audioFormat = format;
+		m_audio.m_pid = TS_MUXER_AUDIO_PID;
+		m_audio.m_streamType = getStreamType(format);
+		m_audio.m_streamId = 0xC0;
+	}
+	this->createTables();
+}
+
+TSMuxerSink::~TSMuxerSink()
+{
+	if (m_audioSource != NULL)
+	{
+		m_audioSource->stopGettingFrames();
+	}
+	delete[] m_buffer;
+	delete[] m_audioBuffer;
+}
+
+bool TSMuxerSink::addAudioSource(FramedSource *source, const std::string &format)
+{
+	uint8_t streamType = getStreamType(format);
+	if ((m_audioSource != NULL) || (m_video.m_streamType == 0) || (format.find("audio/") != 0) || (streamType == 0))
+	{
+		return false;
+	}
+	m_audioSource = source;
+	m_audioFormat = format;
+	m_audio.m_pid = TS_MUXER_AUDIO_PID;
+	m_audio.m_streamType = streamType;
+	m_audio.m_streamId = 0xC0;
+	m_audioBufferSize = OutPacketBuffer::maxSize;
+	m_audioBuffer = new unsigned char[m_audioBufferSize];
+	this->createTables();
+
+	this->continueAudio();
+	return true;
+}
+
+Boolean TSMuxerSink::continuePlaying()
+{
+	Boolean ret = False;
+	if (fSource != NULL)
+	{
+		fSource->getNextFrame(m_buffer, m_bufferSize,
+							  afterGettingFrame, this,
+							  onSourceClosure, this);
+		ret = True;
+	}
+	return ret;
+}
+
+void TSMuxerSink::afterGettingFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime)
+{
+	if (numTruncatedBytes > 0)
+	{
+		envir() << "TSMuxerSink::afterGettingFrame(): The input frame data was too large for our buffer size truncated:" << numTruncatedBytes << " bufferSize:" << m_bufferSize << "\n";
+		m_bufferSize += numTruncatedBytes;
+		delete[] m_buffer;
+		m_buffer = new unsigned char[m_bufferSize];
+		if ((m_video.m_streamType != 0) && (m_device != NULL))
+		{
+			// the dropped frame breaks the GOP, the next keyframe repairs it
+			m_device->requestKeyFrame("ts muxer dropped frame");
+		}
+	}
+	else if (frameSize > 0)
+	{
+		if (m_video.m_streamType != 0)
+		{
+			this->writeNal(m_buffer, frameSize, presentationTime);
+		}
+		else if (m_audio.m_streamType != 0)
+		{
+			// without video every audio frame could start a segment
+			this->onAccessUnit(presentationTime, true);
+			this->writeAudioFrame(m_buffer, frameSize, presentationTime);
+		}
+	}
+
+	continuePlaying();
+}
+
+void TSMuxerSink::continueAudio()
+{
+	if (m_audioSource != NULL)
+	{
+		m_audioSource->getNextFrame(m_audioBuffer, m_audioBufferSize,
+									afterGettingAudioFrame, this,
+									onAudioSourceClosure, this);
+	}
+}
+
+void TSMuxerSink::afterGettingAudioFrame(unsigned frameSize, unsigned numTruncatedBytes, struct timeval presentationTime)
+{
+	if (numTruncatedBytes > 0)
+	{
+		envir() << "TSMuxerSink::afterGettingAudioFrame(): The input frame data was too large for our buffer size truncated:" << numTruncatedBytes << " bufferSize:" << m_audioBufferSize << "\n";
+		m_audioBufferSize += numTruncatedBytes;
+		delete[] m_audioBuffer;
+		m_audioBuffer = new unsigned char[m_audioBufferSize];
+	}
+	else if (frameSize > 0)
+	{
+		this->writeAudioFrame(m_audioBuffer, frameSize, presentationTime);
+	}
+
+	continueAudio();
+}
+
+// the video goes on without audio
+void TSMuxerSink::onAudioSourceClosure(void *clientData)
+{
+	TSMuxerSink *sink = (TSMuxerSink *)clientData;
+	LOG(NOTICE) << "audio source of the TS muxer closed";
+	sink->m_audioSource = NULL;
+}
+
+// ---------------------------------
+// elementary streams to PES
+// ---------------------------------
+
+// NAL units of an access unit share the capture time, they are written in one PES
+void TSMuxerSink::writeNal(const unsigned char *nal, unsigned int size, const timeval &presentationTime)
+{
+	// the source keeps the start code when it is started with keepMarker
+	unsigned int markerLength = 0;
+	if ((size > 4) && (memcmp(nal, "\0\0\0\1", 4) == 0))
+	{
+		markerLength = 4;
+	}
+	else if ((size > 3) && (memcmp(nal, "\0\0\1", 3) == 0))
+	{
+		markerLength = 3;
+	}
+	bool h265 = (m_format == "video/H265");
+	int type = h265 ? ((nal[markerLength] & 0x7E) >> 1) : (nal[markerLength] & 0x1F);
+
+	double time = presentationTime.tv_sec + presentationTime.tv_usec / 1000000.0;
+	bool accessUnitStart = !m_hasAccessUnit || (time != m_accessUnitTime);
+	if (accessUnitStart)
+	{
+		// the previous access unit ends before a part or a segment is cut
+		this->finishPacket(m_video);
+	}
+	bool keyFrame = (m_device != NULL) && m_device->isKeyFrame((const char *)nal, size);
+	this->onAccessUnit(presentationTime, keyFrame);
+
+	if (accessUnitStart)
+	{
+		this->startPes(m_video, presentationTime, 0, true);
+		// an access unit delimiter is expected at the start of each access unit
+		static const unsigned char h264Delimiter[] = {0, 0, 0, 1, 0x09, 0xF0};
+		static const unsigned char h265Delimiter[] = {0, 0, 0, 1, 0x46, 0x01, 0x50};
+		if (h265 && (type != 35))
+		{
+			this->writePayload(m_video, h265Delimiter, sizeof(h265Delimiter));
+		}
+		else if (!h265 && (type != 9))
+		{
+			this->writePayload(m_video, h264Delimiter, sizeof(h264Delimiter));
+		}
+	}
+	if (markerLength == 0)
+	{
+		static const unsigned char startCode[] = {0, 0, 0, 1};
+		this->writePayload(m_video, startCode, sizeof(startCode));
+	}
+	this->writePayload(m_video, nal, size);
+}
+
+// an audio frame is a complete PES, its last packet is padded at once
+void TSMuxerSink::writeAudioFrame(const unsigned char *frame, unsigned int size, const timeval &presentationTime)
+{
+	this->startPes(m_audio, presentationTime, size, m_video.m_streamType == 0);
+	this->writePayload(m_audio, frame, size);
+	this->finishPacket(m_audio);
+}
+
+void TSMuxerSink::startPes(Stream &stream, const timeval &presentationTime, unsigned int size, bool pcr)
+{
+	this->finishPacket(stream);
+	uint64_t ticks = toTicks(presentationTime);
+	this->startPacket(stream, true, pcr ? &ticks : NULL);
+
+	// PES_packet_length 0 for video, the size of the access unit is not known yet
+	uint64_t pts = (ticks + TS_MUXER_PTS_DELAY) & 0x1FFFFFFFFULL;
+	unsigned int length = (size != 0) ? size + 8 : 0;
+	if (length > 0xFFFF)
+	{
+		length = 0;
+	}
+	const unsigned char header[] = {0, 0, 1, stream.m_streamId,
+									(unsigned char)(length >> 8), (unsigned char)length,
+									0x80, 0x80, 5, // PTS only
+									(unsigned char)(0x21 | ((pts >> 29) & 0x0E)), (unsigned char)(pts >> 22),
+									(unsigned char)(0x01 | ((pts >> 14) & 0xFE)), (unsigned char)(pts >> 7),
+									(unsigned char)(0x01 | ((pts << 1) & 0xFE))};
+	this->writePayload(stream, header, sizeof(header));
+}
+
+// ---------------------------------
+// packets written in place in the arena
+// ---------------------------------
+void TSMuxerSink::writePayload(Stream &stream, const unsigned char *data, unsigned int size)
+{
+	while (size > 0)
+	{
+		if (stream.m_packet == NULL)
+		{
+			this->startPacket(stream, false, NULL);
+		}
+		unsigned int length = std::min(size, MEMORY_BUFFER_SINK_TS_PACKET_SIZE - stream.m_packetUsed);
+		memcpy(stream.m_packet + stream.m_packetUsed, data, length);
+		stream.m_packetUsed += length;
+		data += length;
+		size -= length;
+		if (stream.m_packetUsed == MEMORY_BUFFER_SINK_TS_PACKET_SIZE)
+		{
+			stream.m_packet = NULL;
+			stream.m_packetUsed = 0;
+		}
+	}
+}
+
+void TSMuxerSink::startPacket(Stream &stream, bool unitStart, const uint64_t *pcr)
+{
+	stream.m_packet = this->reservePacket();
+	unsigned char *packet = (unsigned char *)stream.m_packet;
+	packet[0] = 0x47;
+	packet[1] = (unitStart ? 0x40 : 0) | ((stream.m_pid >> 8) & 0x1F);
+	packet[2] = stream.m_pid & 0xFF;
+	packet[3] = 0x10 | stream.m_continuity;
+	stream.m_continuity = (stream.m_continuity + 1) & 0x0F;
+	stream.m_packetUsed = 4;
+
+	if (pcr != NULL)
+	{
+		// adaptation field with the PCR, extension 0
+		packet[3] |= 0x20;
+		packet[4] = 7;
+		packet[5] = 0x10;
+		packet[6] = *pcr >> 25;
+		packet[7] = *pcr >> 17;
+		packet[8] = *pcr >> 9;
+		packet[9] = *pcr >> 1;
+		packet[10] = ((*pcr & 1) << 7) | 0x7E;
+		packet[11] = 0;
+		stream.m_packetUsed = 12;
+	}
+}
+
+// the payload of an incomplete packet moves to its end, the adaptation field is stuffed
+void TSMuxerSink::finishPacket(Stream &stream)
+{
+	if (stream.m_packet == NULL)
+	{
+		return;
+	}
+	unsigned char *packet = (unsigned char *)stream.m_packet;
+	unsigned int stuffing = MEMORY_BUFFER_SINK_TS_PACKET_SIZE - stream.m_packetUsed;
+	if (packet[3] & 0x20)
+	{
+		unsigned int payload = 5 + packet[4];
+		memmove(packet + payload + stuffing, packet + payload, stream.m_packetUsed - payload);
+		memset(packet + payload, 0xFF, stuffing);
+		packet[4] += stuffing;
+	}
+	else
+	{
+		memmove(packet + 4 + stuffing, packet + 4, stream.m_packetUsed - 4);
+		packet[3] |= 0x20;
+		packet[4] = stuffing - 1;
+		if (stuffing > 1)
+		{
+			packet[5] = 0;
+			memset(packet + 6, 0xFF, stuffing - 2);
+		}
+	}
+	stream.m_packet = NULL;
+	stream.m_packetUsed = 0;
+}
+
+// the 188 bytes belong to the slice in progress before they are written
+char *TSMuxerSink::reservePacket()
+{
+	if (!m_chunk || (m_chunk->capacity() - m_chunkUsed < MEMORY_BUFFER_SINK_TS_PACKET_SIZE))
+	{
+		m_chunk = m_arena->acquire();
+		m_chunkUsed = 0;
+	}
+	MemorySegment::Span span = {m_chunk, m_chunkUsed, MEMORY_BUFFER_SINK_TS_PACKET_SIZE};
+	this->appendSpan(m_outputBuffers[m_sequence], span);
+	char *packet = m_chunk->data() + m_chunkUsed;
+	m_chunkUsed += MEMORY_BUFFER_SINK_TS_PACKET_SIZE;
+	return packet;
+}
+
+// PAT and PMT of the streams, repeated at the start of each segment
+void TSMuxerSink::createTables()
+{
+	const unsigned char pat[] = {0x00, 0xB0, 13, // table_id, section_length
+								 0x00, 0x01, 0xC1, 0x00, 0x00,
+								 0x00, 0x01, (unsigned char)(0xE0 | (TS_MUXER_PMT_PID >> 8)), (unsigned char)(TS_MUXER_PMT_PID & 0xFF)};
+	m_pat = psiPacket(0, pat, sizeof(pat));
+
+	uint16_t pcrPid = (m_video.m_streamType != 0) ? m_video.m_pid : m_audio.m_pid;
+	unsigned char pmt[32];
+	unsigned int size = 0;
+	pmt[size++] = 0x02;
+	size += 2; // section_length
+	pmt[size++] = 0x00;
+	pmt[size++] = 0x01;
+	pmt[size++] = 0xC1;
+	pmt[size++] = 0x00;
+	pmt[size++] = 0x00;
+	pmt[size++] = 0xE0 | (pcrPid >> 8);
+	pmt[size++] = pcrPid & 0xFF;
+	pmt[size++] = 0xF0;
+	pmt[size++] = 0x00;
+	const Stream *streams[] = {&m_video, &m_audio};
+	for (const Stream *stream : streams)
+	{
+		if (stream->m_streamType != 0)
+		{
+			pmt[size++] = stream->m_streamType;
+			pmt[size++] = 0xE0 | (stream->m_pid >> 8);
+			pmt[size++] = stream->m_pid & 0xFF;
+			pmt[size++] = 0xF0;
+			pmt[size++] = 0x00;
+		}
+	}
+	// section_length counts the bytes after it with the CRC
+	pmt[1] = 0xB0 | ((size + 1) >> 8);
+	pmt[2] = (size + 1) & 0xFF;
+	m_pmt = psiPacket(TS_MUXER_PMT_PID, pmt, size);
+}
+
+// a copy of the tables for each segment, the continuity counter of each PID goes on from the previous segment
+std::shared_ptr<SegmentArena::Chunk> TSMuxerSink::createSegmentTables()
+{
+	std::shared_ptr<SegmentArena::Chunk> tables = std::make_shared<SegmentArena::Chunk>(m_pat.size() + m_pmt.size());
+	char *pat = tables->data();
+	char *pmt = tables->data() + m_pat.size();
+	memcpy(pat, m_pat.c_str(), m_pat.size());
+	memcpy(pmt, m_pmt.c_str(), m_pmt.size());
+	pat[3] = 0x10 | m_patContinuity;
+	pmt[3] = 0x10 | m_pmtContinuity;
+	m_patContinuity = (m_patContinuity + 1) & 0x0F;
+	m_pmtContinuity = (m_pmtContinuity + 1) & 0x0F;
+	return tables;
+}
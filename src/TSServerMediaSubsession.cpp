@@ -8,77 +8,155 @@
 ** -------------------------------------------------------------------------*/
 
 #include "TSServerMediaSubsession.h"
-#include "AddH26xMarkerFilter.h"
+#include "CMAFSink.h"
+#include "TSMuxerSink.h"
 
-TSServerMediaSubsession::TSServerMediaSubsession(UsageEnvironment &env, StreamReplicator *videoreplicator, StreamReplicator *audioreplicator, unsigned int sliceDuration)
-	: UnicastServerMediaSubsession(env, videoreplicator), m_slice(0)
+TSServerMediaSubsession::TSServerMediaSubsession(UsageEnvironment &env, FrameReplicator *videoreplicator, FrameReplicator *audioreplicator, unsigned int sliceDuration, unsigned int partDuration, bool cmaf, unsigned int idleTimeout)
+	: UnicastServerMediaSubsession(env, videoreplicator, RtpSendOptions()), m_audioReplicator(audioreplicator), m_hlsSink(NULL), m_hlsSource(NULL), m_hlsAudioSource(NULL), m_sliceDuration(sliceDuration), m_partDuration(partDuration), m_cmaf(cmaf), m_idleTimeout(idleTimeout), m_idleTask(NULL)
 {
-	// Create a source
-	FramedSource *source = videoreplicator->createStreamReplica();
-	MPEG2TransportStreamFromESSource *muxer = MPEG2TransportStreamFromESSource::createNew(env);
+}
+
+TSServerMediaSubsession::~TSServerMediaSubsession()
+{
+	envir().taskScheduler().unscheduleDelayedTask(m_idleTask);
+	this->stopPipeline();
+}
+
+// ---------------------------------
+// the pipeline is built by the first HLS request and stopped when they stop
+// ---------------------------------
+MemoryBufferSink *TSServerMediaSubsession::getHlsSink()
+{
+	if (m_hlsSink == NULL)
+	{
+		this->startPipeline();
+	}
+	if (m_idleTimeout != 0)
+	{
+		envir().taskScheduler().unscheduleDelayedTask(m_idleTask);
+		m_idleTask = envir().taskScheduler().scheduleDelayedTask(m_idleTimeout * 1000000LL, TSServerMediaSubsession::idleTimeoutStub, this);
+	}
+	return m_hlsSink;
+}
+
+void TSServerMediaSubsession::startPipeline()
+{
+	UsageEnvironment &env = envir();
+	LOG(NOTICE) << "Start HLS pipeline of " << this->trackId() << " format:" << m_format;
 
-	if (m_format == "video/H264")
+	// Create a source, the segments keep the durations of the cached GOP
+	FramedSource *source = m_replicator->createStreamReplica(false);
+	V4L2DeviceSource *device = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+	if (device != NULL)
 	{
-		// add marker
-		FramedSource *filter = new AddH26xMarkerFilter(env, source);
-		// mux to TS
-		muxer->addNewVideoSource(filter, 5);
+		// the first segment starts at a keyframe, the encoder does not wait the end of its GOP
+		device->requestKeyFrame("hls start");
 	}
-	else if (m_format == "video/H265")
+	if (m_cmaf && ((m_format == "video/H264") || (m_format == "video/H265")))
 	{
-		// add marker
-		FramedSource *filter = new AddH26xMarkerFilter(env, source);
-		// mux to TS
-		muxer->addNewVideoSource(filter, 6);
+		// the NAL units are packed in fragments without muxer
+		m_hlsSink = CMAFSink::createNew(env, m_format, device, SEGMENT_ARENA_CHUNK_SIZE, m_sliceDuration, m_partDuration);
+		m_hlsSource = source;
+		m_hlsSink->startPlaying(*m_hlsSource, NULL, NULL);
+		return;
 	}
 
-	if (m_format == "audio/MPEG")
+	// the elementary streams are packetized by the sink, segments are cut on the keyframes it sees
+	TSMuxerSink *sink = TSMuxerSink::createNew(env, m_format, device, SEGMENT_ARENA_CHUNK_SIZE, m_sliceDuration, m_partDuration);
+	m_hlsSink = sink;
+	if (TSMuxerSink::getStreamType(m_format) == 0)
 	{
-		// mux to TS
-		muxer->addNewAudioSource(source, 1);
+		// nothing to mux, the replica would only hold the capture
+		Medium::close(source);
+		return;
 	}
+	m_hlsSource = source;
 
-	FramedSource *tsSource = createSource(env, muxer, "video/MP2T");
+	// audio of the session muxed with the video
+	V4L2DeviceSource *audioDevice = (m_audioReplicator != NULL) ? dynamic_cast<V4L2DeviceSource *>(m_audioReplicator->inputSource()) : NULL;
+	if ((audioDevice != NULL) && (audioDevice->getDevice() != NULL) && (m_format.find("video/") == 0))
+	{
+		DeviceInterface *audioInterface = audioDevice->getDevice();
+		std::string audioFormat = BaseServerMediaSubsession::getAudioRtpFormat(audioInterface->getAudioFormat(), audioInterface->getSampleRate(), audioInterface->getChannels());
+		if (TSMuxerSink::getStreamType(audioFormat) != 0)
+		{
+			m_hlsAudioSource = m_audioReplicator->createStreamReplica(false);
+			sink->addAudioSource(m_hlsAudioSource, audioFormat);
+		}
+		else
+		{
+			LOG(NOTICE) << "audio format:" << audioFormat << " is not muxed in HLS";
+		}
+	}
 
 	// Start Playing the HLS Sink
-	m_hlsSink = MemoryBufferSink::createNew(env, OutPacketBuffer::maxSize, sliceDuration);
-	m_hlsSink->startPlaying(*tsSource, NULL, NULL);
+	m_hlsSink->startPlaying(*m_hlsSource, NULL, NULL);
 }
 
-TSServerMediaSubsession::~TSServerMediaSubsession()
+void TSServerMediaSubsession::stopPipeline()
+{
+	if (m_hlsSink != NULL)
+	{
+		LOG(NOTICE) << "Stop HLS pipeline of " << this->trackId();
+		m_hlsSink->stopPlaying();
+		Medium::close(m_hlsSink);
+		m_hlsSink = NULL;
+		Medium::close(m_hlsSource);
+		m_hlsSource = NULL;
+		Medium::close(m_hlsAudioSource);
+		m_hlsAudioSource = NULL;
+		// the next sink starts again from the first version
+		m_playLists.clear();
+	}
+}
+
+void TSServerMediaSubsession::idleTimeout()
 {
-	Medium::close(m_hlsSink);
+	LOG(NOTICE) << "No HLS request since " << m_idleTimeout << "s";
+	this->stopPipeline();
 }
 
 float TSServerMediaSubsession::getCurrentNPT(void *streamToken)
 {
-	return (m_hlsSink->firstTime());
+	return (m_hlsSink != NULL) ? m_hlsSink->firstTime() : 0;
 }
 
 float TSServerMediaSubsession::duration() const
 {
-	return (m_hlsSink->duration());
+	return (m_hlsSink != NULL) ? m_hlsSink->duration() : 0;
 }
 
-void TSServerMediaSubsession::seekStream(unsigned clientSessionId, void *streamToken, double &seekNPT, double streamDuration, u_int64_t &numBytes)
+// RFC 6381 codecs of the segments, TS segments use the parameter sets of the device
+std::string TSServerMediaSubsession::getCodecs()
 {
-	m_slice = seekNPT / m_hlsSink->getSliceDuration();
-	seekNPT = m_slice * m_hlsSink->getSliceDuration();
-	numBytes = m_hlsSink->getBufferSize(m_slice);
-	std::cout << "seek seekNPT:" << seekNPT << " slice:" << m_slice << " numBytes:" << numBytes << std::endl;
+	std::string codecs = (m_hlsSink != NULL) ? m_hlsSink->getCodecs() : std::string();
+	V4L2DeviceSource *device = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+	if (codecs.empty() && (device != NULL))
+	{
+		std::list<std::string> initFrames = device->getInitFrames();
+		if ((m_format == "video/H265") && !initFrames.empty())
+		{
+			// skip the VPS
+			initFrames.pop_front();
+		}
+		if (!initFrames.empty())
+		{
+			codecs = CMAFSink::getCodecs(m_format, initFrames.front());
+		}
+	}
+	return codecs;
 }
 
-FramedSource *TSServerMediaSubsession::getStreamSource(void *streamToken)
+unsigned int TSServerMediaSubsession::getWidth()
 {
-	FramedSource *source = NULL;
+	V4L2DeviceSource *device = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+	int width = ((device != NULL) && (device->getDevice() != NULL)) ? device->getDevice()->getWidth() : 0;
+	return (width > 0) ? width : 0;
+}
 
-	std::string buffer = m_hlsSink->getBuffer(m_slice);
-	unsigned int size = buffer.size();
-	if (size != 0)
-	{
-		u_int8_t *content = new u_int8_t[size];
-		memcpy(content, buffer.c_str(), size);
-		source = ByteStreamMemoryBufferSource::createNew(envir(), content, size);
-	}
-	return source;
+unsigned int TSServerMediaSubsession::getHeight()
+{
+	V4L2DeviceSource *device = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+	int height = ((device != NULL) && (device->getDevice() != NULL)) ? device->getDevice()->getHeight() : 0;
+	return (height > 0) ? height : 0;
 }
@@ -12,14 +12,19 @@
 // -----------------------------------------
 //    ServerMediaSubsession for Unicast
 // -----------------------------------------
-UnicastServerMediaSubsession *UnicastServerMediaSubsession::createNew(UsageEnvironment &env, StreamReplicator *replicator)
+bool UnicastServerMediaSubsession::m_sharedPacketizer = false;
+
+UnicastServerMediaSubsession *UnicastServerMediaSubsession::createNew(UsageEnvironment &env, FrameReplicator *replicator, const RtpSendOptions &rtpSendOptions)
 {
-	return new UnicastServerMediaSubsession(env, replicator);
+	return new UnicastServerMediaSubsession(env, replicator, rtpSendOptions);
 }
 
 FramedSource *UnicastServerMediaSubsession::createNewStreamSource(unsigned clientSessionId, unsigned &estBitrate)
 {
-	estBitrate = 500;
+	// live555 sizes the send buffer of the RTP socket from the estimated bitrate
+	V4L2DeviceSource *deviceSource = dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource());
+	unsigned int bitrate = deviceSource ? deviceSource->getBitrate() : 0;
+	estBitrate = (bitrate != 0) ? bitrate : 500;
 	FramedSource *source = m_replicator->createStreamReplica();
 	return createSource(envir(), source, m_format);
 }
@@ -29,7 +34,49 @@ RTPSink *UnicastServerMediaSubsession::createNewRTPSink(Groupsock *rtpGroupsock,
 	return createSink(envir(), rtpGroupsock, rtpPayloadTypeIfDynamic, m_format, dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource()));
 }
 
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
+char const *UnicastServerMediaSubsession::sdpLines()
+{
+#else
+char const *UnicastServerMediaSubsession::sdpLines(int addressFamily)
+{
+#endif
+	// parameter sets changed since the SDP was cached, next DESCRIBE get the new ones
+	unsigned int version = this->getAuxLineVersion();
+	if (m_SDPLinesVersion != version)
+	{
+		if (fSDPLines != NULL)
+		{
+			LOG(NOTICE) << "Refresh SDP of " << this->trackId() << " version:" << version;
+			delete[] fSDPLines;
+			fSDPLines = NULL;
+		}
+		m_SDPLinesVersion = version;
+	}
+#if LIVEMEDIA_LIBRARY_VERSION_INT < 1610928000
+	return OnDemandServerMediaSubsession::sdpLines();
+#else
+	return OnDemandServerMediaSubsession::sdpLines(addressFamily);
+#endif
+}
+
 char const *UnicastServerMediaSubsession::getAuxSDPLine(RTPSink *rtpSink, FramedSource *inputSource)
 {
 	return this->getAuxLine(dynamic_cast<V4L2DeviceSource *>(m_replicator->inputSource()), rtpSink);
 }
+
+void UnicastServerMediaSubsession::startStream(unsigned clientSessionId, void *streamToken, TaskFunc *rtcpRRHandler, void *rtcpRRHandlerClientData, unsigned short &rtpSeqNum, unsigned &rtpTimestamp, ServerRequestAlternativeByteHandler *serverRequestAlternativeByteHandler, void *serverRequestAlternativeByteHandlerClientData)
+{
+	this->requestKeyFrame("play");
+	OnDemandServerMediaSubsession::startStream(clientSessionId, streamToken, rtcpRRHandler, rtcpRRHandlerClientData, rtpSeqNum, rtpTimestamp, serverRequestAlternativeByteHandler, serverRequestAlternativeByteHandlerClientData);
+}
+
+#if LIVEMEDIA_LIBRARY_VERSION_INT >= 1607644800
+Groupsock *UnicastServerMediaSubsession::createGroupsock(struct sockaddr_storage const &addr, Port port)
+{
+	// the same groupsocks are used for RTP and RTCP, the server receives only RTCP
+	RTCPFeedbackGroupsock *groupsock = BatchGroupsock::createNew(envir(), addr, port, 255, m_rtpSendOptions);
+	groupsock->setKeyFrameRequestHandler(BaseServerMediaSubsession::rtcpKeyFrameRequest, static_cast<BaseServerMediaSubsession *>(this));
+	return groupsock;
+}
+#endif
@@ -12,10 +12,12 @@
 #include <fcntl.h>
 #include <iomanip>
 #include <sstream>
+#include <algorithm>
 
 // project
 #include "logger.h"
 #include "V4L2DeviceSource.h"
+#include "CaptureReactor.h"
 
 // ---------------------------------
 // V4L2 FramedSource Stats
@@ -37,26 +39,59 @@ int V4L2DeviceSource::Stats::notify(int tv_sec, int framesize)
 // ---------------------------------
 // V4L2 FramedSource
 // ---------------------------------
-V4L2DeviceSource *V4L2DeviceSource::createNew(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode)
+V4L2DeviceSource *V4L2DeviceSource::createNew(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, const CaptureOptions &options)
 {
 	V4L2DeviceSource *source = NULL;
 	if (device)
 	{
-		source = new V4L2DeviceSource(env, device, outputFd, queueSize, captureMode);
+		source = new V4L2DeviceSource(env, device, outputFd, queueSize, captureMode, options);
 	}
 	return source;
 }
 
 // Constructor
-V4L2DeviceSource::V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode)
+V4L2DeviceSource::V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *device, int outputFd, unsigned int queueSize, CaptureMode captureMode, const CaptureOptions &options)
 	: FramedSource(env),
+	  m_captureQueue(std::max(queueSize * 16, 256u)),
 	  m_in("in"),
 	  m_out("out"),
 	  m_outfd(outputFd),
 	  m_device(device),
-	  m_queueSize(queueSize)
+	  m_queueSize(queueSize),
+	  m_captureMode(captureMode),
+	  m_pool(FrameBufferPool::createNew(device ? device->getBufferSize() : 0, queueSize + 3)),
+	  m_queuedAccessUnits(0),
+	  m_queuedBytes(0),
+	  m_maxQueueDurationMs(options.m_targetLatencyMs),
+	  m_maxAccessUnits(queueSize),
+	  m_maxBytes(options.m_maxQueueBytes),
+	  m_waitKeyFrame(false),
+	  m_skipToKeyFrame(false),
+	  m_deliveringAccessUnit(false),
+	  m_budgetSec(0),
+	  m_budgetAccessUnits(0),
+	  m_budgetBytes(0),
+	  m_bitrate(0),
+	  m_maxQueueBytes(options.m_maxQueueBytes),
+	  m_targetLatencyMs(options.m_targetLatencyMs),
+	  m_keyFrameRequester(device, options.m_keyFrameRequestIntervalMs),
+	  m_lazyCapture((options.m_idleTimeoutMs >= 0) && (device != NULL) && (outputFd == -1) && (captureMode != NOCAPTURE)),
+	  m_capturing(true),
+	  m_consumers(0),
+	  m_capturePaused(false),
+	  m_readerParked(false),
+	  m_captureChanged(false),
+	  m_wakeCapture(false),
+	  m_idleTask(NULL),
+	  m_waitFirstFrame(true),
+	  m_resumes(0),
+	  m_idleTimeoutMs(options.m_idleTimeoutMs),
+	  m_auxLineVersion(0),
+	  m_frameHandler(NULL),
+	  m_frameHandlerClientData(NULL)
 {
 	m_eventTriggerId = envir().taskScheduler().createEventTrigger(V4L2DeviceSource::deliverFrameStub);
+	gettimeofday(&m_captureStart, NULL);
 	if (m_device)
 	{
 		switch (captureMode)
@@ -64,6 +99,14 @@ V4L2DeviceSource::V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *devic
 		case CAPTURE_INTERNAL_THREAD:
 			m_thread = std::thread(&V4L2DeviceSource::thread, this);
 			break;
+		case CAPTURE_REACTOR:
+			if (!CaptureReactor::getInstance()->addDevice(m_device->getFd(), V4L2DeviceSource::readFrameStub, this))
+			{
+				LOG(WARN) << "capture reactor not available, use a reader thread";
+				m_captureMode = CAPTURE_INTERNAL_THREAD;
+				m_thread = std::thread(&V4L2DeviceSource::thread, this);
+			}
+			break;
 		case CAPTURE_LIVE555_THREAD:
 			envir().taskScheduler().turnOnBackgroundReadHandling(m_device->getFd(), V4L2DeviceSource::incomingPacketHandlerStub, this);
 			break;
@@ -72,16 +115,41 @@ V4L2DeviceSource::V4L2DeviceSource(UsageEnvironment &env, DeviceInterface *devic
 			break;
 		}
 	}
+	if (m_lazyCapture)
+	{
+		// the device streams until the idle timeout if nobody connects
+		this->updateCapture();
+	}
 }
 
 // Destructor
 V4L2DeviceSource::~V4L2DeviceSource()
 {
+	if (m_device && (m_captureMode == CAPTURE_REACTOR))
+	{
+		CaptureReactor::getInstance()->removeDevice(m_device->getFd());
+	}
 	envir().taskScheduler().deleteEventTrigger(m_eventTriggerId);
+	if (m_lazyCapture)
+	{
+		envir().taskScheduler().unscheduleDelayedTask(m_idleTask);
+	}
+	{
+		// a paused reader thread is released, the stopped device ends it
+		std::lock_guard<std::mutex> lock(m_captureMutex);
+		m_capturePaused = false;
+	}
+	m_captureCondition.notify_all();
 	if (m_thread.joinable())
 	{
 		m_thread.join();
 	}
+	while (m_captureQueue.front() != NULL)
+	{
+		m_captureQueue.pop();
+	}
+	LOG(NOTICE) << "buffer pool hits:" << m_pool->getHits() << " misses:" << m_pool->getMisses() << " dropped frames:" << m_captureQueue.getDropped() << " keyframe requests:" << m_keyFrameRequester.getRequests();
+	m_pool->close();
 	delete m_device;
 }
 
@@ -96,6 +164,16 @@ void *V4L2DeviceSource::thread()
 	LOG(NOTICE) << "begin thread";
 	while (!stop)
 	{
+		if (m_capturePaused)
+		{
+			// parked out of select and read, the device can be stopped
+			std::unique_lock<std::mutex> lock(m_captureMutex);
+			m_readerParked = true;
+			m_captureCondition.notify_all();
+			m_captureCondition.wait(lock, [this]
+									{ return !m_capturePaused; });
+			m_readerParked = false;
+		}
 		int fd = m_device->getFd();
 		FD_SET(fd, &fdset);
 		tv.tv_sec = 1;
@@ -118,6 +196,12 @@ void *V4L2DeviceSource::thread()
 			}
 		}
 	}
+	{
+		// a pause does not wait for a reader that is gone
+		std::lock_guard<std::mutex> lock(m_captureMutex);
+		m_readerParked = true;
+	}
+	m_captureCondition.notify_all();
 	LOG(NOTICE) << "end thread";
 	return NULL;
 }
@@ -131,48 +215,44 @@ void V4L2DeviceSource::doGetNextFrame()
 // deliver frame to the sink
 void V4L2DeviceSource::deliverFrame()
 {
-	if (isCurrentlyAwaitingData())
+	if (m_frameHandler != NULL)
+	{
+		// hand the frames over without copy
+		Frame frame;
+		while (this->popFrame(frame))
+		{
+			m_frameHandler(m_frameHandlerClientData, std::make_shared<const Frame>(std::move(frame)));
+		}
+	}
+	else if (isCurrentlyAwaitingData())
 	{
 		fDurationInMicroseconds = 0;
 		fFrameSize = 0;
 
-		m_mutex.lock();
-		if (m_captureQueue.empty())
+		Frame frame;
+		if (!this->popFrame(frame))
 		{
 			LOG(DEBUG) << "Queue is empty";
 		}
 		else
 		{
-			timeval curTime;
-			gettimeofday(&curTime, NULL);
-			Frame *frame = m_captureQueue.front();
-			m_captureQueue.pop_front();
-
-			m_out.notify(curTime.tv_sec, frame->m_size);
-			if (frame->m_size > fMaxSize)
+			if (frame.m_size > fMaxSize)
 			{
 				fFrameSize = fMaxSize;
-				fNumTruncatedBytes = frame->m_size - fMaxSize;
+				fNumTruncatedBytes = frame.m_size - fMaxSize;
 			}
 			else
 			{
-				fFrameSize = frame->m_size;
+				fFrameSize = frame.m_size;
 			}
-			timeval diff;
-			timersub(&curTime, &(frame->m_timestamp), &diff);
-
-			LOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec << "." << curTime.tv_usec << "\tsize:" << fFrameSize << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms\tqueue:" << m_captureQueue.size();
-
-			fPresentationTime = frame->m_timestamp;
-			memcpy(fTo, frame->m_buffer, fFrameSize);
-			delete frame;
+			fPresentationTime = frame.m_timestamp;
+			memcpy(fTo, frame.m_buffer, fFrameSize);
 
 			if (!m_captureQueue.empty())
 			{
 				envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
 			}
 		}
-		m_mutex.unlock();
 
 		if (fFrameSize > 0)
 		{
@@ -182,6 +262,51 @@ void V4L2DeviceSource::deliverFrame()
 	}
 }
 
+// take the next frame out of the queue
+bool V4L2DeviceSource::popFrame(Frame &frame)
+{
+	// the frames of an access unit already started are never dropped
+	if (!m_deliveringAccessUnit)
+	{
+		this->dropStaleAccessUnits();
+	}
+
+	Frame *front = m_captureQueue.front();
+	if (front == NULL)
+	{
+		return false;
+	}
+
+	timeval curTime;
+	gettimeofday(&curTime, NULL);
+	timeval diff;
+	timersub(&curTime, &(front->m_timestamp), &diff);
+	m_out.notify(curTime.tv_sec, front->m_size);
+
+	frame = std::move(*front);
+	m_queuedBytes -= frame.m_size;
+	if (frame.m_endOfAccessUnit)
+	{
+		m_queuedAccessUnits--;
+	}
+	m_captureQueue.pop();
+	m_deliveringAccessUnit = !frame.m_endOfAccessUnit;
+
+	LOG(DEBUG) << "deliverFrame\ttimestamp:" << curTime.tv_sec << "." << curTime.tv_usec << "\tsize:" << frame.m_size << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms\tqueue:" << m_captureQueue.size();
+	return true;
+}
+
+// consume the frames through a callback instead of the FramedSource interface
+void V4L2DeviceSource::setFrameHandler(FrameHandler *handler, void *clientData)
+{
+	m_frameHandler = handler;
+	m_frameHandlerClientData = clientData;
+	if ((m_frameHandler != NULL) && !m_captureQueue.empty())
+	{
+		envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+	}
+}
+
 // FrameSource callback on read event
 void V4L2DeviceSource::incomingPacketHandler()
 {
@@ -196,36 +321,48 @@ int V4L2DeviceSource::getNextFrame()
 {
 	timeval ref;
 	gettimeofday(&ref, NULL);
-	char *buffer = new char[m_device->getBufferSize()];
-	int frameSize = m_device->read(buffer, m_device->getBufferSize());
+	FrameBufferPool::Buffer *buffer = m_pool->acquire();
+	if (buffer == NULL)
+	{
+		errno = ENOMEM;
+		return -1;
+	}
+	int frameSize = m_device->read(buffer->data(), buffer->capacity());
 	if (frameSize < 0)
 	{
 		LOG(NOTICE) << "V4L2DeviceSource::getNextFrame errno:" << errno << " " << strerror(errno);
-		delete[] buffer;
 	}
 	else if (frameSize == 0)
 	{
 		LOG(DEBUG) << "V4L2DeviceSource::getNextFrame no data errno:" << errno << " " << strerror(errno);
-		delete[] buffer;
 	}
 	else
 	{
+		buffer->setSize(frameSize);
 		this->postFrame(buffer, frameSize, ref);
 	}
+	buffer->release();
 	return frameSize;
 }
 
 // post frame to queue
-void V4L2DeviceSource::postFrame(char *frame, int frameSize, const timeval &ref)
+void V4L2DeviceSource::postFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref)
 {
+	char *frame = buffer->data();
 	timeval tv;
 	gettimeofday(&tv, NULL);
 	timeval diff;
 	timersub(&tv, &ref, &diff);
 	m_in.notify(tv.tv_sec, frameSize);
+	if (m_waitFirstFrame.exchange(false))
+	{
+		timeval latency;
+		timersub(&tv, &m_captureStart, &latency);
+		LOG(NOTICE) << (m_resumes ? "warm resume" : "cold start") << " latency:" << (latency.tv_sec * 1000 + latency.tv_usec / 1000) << "ms";
+	}
 	LOG(DEBUG) << "postFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << frameSize << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms";
 
-	processFrame(frame, frameSize, ref);
+	processFrame(buffer, frameSize, ref);
 	if (m_outfd != -1)
 	{
 		int written = write(m_outfd, frame, frameSize);
@@ -236,46 +373,358 @@ void V4L2DeviceSource::postFrame(char *frame, int frameSize, const timeval &ref)
 	}
 }
 
-void V4L2DeviceSource::processFrame(char *frame, int frameSize, const timeval &ref)
+void V4L2DeviceSource::processFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref)
 {
 	timeval tv;
 	gettimeofday(&tv, NULL);
 	timeval diff;
 	timersub(&tv, &ref, &diff);
 
-	std::list<std::pair<unsigned char *, size_t>> frameList = this->splitFrames((unsigned char *)frame, frameSize);
-	while (!frameList.empty())
+	// all the frames of a capture buffer belong to the same access unit
+	std::list<std::pair<unsigned char *, size_t>> frameList = this->splitFrames((unsigned char *)buffer->data(), frameSize);
+	size_t accessUnitSize = 0;
+	bool keyFrame = false;
+	for (auto &item : frameList)
 	{
-		std::pair<unsigned char *, size_t> &item = frameList.front();
-		size_t size = item.second;
-		char *allocatedBuffer = NULL;
-		if (frameList.size() == 1)
+		accessUnitSize += item.second;
+		keyFrame = keyFrame || this->isKeyFrame((const char *)item.first, item.second);
+	}
+	this->updateQueueBudget(tv, accessUnitSize);
+	bool interFrames = this->hasInterFrames();
+	if ((keyFrame || !interFrames) && (accessUnitSize > 0))
+	{
+		this->updateLastFrame(buffer, frameSize, ref);
+		// the keyframe answers the pending requests
+		m_keyFrameRequester.keyFrameCaptured();
+	}
+	else
+	{
+		this->sendKeyFrameRequest(tv);
+	}
+
+	if (m_waitKeyFrame && !keyFrame)
+	{
+		LOG(DEBUG) << "drop access unit waiting for a keyframe size:" << accessUnitSize;
+		for (auto &item : frameList)
 		{
-			// last frame will release buffer
-			allocatedBuffer = frame;
+			m_captureQueue.notifyDrop(item.second);
 		}
-		queueFrame((char *)item.first, size, ref, allocatedBuffer);
+		return;
+	}
+
+	bool queued = !frameList.empty() && !this->isOverBudget(accessUnitSize);
+	while (queued && !frameList.empty())
+	{
+		std::pair<unsigned char *, size_t> &item = frameList.front();
+		size_t size = item.second;
+		// each frame keeps a reference on the capture buffer
+		queued = queueFrame((char *)item.first, size, ref, buffer, this->getFrameOwner(item.first), keyFrame, (frameList.size() == 1));
 		frameList.pop_front();
 
 		LOG(DEBUG) << "queueFrame\ttimestamp:" << ref.tv_sec << "." << ref.tv_usec << "\tsize:" << size << "\tdiff:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms";
 	}
+
+	if (queued)
+	{
+		// publish the whole access unit at once
+		m_captureQueue.commit();
+		m_queuedBytes += accessUnitSize;
+		m_queuedAccessUnits++;
+		m_waitKeyFrame = false;
+
+		// post an event to ask to deliver the frame
+		envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+	}
+	else if (accessUnitSize > 0)
+	{
+		// dropping part of a GOP corrupts the stream until the next keyframe
+		m_captureQueue.rollback();
+		m_captureQueue.notifyDrop(accessUnitSize);
+		m_waitKeyFrame = interFrames;
+		this->requestKeyFrame("queue full");
+		LOG(DEBUG) << "Queue full drop access unit size:" << accessUnitSize << " queue:" << m_queuedAccessUnits << " bytes:" << m_queuedBytes << " dropped:" << m_captureQueue.getDropped();
+	}
+}
+
+// stage a frame in the fifo
+bool V4L2DeviceSource::queueFrame(char *frame, int frameSize, const timeval &tv, FrameBufferPool::Buffer *allocatedBuffer, const std::shared_ptr<const std::string> &owner, bool keyFrame, bool endOfAccessUnit)
+{
+	Frame item(frame, frameSize, tv, allocatedBuffer, owner);
+	item.m_keyFrame = keyFrame;
+	item.m_endOfAccessUnit = endOfAccessUnit;
+	return m_captureQueue.stage(std::move(item));
+}
+
+// measure the stream to size the queue from the target latency
+void V4L2DeviceSource::updateQueueBudget(const timeval &tv, size_t accessUnitSize)
+{
+	if (tv.tv_sec != m_budgetSec)
+	{
+		if (m_targetLatencyMs != 0)
+		{
+			m_maxAccessUnits = std::max(1u, (m_budgetAccessUnits * m_targetLatencyMs + 999) / 1000);
+			size_t bytes = m_budgetBytes * m_targetLatencyMs / 1000;
+			m_maxBytes = (m_maxQueueBytes != 0) ? std::min(m_maxQueueBytes, bytes) : bytes;
+		}
+		LOG(DEBUG) << "queue budget accessUnits:" << m_maxAccessUnits << " bytes:" << m_maxBytes << " duration:" << m_maxQueueDurationMs << "ms";
+		if (m_budgetSec != 0)
+		{
+			m_bitrate = m_budgetBytes * 8 / 1000;
+		}
+		m_budgetSec = tv.tv_sec;
+		m_budgetAccessUnits = 0;
+		m_budgetBytes = 0;
+	}
+	m_budgetAccessUnits++;
+	m_budgetBytes += accessUnitSize;
 }
 
-// post a frame to fifo
-void V4L2DeviceSource::queueFrame(char *frame, int frameSize, const timeval &tv, char *allocatedBuffer)
+bool V4L2DeviceSource::isOverBudget(size_t accessUnitSize)
 {
-	m_mutex.lock();
-	while (m_captureQueue.size() >= m_queueSize)
+	bool overBudget = (m_queuedAccessUnits >= m_maxAccessUnits);
+	// an access unit larger than the whole budget is still accepted in an empty queue
+	if ((m_maxBytes != 0) && (m_queuedAccessUnits != 0) && (m_queuedBytes + accessUnitSize > m_maxBytes))
 	{
-		LOG(DEBUG) << "Queue full size drop frame size:" << (int)m_captureQueue.size();
-		delete m_captureQueue.front();
-		m_captureQueue.pop_front();
+		overBudget = true;
 	}
-	m_captureQueue.push_back(new Frame(frame, frameSize, tv, allocatedBuffer));
-	m_mutex.unlock();
+	return overBudget;
+}
 
-	// post an event to ask to deliver the frame
-	envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+// drop the access unit at the head of the queue
+void V4L2DeviceSource::dropAccessUnit()
+{
+	Frame *frame = NULL;
+	bool endOfAccessUnit = false;
+	while (!endOfAccessUnit && ((frame = m_captureQueue.front()) != NULL))
+	{
+		endOfAccessUnit = frame->m_endOfAccessUnit;
+		m_captureQueue.notifyDrop(frame->m_size);
+		m_queuedBytes -= frame->m_size;
+		m_captureQueue.pop();
+	}
+	m_queuedAccessUnits--;
+}
+
+// skip the access units that are too old, then forward to the next keyframe
+void V4L2DeviceSource::dropStaleAccessUnits()
+{
+	unsigned int maxDurationMs = m_maxQueueDurationMs;
+	if (maxDurationMs != 0)
+	{
+		timeval curTime;
+		gettimeofday(&curTime, NULL);
+		Frame *frame = NULL;
+		while ((frame = m_captureQueue.front()) != NULL)
+		{
+			timeval diff;
+			timersub(&curTime, &(frame->m_timestamp), &diff);
+			if ((diff.tv_sec * 1000 + diff.tv_usec / 1000) <= maxDurationMs)
+			{
+				break;
+			}
+			LOG(DEBUG) << "drop stale access unit age:" << (diff.tv_sec * 1000 + diff.tv_usec / 1000) << "ms";
+			this->dropAccessUnit();
+			if (!m_skipToKeyFrame && this->hasInterFrames())
+			{
+				m_skipToKeyFrame = true;
+				this->requestKeyFrame("stale queue");
+			}
+		}
+	}
+
+	if (m_skipToKeyFrame)
+	{
+		Frame *frame = NULL;
+		while (((frame = m_captureQueue.front()) != NULL) && !frame->m_keyFrame)
+		{
+			this->dropAccessUnit();
+		}
+		if (frame != NULL)
+		{
+			m_skipToKeyFrame = false;
+		}
+	}
+}
+
+// ---------------------------------
+// keyframe requests, coalesced until a keyframe is captured and sent at most once per interval
+// ---------------------------------
+void V4L2DeviceSource::requestKeyFrame(const char *reason)
+{
+	if (this->hasInterFrames() && m_keyFrameRequester.request())
+	{
+		LOG(DEBUG) << "keyframe request:" << reason;
+	}
+}
+
+void V4L2DeviceSource::sendKeyFrameRequest(const timeval &tv)
+{
+	if (m_keyFrameRequester.isPending() && !m_keyFrameRequester.send(tv) && !m_keyFrameRequester.isPending())
+	{
+		if (m_keyFrameRequester.isSupported())
+		{
+			LOG(NOTICE) << "keyframe request failed errno:" << errno << " " << strerror(errno);
+		}
+		else
+		{
+			LOG(WARN) << "keyframe request not supported by the device errno:" << errno << " " << strerror(errno);
+		}
+	}
+}
+
+// ---------------------------------
+// lazy capture, STREAMON with the first consumer and STREAMOFF after the idle timeout
+// ---------------------------------
+void V4L2DeviceSource::addConsumer()
+{
+	if ((m_consumers++ == 0) && m_lazyCapture)
+	{
+		m_captureChanged = true;
+		envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+	}
+}
+
+void V4L2DeviceSource::removeConsumer()
+{
+	if ((--m_consumers == 0) && m_lazyCapture)
+	{
+		m_captureChanged = true;
+		envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+	}
+}
+
+// thread safe, a snapshot is a consumer for one idle timeout, true when the capture is lazy
+bool V4L2DeviceSource::wakeCapture()
+{
+	if (m_lazyCapture)
+	{
+		m_wakeCapture = true;
+		m_captureChanged = true;
+		envir().taskScheduler().triggerEvent(m_eventTriggerId, this);
+	}
+	return m_lazyCapture;
+}
+
+void V4L2DeviceSource::updateCapture()
+{
+	bool wake = m_wakeCapture.exchange(false);
+	if ((m_consumers > 0) || wake)
+	{
+		envir().taskScheduler().unscheduleDelayedTask(m_idleTask);
+		if (!m_capturing)
+		{
+			m_capturing = this->resumeCapture();
+		}
+	}
+	if ((m_consumers == 0) && m_capturing && (m_idleTask == NULL))
+	{
+		m_idleTask = envir().taskScheduler().scheduleDelayedTask(m_idleTimeoutMs * 1000, V4L2DeviceSource::idleTimeoutStub, this);
+	}
+}
+
+void V4L2DeviceSource::idleTimeout()
+{
+	if ((m_consumers == 0) && m_capturing)
+	{
+		if (this->pauseCapture())
+		{
+			m_capturing = false;
+		}
+		else
+		{
+			LOG(WARN) << "capture cannot be paused, the device streams continuously";
+			m_lazyCapture = false;
+		}
+	}
+}
+
+bool V4L2DeviceSource::pauseCapture()
+{
+	int fd = m_device->getFd();
+	if (m_captureMode == CAPTURE_LIVE555_THREAD)
+	{
+		envir().taskScheduler().turnOffBackgroundReadHandling(fd);
+	}
+	else if (m_captureMode == CAPTURE_REACTOR)
+	{
+		// once removed the reactor does not read the device anymore
+		CaptureReactor::getInstance()->removeDevice(fd);
+	}
+	else
+	{
+		// STREAMOFF only once the reader thread is parked, select wakes up at least every second
+		std::unique_lock<std::mutex> lock(m_captureMutex);
+		m_capturePaused = true;
+		m_captureCondition.wait(lock, [this]
+								{ return m_readerParked; });
+	}
+
+	bool paused = m_device->stopCapture();
+	if (paused)
+	{
+		// the last keyframe is older than the pause, snapshots wait for the next one
+		m_lastFrame.store(std::shared_ptr<const FrameSnapshot>());
+		LOG(NOTICE) << "capture paused fd:" << fd;
+	}
+	else
+	{
+		this->resumeCapture();
+	}
+	return paused;
+}
+
+bool V4L2DeviceSource::resumeCapture()
+{
+	int fd = m_device->getFd();
+	if (!m_capturing)
+	{
+		gettimeofday(&m_captureStart, NULL);
+		if (!m_device->startCapture())
+		{
+			// the next consumer retries
+			LOG(ERROR) << "capture cannot be resumed fd:" << fd << " error:" << strerror(errno);
+			return false;
+		}
+		m_resumes++;
+		m_waitFirstFrame = true;
+		this->requestKeyFrame("resume");
+		LOG(NOTICE) << "capture resumed fd:" << fd << " resumes:" << m_resumes;
+	}
+
+	if (m_captureMode == CAPTURE_LIVE555_THREAD)
+	{
+		envir().taskScheduler().turnOnBackgroundReadHandling(fd, V4L2DeviceSource::incomingPacketHandlerStub, this);
+	}
+	else if (m_captureMode == CAPTURE_REACTOR)
+	{
+		CaptureReactor::getInstance()->addDevice(fd, V4L2DeviceSource::readFrameStub, this);
+	}
+	else
+	{
+		{
+			std::lock_guard<std::mutex> lock(m_captureMutex);
+			m_capturePaused = false;
+		}
+		m_captureCondition.notify_all();
+	}
+	return true;
+}
+
+// publish new SDP parameters, called only when they change
+void V4L2DeviceSource::setAuxLine(const std::string &auxLine)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_auxLineMutex);
+		m_auxLine.assign(auxLine);
+	}
+	unsigned int version = m_auxLineVersion.fetch_add(1, std::memory_order_acq_rel) + 1;
+	LOG(NOTICE) << "SDP parameters version:" << version << " " << auxLine;
+}
+
+// the snapshot shares the capture buffer with the queued frames
+void V4L2DeviceSource::updateLastFrame(FrameBufferPool::Buffer *buffer, int frameSize, const timeval &ref)
+{
+	m_lastFrame.store(std::make_shared<const FrameSnapshot>(buffer, buffer->data(), frameSize, ref));
 }
 
 // split packet in frames
@@ -285,9 +734,6 @@ std::list<std::pair<unsigned char *, size_t>> V4L2DeviceSource::splitFrames(unsi
 	if (frame != NULL)
 	{
 		frameList.push_back(std::pair<unsigned char *, size_t>(frame, frameSize));
-
-		std::lock_guard<std::mutex> lock(m_lastFrameMutex);
-		m_lastFrame.assign((char *)frame, frameSize);
 	}
 	return frameList;
 }
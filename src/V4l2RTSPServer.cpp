@@ -24,13 +24,17 @@
 #include "ALSACapture.h"
 #endif
 
-StreamReplicator *V4l2RTSPServer::CreateVideoReplicator(
+bool V4l2RTSPServer::m_epollScheduler = false;
+unsigned int V4l2RTSPServer::m_nbWorkerLoops = 0;
+V4l2RTSPServer::LoopPolicy V4l2RTSPServer::m_loopPolicy = V4l2RTSPServer::LOOP_ROUNDROBIN;
+
+FrameReplicator *V4l2RTSPServer::CreateVideoReplicator(
 	const V4L2DeviceParameters &inParam,
 	int queueSize, V4L2DeviceSource::CaptureMode captureMode, int repeatConfig,
-	const std::string &outputFile, V4l2IoType ioTypeOut, V4l2Output *&out)
+	const std::string &outputFile, V4l2IoType ioTypeOut, V4l2Output *&out, const V4L2DeviceSource::CaptureOptions &options)
 {
 
-	StreamReplicator *videoReplicator = NULL;
+	FrameReplicator *videoReplicator = NULL;
 	std::string videoDev(inParam.m_devName);
 	if (!videoDev.empty())
 	{
@@ -65,7 +69,7 @@ StreamReplicator *V4l2RTSPServer::CreateVideoReplicator(
 			}
 			else
 			{
-				videoReplicator = DeviceSourceFactory::createStreamReplicator(this->env(), videoCapture->getFormat(), new VideoCaptureAccess(videoCapture), queueSize, captureMode, outfd, repeatConfig);
+				videoReplicator = DeviceSourceFactory::createFrameReplicator(this->env(), videoCapture->getFormat(), new VideoCaptureAccess(videoCapture), queueSize, captureMode, outfd, repeatConfig, options);
 				if (videoReplicator == NULL)
 				{
 					LOG(FATAL) << "Unable to create source for device " << videoDev;
@@ -238,11 +242,11 @@ snd_pcm_format_t V4l2RTSPServer::decodeAudioFormat(const std::string &fmt)
 	return audioFmt;
 }
 
-StreamReplicator *V4l2RTSPServer::CreateAudioReplicator(
+FrameReplicator *V4l2RTSPServer::CreateAudioReplicator(
 	const std::string &audioDev, const std::list<snd_pcm_format_t> &audioFmtList, int audioFreq, int audioNbChannels, int verbose,
-	int queueSize, V4L2DeviceSource::CaptureMode captureMode)
+	int queueSize, V4L2DeviceSource::CaptureMode captureMode, const V4L2DeviceSource::CaptureOptions &options)
 {
-	StreamReplicator *audioReplicator = NULL;
+	FrameReplicator *audioReplicator = NULL;
 	if (!audioDev.empty())
 	{
 		// find the ALSA device associated with the V4L2 device
@@ -255,7 +259,7 @@ StreamReplicator *V4l2RTSPServer::CreateAudioReplicator(
 		ALSACapture *audioCapture = ALSACapture::createNew(param);
 		if (audioCapture)
 		{
-			audioReplicator = DeviceSourceFactory::createStreamReplicator(this->env(), 0, audioCapture, queueSize, captureMode);
+			audioReplicator = DeviceSourceFactory::createFrameReplicator(this->env(), 0, audioCapture, queueSize, captureMode, -1, true, options);
 			if (audioReplicator == NULL)
 			{
 				LOG(FATAL) << "Unable to create source for device " << audioDevice;
@@ -0,0 +1,121 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** WorkerLoop.cpp
+**
+** event loop running in its own thread that serves unicast RTSP clients
+**
+** -------------------------------------------------------------------------*/
+
+#include "logger.h"
+#include "WorkerLoop.h"
+#include "UnicastServerMediaSubsession.h"
+
+WorkerLoop::WorkerLoop(TaskScheduler *scheduler, Port rtspPort, const std::list<std::string> &userPasswordList, const char *realm, unsigned reclamationTestSeconds, const std::string &sslCert, bool enableRTSPS, unsigned int keepAliveTimeout, unsigned int keepAliveMaxConnections)
+	: m_env(BasicUsageEnvironment::createNew(*scheduler)), m_server(NULL), m_stop(0), m_pendingConnections(0), m_tasksTrigger(0)
+{
+	// HLS and MPEG-DASH are served by the main server
+	m_server = HTTPServer::createWorker(*m_env, rtspPort, userPasswordList, realm, reclamationTestSeconds, 0, "", sslCert, enableRTSPS, keepAliveTimeout, keepAliveMaxConnections);
+	m_tasksTrigger = m_env->taskScheduler().createEventTrigger(WorkerLoop::runTasksStub);
+	m_thread = std::thread(&WorkerLoop::thread, this);
+}
+
+WorkerLoop::~WorkerLoop()
+{
+	this->post([this]() { m_stop = 1; });
+	m_thread.join();
+
+	TaskScheduler *scheduler = &(m_env->taskScheduler());
+	m_env->reclaim();
+	delete scheduler;
+}
+
+// ---------------------------------
+// tasks posted by the other threads
+// ---------------------------------
+void WorkerLoop::post(const std::function<void()> &task)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_tasksMutex);
+		m_tasks.push_back(task);
+	}
+	m_env->taskScheduler().triggerEvent(m_tasksTrigger, this);
+}
+
+void WorkerLoop::runTasks()
+{
+	std::deque<std::function<void()>> tasks;
+	{
+		std::lock_guard<std::mutex> lock(m_tasksMutex);
+		tasks.swap(m_tasks);
+	}
+	for (const std::function<void()> &task : tasks)
+	{
+		task();
+	}
+}
+
+void WorkerLoop::thread()
+{
+	LOG(NOTICE) << "begin worker loop";
+	m_env->taskScheduler().doEventLoop(&m_stop);
+
+	// sessions are closed before the mirrors that feed them
+	Medium::close(m_server);
+	for (FrameReplicator *mirror : m_mirrors)
+	{
+		Medium::close(mirror);
+	}
+	m_env->taskScheduler().deleteEventTrigger(m_tasksTrigger);
+	LOG(NOTICE) << "end worker loop";
+}
+
+// ---------------------------------
+// called from the main loop
+// ---------------------------------
+void WorkerLoop::addClientConnection(int clientSocket, struct SOCKETCLIENT clientAddr)
+{
+	struct SOCKETCLIENTSTORAGE addr = clientAddr;
+	m_pendingConnections++;
+	this->post([this, clientSocket, addr]() {
+		m_server->addClientConnection(clientSocket, addr);
+		m_pendingConnections--;
+	});
+}
+
+void WorkerLoop::addUnicastSession(const std::string &url, FrameReplicator *videoReplicator, FrameReplicator *audioReplicator, const RtpSendOptions &rtpSendOptions)
+{
+	this->post([this, url, videoReplicator, audioReplicator, rtpSendOptions]() {
+		ServerMediaSession *sms = ServerMediaSession::createNew(*m_env, url.c_str());
+		if (videoReplicator)
+		{
+			FrameReplicator *mirror = videoReplicator->createMirror(*m_env);
+			m_mirrors.push_back(mirror);
+			sms->addSubsession(UnicastServerMediaSubsession::createNew(*m_env, mirror, rtpSendOptions));
+		}
+		if (audioReplicator)
+		{
+			FrameReplicator *mirror = audioReplicator->createMirror(*m_env);
+			m_mirrors.push_back(mirror);
+			sms->addSubsession(UnicastServerMediaSubsession::createNew(*m_env, mirror, rtpSendOptions));
+		}
+		m_server->addServerMediaSession(sms);
+	});
+}
+
+void WorkerLoop::removeSession(const std::string &url)
+{
+	this->post([this, url]() { m_server->deleteServerMediaSession(url.c_str()); });
+}
+
+void WorkerLoop::addUserRecord(const std::string &username, const std::string &password)
+{
+	this->post([this, username, password]() { m_server->addUserRecord(username.c_str(), password.c_str()); });
+}
+
+void WorkerLoop::setTLS(const std::string &sslCert, bool enableRTSPS, bool encryptSRTP)
+{
+	this->post([this, sslCert, enableRTSPS, encryptSRTP]() { m_server->setTLS(sslCert, enableRTSPS, encryptSRTP); });
+}
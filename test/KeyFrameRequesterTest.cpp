@@ -0,0 +1,127 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** KeyFrameRequesterTest.cpp
+**
+** Keyframe requests checked with a mock device
+**
+** -------------------------------------------------------------------------*/
+
+#include <errno.h>
+
+#include <iostream>
+
+#include "KeyFrameRequester.h"
+
+// ---------------------------------
+// device that counts the requests, a non zero error makes them fail
+// ---------------------------------
+class MockDevice : public DeviceInterface
+{
+public:
+	MockDevice() : m_requests(0), m_error(0) {}
+
+	virtual size_t read(char *buffer, size_t bufferSize) { return 0; }
+	virtual int getFd() { return -1; }
+	virtual unsigned long getBufferSize() { return 0; }
+	virtual bool requestKeyFrame()
+	{
+		m_requests++;
+		errno = m_error;
+		return (m_error == 0);
+	}
+
+	unsigned int m_requests;
+	int m_error;
+};
+
+static int failures = 0;
+
+static void check(bool condition, const char *message)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << message << std::endl;
+		failures++;
+	}
+}
+
+static timeval at(long ms)
+{
+	timeval tv = {ms / 1000, (ms % 1000) * 1000};
+	return tv;
+}
+
+static void testInterval()
+{
+	MockDevice device;
+	KeyFrameRequester requester(&device, 1000);
+
+	check(requester.request(), "first request is pending");
+	check(!requester.request(), "requests are coalesced");
+	check(requester.send(at(10000)), "first request is sent");
+	check(device.m_requests == 1, "device asked once");
+
+	check(requester.request(), "new request after send");
+	check(!requester.send(at(10500)), "request held during the interval");
+	check(requester.isPending(), "held request stays pending");
+	check(requester.send(at(11000)), "request sent after the interval");
+	check(device.m_requests == 2, "device asked twice");
+	check(requester.getRequests() == 2, "requests counted");
+}
+
+static void testKeyFrameCaptured()
+{
+	MockDevice device;
+	KeyFrameRequester requester(&device, 1000);
+
+	requester.request();
+	requester.keyFrameCaptured();
+	check(!requester.isPending(), "keyframe clears the pending request");
+	check(!requester.send(at(10000)), "nothing sent after a keyframe");
+	check(device.m_requests == 0, "device not asked after a keyframe");
+}
+
+static void testUnsupported()
+{
+	MockDevice device;
+	KeyFrameRequester requester(&device, 1000);
+
+	device.m_error = EBUSY;
+	requester.request();
+	check(!requester.send(at(10000)), "busy device fails");
+	check(requester.isSupported(), "transient error is not latched");
+
+	device.m_error = EINVAL;
+	check(requester.request(), "request after a transient error");
+	check(!requester.send(at(11000)), "missing control fails");
+	check(!requester.isSupported(), "missing control is latched");
+	check(!requester.request(), "no request once unsupported");
+	check(!requester.send(at(12000)), "nothing sent once unsupported");
+	check(device.m_requests == 2, "device not asked once unsupported");
+}
+
+static void testDisabled()
+{
+	MockDevice device;
+	KeyFrameRequester requester(&device, 0);
+
+	check(!requester.request(), "interval 0 disables the requests");
+	check(!requester.send(at(10000)), "nothing sent when disabled");
+	check(device.m_requests == 0, "device not asked when disabled");
+}
+
+int main()
+{
+	testInterval();
+	testKeyFrameCaptured();
+	testUnsupported();
+	testDisabled();
+	if (failures == 0)
+	{
+		std::cout << "KeyFrameRequester OK" << std::endl;
+	}
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,142 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** StartCodeScannerTest.cpp
+**
+** Start code scanner checked against a brute-force search
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+
+#include <iostream>
+#include <vector>
+
+#include "StartCodeScanner.h"
+
+static int failures = 0;
+
+static void check(bool condition, const char *implementation, const char *message)
+{
+	if (!condition)
+	{
+		std::cerr << "FAILED: " << implementation << " " << message << std::endl;
+		failures++;
+	}
+}
+
+static size_t bruteForceFind(const unsigned char *buffer, size_t size, size_t pos)
+{
+	for (; pos + 3 <= size; pos++)
+	{
+		if ((buffer[pos] == 0) && (buffer[pos + 1] == 0) && (buffer[pos + 2] == 1))
+		{
+			return pos;
+		}
+	}
+	return size;
+}
+
+// mostly 0 and 1 bytes, so that start codes and near misses are frequent
+static std::vector<unsigned char> randomBuffer(size_t size)
+{
+	std::vector<unsigned char> buffer(size);
+	for (size_t i = 0; i < size; i++)
+	{
+		int value = rand() % 8;
+		buffer[i] = (value < 5) ? 0 : (value < 7) ? 1 : (rand() % 256);
+	}
+	return buffer;
+}
+
+static void testFindStartCode(const char *implementation)
+{
+	for (int iteration = 0; iteration < 2000; iteration++)
+	{
+		// the buffer has no extra byte, a kernel reading past its end is caught by the sanitizers
+		std::vector<unsigned char> buffer = randomBuffer(rand() % 200);
+		for (size_t pos = 0; pos <= buffer.size(); pos++)
+		{
+			size_t expected = bruteForceFind(buffer.data(), buffer.size(), pos);
+			if (StartCodeScanner::findStartCode(buffer.data(), buffer.size(), pos) != expected)
+			{
+				check(false, implementation, "findStartCode differs from the brute-force search");
+				return;
+			}
+		}
+	}
+
+	// long buffers without start code exercise the vector loops
+	std::vector<unsigned char> buffer(1000, 0x55);
+	check(StartCodeScanner::findStartCode(buffer.data(), buffer.size(), 0) == buffer.size(), implementation, "no start code");
+	buffer[997] = 0;
+	buffer[998] = 0;
+	buffer[999] = 1;
+	check(StartCodeScanner::findStartCode(buffer.data(), buffer.size(), 0) == 997, implementation, "start code at the end");
+}
+
+static void testScan(const char *implementation)
+{
+	StartCodeScanner scanner;
+	for (int iteration = 0; iteration < 2000; iteration++)
+	{
+		std::vector<unsigned char> buffer = randomBuffer(rand() % 200);
+		const std::vector<StartCodeScanner::NalUnit> &nalList = scanner.scan(buffer.data(), buffer.size());
+
+		// every start code opens a NAL unit, empty ones are skipped
+		size_t count = 0;
+		bool same = true;
+		size_t pos = bruteForceFind(buffer.data(), buffer.size(), 0);
+		while (pos < buffer.size())
+		{
+			size_t start = pos + 3;
+			size_t next = bruteForceFind(buffer.data(), buffer.size(), start);
+			size_t end = ((next < buffer.size()) && (next > start) && (buffer[next - 1] == 0)) ? next - 1 : next;
+			if (end > start)
+			{
+				unsigned int markerLength = ((pos > 0) && (buffer[pos - 1] == 0)) ? 4 : 3;
+				same = same && (count < nalList.size()) && (nalList[count].m_data == &buffer[start]) && (nalList[count].m_size == end - start) && (nalList[count].m_markerLength == markerLength) && (nalList[count].m_marker == &buffer[start - markerLength]) && (nalList[count].m_type == buffer[start]);
+				count++;
+			}
+			pos = next;
+		}
+		if (!same || (count != nalList.size()))
+		{
+			check(false, implementation, "scan differs from the brute-force split");
+			return;
+		}
+	}
+
+	// SPS, PPS and IDR with a 4 bytes then 3 bytes start codes
+	unsigned char frame[] = {0, 0, 0, 1, 0x67, 0x42, 0, 0, 1, 0x68, 0xce, 0, 0, 0, 1, 0x65, 0x88, 0x84};
+	const std::vector<StartCodeScanner::NalUnit> &nalList = scanner.scan(frame, sizeof(frame));
+	check(nalList.size() == 3, implementation, "number of NAL units");
+	if (nalList.size() == 3)
+	{
+		check((nalList[0].m_type == 0x67) && (nalList[0].m_markerLength == 4) && (nalList[0].m_size == 2), implementation, "SPS");
+		check((nalList[1].m_type == 0x68) && (nalList[1].m_markerLength == 3) && (nalList[1].m_size == 2), implementation, "PPS");
+		check((nalList[2].m_type == 0x65) && (nalList[2].m_markerLength == 4) && (nalList[2].m_size == 3), implementation, "IDR");
+	}
+}
+
+int main()
+{
+	const char *implementations[] = {"scalar", "sse2", "avx2", "neon"};
+	for (const char *implementation : implementations)
+	{
+		if (StartCodeScanner::setImplementation(implementation))
+		{
+			srand(1);
+			testFindStartCode(implementation);
+			testScan(implementation);
+			std::cout << implementation << " checked" << std::endl;
+		}
+	}
+	if (failures == 0)
+	{
+		std::cout << "OK" << std::endl;
+	}
+	return (failures == 0) ? 0 : 1;
+}
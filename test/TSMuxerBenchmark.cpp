@@ -0,0 +1,105 @@
+/* ---------------------------------------------------------------------------
+** This software is in the public domain, furnished "as is", without technical
+** support, and with no warranty, express or implied, as to its usefulness for
+** any purpose.
+**
+** TSMuxerBenchmark.cpp
+**
+** Throughput of the MPEG-TS muxer on a synthetic H264 stream
+**
+** usage: tsmuxer_benchmark [seconds of video]
+**
+** -------------------------------------------------------------------------*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include <chrono>
+#include <iostream>
+#include <string>
+
+#include "BasicUsageEnvironment.hh"
+
+#include "H264_V4l2DeviceSource.h"
+#include "TSMuxerSink.h"
+
+// ---------------------------------
+// frames are given to the muxer as the replica would, without the event loop
+// ---------------------------------
+class BenchmarkSink : public TSMuxerSink
+{
+public:
+	BenchmarkSink(UsageEnvironment &env, V4L2DeviceSource *device) : TSMuxerSink(env, "video/H264", device, SEGMENT_ARENA_CHUNK_SIZE, 2, 0, 5) {}
+
+	void mux(const std::string &frame, const timeval &presentationTime)
+	{
+		memcpy(m_buffer, frame.c_str(), frame.size());
+		this->afterGettingFrame(frame.size(), 0, presentationTime);
+	}
+	unsigned int getSegments() { return m_sequence; }
+};
+
+// NAL unit with its start code, the payload has no start code
+static std::string createNal(unsigned char header, unsigned int size)
+{
+	std::string nal("\0\0\0\1", 4);
+	nal += (char)header;
+	for (unsigned int i = 0; i < size; i++)
+	{
+		nal += (char)(0x80 | (rand() & 0x7F));
+	}
+	return nal;
+}
+
+int main(int argc, char **argv)
+{
+	unsigned int seconds = (argc > 1) ? atoi(argv[1]) : 600;
+	const unsigned int fps = 30;
+	const unsigned int gop = 60;
+
+	TaskScheduler *scheduler = BasicTaskScheduler::createNew();
+	UsageEnvironment *env = BasicUsageEnvironment::createNew(*scheduler);
+
+	// the source only tells the keyframes, it does not capture
+	V4L2DeviceSource *device = H264_V4L2DeviceSource::createNew(*env, NULL, -1, 5, V4L2DeviceSource::NOCAPTURE, false, true);
+	BenchmarkSink *sink = new BenchmarkSink(*env, device);
+
+	// 4Mbps 1080p like stream
+	std::string sps = createNal(0x67, 20);
+	std::string pps = createNal(0x68, 4);
+	std::string idr = createNal(0x65, 50000);
+	std::string slice = createNal(0x41, 15000);
+
+	unsigned long frames = 0;
+	unsigned long bytes = 0;
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	for (unsigned int i = 0; i < seconds * fps; i++)
+	{
+		timeval presentationTime = {(time_t)(i / fps), (suseconds_t)((i % fps) * 1000000 / fps)};
+		if (i % gop == 0)
+		{
+			sink->mux(sps, presentationTime);
+			sink->mux(pps, presentationTime);
+			sink->mux(idr, presentationTime);
+			bytes += sps.size() + pps.size() + idr.size();
+		}
+		else
+		{
+			sink->mux(slice, presentationTime);
+			bytes += slice.size();
+		}
+		frames++;
+	}
+	double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	std::cout << "frames:" << frames << " bytes:" << bytes << " segments:" << sink->getSegments()
+			  << " time:" << (unsigned long)(elapsed * 1000) << "ms"
+			  << " rate:" << (unsigned long)(bytes / elapsed / 1000000) << "MB/s"
+			  << " frames/s:" << (unsigned long)(frames / elapsed) << std::endl;
+
+	Medium::close(sink);
+	Medium::close(device);
+	env->reclaim();
+	delete scheduler;
+	return 0;
+}